@@ -0,0 +1,133 @@
+#ifndef ASYNCIMAGEWRITER_H
+#define ASYNCIMAGEWRITER_H
+
+
+#include <string>
+#include <deque>
+#include <utility>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <iostream>
+
+#include "itkImage.h"
+#include "itkImageFileWriter.h"
+
+#include "StageTracer.h"
+
+
+//Writes images on a background thread. At most maxQueued images wait for
+//encoding at any time, Write blocks when the queue is full so memory stays
+//bounded and TryWrite drops the image instead. Images handed to Write must
+//not be modified afterwards.
+template <typename TImage>
+class AsyncImageWriter{
+
+  public:
+
+    typedef TImage Image;
+    typedef typename Image::Pointer ImagePointer;
+
+    typedef typename itk::ImageFileWriter<Image> ImageWriter;
+    typedef typename ImageWriter::Pointer ImageWriterPointer;
+
+
+  AsyncImageWriter(unsigned int maxQueued = 4) : m_MaxQueued(maxQueued), m_Compression(false),
+                                                 m_Done(false) {
+    m_Thread = std::thread( &AsyncImageWriter::Run, this );
+  };
+
+  ~AsyncImageWriter(){
+    Finish();
+  };
+
+
+  void Write(ImagePointer image, const std::string &filename){
+    std::unique_lock<std::mutex> lock(m_Mutex);
+    m_NotFull.wait( lock, [this]{ return m_Queue.size() < m_MaxQueued; } );
+    m_Queue.push_back( std::make_pair(image, filename) );
+    m_NotEmpty.notify_one();
+  };
+
+
+  //Queue the image if there is room, returns false if it was dropped
+  bool TryWrite(ImagePointer image, const std::string &filename){
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    if( m_Queue.size() >= m_MaxQueued ){
+      return false;
+    }
+    m_Queue.push_back( std::make_pair(image, filename) );
+    m_NotEmpty.notify_one();
+    return true;
+  };
+
+
+  //Compress images written from now on if the file format supports it
+  void SetUseCompression(bool compression){
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_Compression = compression;
+  };
+
+
+  //Wait until all queued images are written and stop the writer thread
+  void Finish(){
+    {
+      std::lock_guard<std::mutex> lock(m_Mutex);
+      if( m_Done ){
+        return;
+      }
+      m_Done = true;
+    }
+    m_NotEmpty.notify_one();
+    m_Thread.join();
+  };
+
+
+
+  private:
+
+    void Run(){
+      while(true){
+        std::pair<ImagePointer, std::string> job;
+        bool compression;
+        {
+          std::unique_lock<std::mutex> lock(m_Mutex);
+          m_NotEmpty.wait( lock, [this]{ return m_Done || !m_Queue.empty(); } );
+          if( m_Queue.empty() ){
+            return;
+          }
+          job = m_Queue.front();
+          m_Queue.pop_front();
+          compression = m_Compression;
+          m_NotFull.notify_one();
+        }
+
+        TraceSpan span( "Write image" );
+        try{
+          ImageWriterPointer writer = ImageWriter::New();
+          writer->SetFileName( job.second );
+          writer->SetInput( job.first );
+          writer->SetUseCompression( compression );
+          writer->Update();
+        }
+        catch( itk::ExceptionObject & err ){
+          std::cerr << "Failed to write " << job.second << std::endl;
+          std::cerr << err << std::endl;
+        }
+      }
+    };
+
+
+    unsigned int m_MaxQueued;
+    bool m_Compression;
+    bool m_Done;
+    std::deque< std::pair<ImagePointer, std::string> > m_Queue;
+    std::mutex m_Mutex;
+    std::condition_variable m_NotEmpty;
+    std::condition_variable m_NotFull;
+    std::thread m_Thread;
+
+};
+
+
+#endif
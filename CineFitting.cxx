@@ -0,0 +1,191 @@
+#include "CineFitting.h"
+
+#include "StageTracer.h"
+
+#include "itkShrinkImageFilter.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+
+double median(std::vector<double> values){
+  if( values.empty() ){
+    return 0;
+  }
+  size_t n = values.size() / 2;
+  std::nth_element( values.begin(), values.begin() + n, values.end() );
+  double m = values[n];
+  if( values.size() % 2 == 0 ){
+    m = 0.5 * ( m + *std::max_element( values.begin(), values.begin() + n ) );
+  }
+  return m;
+};
+
+
+
+FrameScore scoreFrame(ImageType::Pointer image, const FitParameters &parameters,
+                      unsigned int shrinkFactor){
+
+  TraceSpan spanScore( "Score frame" );
+
+  FrameScore score;
+  if( parameters.inputGate && gateInput( image, parameters ) != FIT_OK ){
+    return score;
+  }
+
+  //Coarse copy, smoothing is in physical units and unaffected
+  typedef itk::ShrinkImageFilter<ImageType, ImageType> ShrinkFilter;
+  ShrinkFilter::Pointer shrinkFilter = ShrinkFilter::New();
+  shrinkFilter->SetInput( image );
+  shrinkFilter->SetShrinkFactors( std::max( 1u, shrinkFactor ) );
+  shrinkFilter->Update();
+  ImageType::Pointer coarse = ITKFilterFunctions<ImageType>::Rescale( shrinkFilter->GetOutput(), 0, 100 );
+
+  ImageType::SpacingType imageSpacing = image->GetSpacing();
+  ImageType::SizeType coarseSize = coarse->GetLargestPossibleRegion().GetSize();
+  ImageType::SpacingType coarseSpacing = coarse->GetSpacing();
+  int f = std::max( 1u, shrinkFactor );
+
+
+  //Eye, steps A 2. to 4.4 without the closing
+  ITKFilterFunctions<ImageType>::SigmaArrayType sigma;
+  sigma[0] = parameters.eyeSigma * imageSpacing[0];
+  sigma[1] = parameters.eyeSigma * imageSpacing[1];
+
+  ITKPipeline<ImageType> eyePipeline( coarse );
+  eyePipeline.AddHorizontalBorder( std::max( 1, 30 / f ) )
+             .GaussSmooth( sigma )
+             .BinaryThreshold( -1, parameters.eyeThreshold, 0, 100 )
+             .AddVerticalBorder( std::max( 1, 50 / f ) );
+
+  CastFilter::Pointer castFilter = CastFilter::New();
+  castFilter->SetInput( eyePipeline.Update() );
+  SignedDistanceFilter::Pointer signedDistanceFilter = SignedDistanceFilter::New();
+  signedDistanceFilter->SetInput( castFilter->GetOutput() );
+  signedDistanceFilter->SetInsideValue(100);
+  signedDistanceFilter->SetOutsideValue(0);
+  signedDistanceFilter->Update();
+
+  ImageCalculatorFilterType::Pointer imageCalculatorFilter = ImageCalculatorFilterType::New();
+  imageCalculatorFilter->SetImage( signedDistanceFilter->GetOutput() );
+  imageCalculatorFilter->Compute();
+  double radius = imageCalculatorFilter->GetMaximum();
+  ImageType::IndexType center = imageCalculatorFilter->GetIndexOfMaximum();
+  if( radius <= 0 ){
+    return score;
+  }
+  double height = coarseSize[1] * coarseSpacing[1];
+  score.eye = std::min( 1.0, radius / ( 0.25 * height ) );
+
+
+  //Stem, region below the eye as in step A 1. with the eye radius for
+  //both axes, smoothed as in step A 2.
+  long r = (long) ( radius / coarseSpacing[1] );
+  long xStart = std::max( 0l, (long) center[0] - r );
+  long xEnd = std::min( (long) coarseSize[0], (long) center[0] + r );
+  long yStart = center[1] + r;
+  long yEnd = std::min( (long) coarseSize[1], (long) ( center[1] + 2.2 * r ) );
+  if( xEnd - xStart < 3 || yEnd - yStart < 1 ){
+    return score;
+  }
+  ImageType::IndexType stemIndex;
+  stemIndex[0] = xStart;
+  stemIndex[1] = yStart;
+  ImageType::SizeType stemSize;
+  stemSize[0] = xEnd - xStart;
+  stemSize[1] = yEnd - yStart;
+
+  sigma[0] = parameters.stemSigmaX * imageSpacing[0];
+  sigma[1] = parameters.stemSigmaY * imageSpacing[1];
+  ITKPipeline<ImageType> stemPipeline( coarse );
+  stemPipeline.Extract( ImageType::RegionType( stemIndex, stemSize ) ).GaussSmooth( sigma );
+  ImageType::Pointer stemImage = stemPipeline.Update();
+
+  const PixelType *buffer = stemImage->GetBufferPointer();
+  double contrast = 0;
+  double sharpness = 0;
+  for(unsigned long y=0; y<stemSize[1]; y++){
+    const PixelType *row = buffer + y * stemSize[0];
+    double minValue = row[0];
+    double maxValue = row[0];
+    double maxStep = 0;
+    for(unsigned long x=1; x<stemSize[0]; x++){
+      minValue = std::min( minValue, (double) row[x] );
+      maxValue = std::max( maxValue, (double) row[x] );
+      maxStep = std::max( maxStep, (double) std::fabs( row[x] - row[x-1] ) );
+    }
+    contrast += ( maxValue - minValue ) / 100.0;
+    if( maxValue > minValue ){
+      sharpness += maxStep / ( maxValue - minValue );
+    }
+  }
+  score.stemContrast = contrast / stemSize[1];
+  score.stemSharpness = sharpness / stemSize[1];
+
+  score.score = score.eye * score.stemContrast * score.stemSharpness;
+  return score;
+};
+
+
+
+CineResult fitCine(const std::vector<ImageType::Pointer> &frames, unsigned int k,
+                   const FitParameters &parameters, unsigned int shrinkFactor,
+                   double outlierFactor){
+
+  CineResult result;
+
+  TraceSpan spanScores( "Score frames" );
+  std::vector<FrameScore> ranked;
+  for(unsigned int i=0; i<frames.size(); i++){
+    FrameScore score = scoreFrame( frames[i], parameters, shrinkFactor );
+    score.frame = i;
+    result.scores.push_back( score );
+    if( score.score > 0 ){
+      ranked.push_back( score );
+    }
+  }
+  std::stable_sort( ranked.begin(), ranked.end(),
+                    [](const FrameScore &a, const FrameScore &b){ return a.score > b.score; } );
+  spanScores.Stop();
+
+
+  TraceSpan spanFits( "Fit frames" );
+  for(unsigned int i=0; i<ranked.size() && result.selected.size() < k; i++){
+    ImageType::Pointer frame = frames[ ranked[i].frame ];
+    Eye eye = fitEye( frame, "", parameters );
+    Stem stem = fitStem( frame, eye, "", parameters );
+    if( stem.status != FIT_OK || stem.width <= 0 ){
+      continue;
+    }
+    result.selected.push_back( ranked[i].frame );
+    result.widths.push_back( 2 * stem.width );
+  }
+  spanFits.Stop();
+
+  if( result.widths.empty() ){
+    return result;
+  }
+
+
+  //Median with rejection by the scaled median absolute deviation
+  double m = median( result.widths );
+  std::vector<double> deviations;
+  for(unsigned int i=0; i<result.widths.size(); i++){
+    deviations.push_back( std::fabs( result.widths[i] - m ) );
+  }
+  result.mad = median( deviations );
+
+  std::vector<double> inlierWidths;
+  double limit = outlierFactor * 1.4826 * result.mad;
+  for(unsigned int i=0; i<result.widths.size(); i++){
+    bool inlier = deviations[i] <= limit;
+    result.inliers.push_back( inlier );
+    if( inlier ){
+      inlierWidths.push_back( result.widths[i] );
+    }
+  }
+  result.width = median( inlierWidths );
+
+  return result;
+};
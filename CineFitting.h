@@ -0,0 +1,69 @@
+#ifndef CINEFITTING_H
+#define CINEFITTING_H
+
+
+//Optic nerve width from a cine loop.
+//
+//All frames are scored on a coarse copy with a fraction of the cost of a
+//fit, only the best k frames are fitted by fitEye and fitStem and their
+//widths are combined by a median with outlier rejection.
+//
+//The frame score is the product of three terms in [0, 1]:
+// - eye: maximum of the distance transform of the thresholded eye (steps
+//   A 1. to 4.3 of the eye estimation without the closing) relative to a
+//   quarter of the image height
+// - stem contrast: mean range of the rows of the region below the eye
+//   after the anisotropic smoothing of step A 2. of the stem estimation
+// - stem sharpness: mean of the steepest horizontal step of each of these
+//   rows relative to its range
+
+
+#include <vector>
+
+#include "EyeAndStemFitting.h"
+
+
+struct FrameScore{
+  unsigned int frame = 0;
+  double score = 0;
+  double eye = 0;
+  double stemContrast = 0;
+  double stemSharpness = 0;
+};
+
+
+
+struct CineResult{
+  //Scores of all frames in frame order
+  std::vector<FrameScore> scores;
+
+  //Fitted frames in order of decreasing score with their optic nerve
+  //width and whether it was used for the aggregate
+  std::vector<unsigned int> selected;
+  std::vector<double> widths;
+  std::vector<bool> inliers;
+
+  //Median of the inlier widths, -1 if no frame could be fitted, and the
+  //median absolute deviation of all fitted widths
+  double width = -1;
+  double mad = 0;
+};
+
+
+
+//Score a frame, images rejected by gateInput (if enabled) score zero
+FrameScore scoreFrame(ImageType::Pointer image,
+                      const FitParameters &parameters = FitParameters(),
+                      unsigned int shrinkFactor = 4);
+
+//Score all frames and fit the best k. Fitted widths further than
+//outlierFactor scaled median absolute deviations from the median are
+//rejected.
+CineResult fitCine(const std::vector<ImageType::Pointer> &frames, unsigned int k,
+                   const FitParameters &parameters = FitParameters(),
+                   unsigned int shrinkFactor = 4, double outlierFactor = 3);
+
+double median(std::vector<double> values);
+
+
+#endif
@@ -0,0 +1,397 @@
+//Compares a candidate configuration of the fitting against the reference
+//configuration over a set of images.
+//
+//Every fit runs in its own child process, so that wall time and peak
+//resident memory are measured per fit and a crashing configuration does
+//not take down the comparison. For each image the differences of eye
+//center, minor and major axis and optic nerve width between candidate and
+//reference are reported next to the times and peak memory of both. If a
+//ground truth file <image without extension>.txt as written by
+//GeneratePhantom exists, the errors of both against it are reported too.
+//
+//The exit code is non-zero if any difference exceeds its tolerance or the
+//candidate fails on an image the reference fits.
+//
+//Configurations are given as name=value parameter assignments, see
+//FitParameters in EyeAndStemFitting.h:
+//
+//  CompareEyeAndStemFits -c eyeShrinkFactors=16,8 phantom-*.png
+
+
+
+#include <tclap/CmdLine.h>
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cmath>
+#include <limits>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "EyeAndStemFitting.h"
+#include "PhantomGenerator.h"
+#include "ImageIO.h"
+
+
+
+//Result of a single fit, passed from the child process through a pipe
+struct FitResult{
+  bool ok;
+  double eyeCenter[2];
+  double eyeMinor;
+  double eyeMajor;
+  double nerveWidth;
+  double seconds;
+  //Peak resident memory in kilobytes
+  long peakMemory;
+  //Registration convergence, see RegistrationTelemetry
+  unsigned int eyeIterations;
+  unsigned int eyeEvaluations;
+  unsigned int stemIterations;
+  unsigned int stemEvaluations;
+  //FitLevel of the eye and stem estimates
+  int eyeLevel;
+  int stemLevel;
+  //Status of the stem, FIT_ERROR if the fit did not complete
+  FitStatus status;
+};
+
+
+//Result of a fit that did not complete, geometry is NaN
+FitResult failedFitResult(){
+  FitResult result;
+  result.ok = false;
+  result.eyeCenter[0] = std::numeric_limits<double>::quiet_NaN();
+  result.eyeCenter[1] = std::numeric_limits<double>::quiet_NaN();
+  result.eyeMinor = std::numeric_limits<double>::quiet_NaN();
+  result.eyeMajor = std::numeric_limits<double>::quiet_NaN();
+  result.nerveWidth = std::numeric_limits<double>::quiet_NaN();
+  result.seconds = 0;
+  result.peakMemory = 0;
+  result.eyeIterations = 0;
+  result.eyeEvaluations = 0;
+  result.stemIterations = 0;
+  result.stemEvaluations = 0;
+  result.eyeLevel = FIT_NONE;
+  result.stemLevel = FIT_NONE;
+  result.status = FIT_ERROR;
+  return result;
+};
+
+
+
+FitResult runFit(const std::string &filename, const FitParameters &parameters){
+  FitResult result = failedFitResult();
+  try{
+    ImageType::Pointer image = ImageIO<ImageType>::ReadImage( filename );
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    Eye eye = fitEye( image, "", parameters );
+    Stem stem = fitStem( image, eye, "", parameters );
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+    result.seconds = std::chrono::duration<double>( end - start ).count();
+    result.eyeCenter[0] = eye.center[0];
+    result.eyeCenter[1] = eye.center[1];
+    result.eyeMinor = eye.minor;
+    result.eyeMajor = eye.major;
+    result.nerveWidth = 2 * stem.width;
+    result.status = stem.status;
+    result.ok = stem.status == FIT_OK && stem.width > 0;
+    result.eyeIterations = eye.registration.TotalIterations();
+    result.eyeEvaluations = eye.registration.TotalEvaluations();
+    result.stemIterations = stem.registration.TotalIterations();
+    result.stemEvaluations = stem.registration.TotalEvaluations();
+    result.eyeLevel = eye.level;
+    result.stemLevel = stem.level;
+  }
+  catch( std::exception & err ){
+    std::cerr << "Failed to fit " << filename << std::endl;
+    std::cerr << err.what() << std::endl;
+    result = failedFitResult();
+  }
+  return result;
+};
+
+
+
+//Run a fit in a child process and measure its peak memory
+FitResult runIsolatedFit(const std::string &filename, const FitParameters &parameters,
+                         bool verbose){
+  FitResult result = failedFitResult();
+
+  int fds[2];
+  if( pipe( fds ) != 0 ){
+    std::cerr << "Could not create pipe" << std::endl;
+    return result;
+  }
+
+  pid_t pid = fork();
+  if( pid < 0 ){
+    std::cerr << "Could not fork" << std::endl;
+    close( fds[0] );
+    close( fds[1] );
+    return result;
+  }
+
+  if( pid == 0 ){
+    close( fds[0] );
+    if( !verbose ){
+      int devNull = open( "/dev/null", O_WRONLY );
+      dup2( devNull, STDOUT_FILENO );
+      close( devNull );
+    }
+    FitResult childResult = runFit( filename, parameters );
+    ssize_t written = write( fds[1], &childResult, sizeof(FitResult) );
+    close( fds[1] );
+    _exit( written == sizeof(FitResult) ? 0 : 1 );
+  }
+
+  close( fds[1] );
+  size_t n = 0;
+  char *buffer = reinterpret_cast<char *>( &result );
+  while( n < sizeof(FitResult) ){
+    ssize_t r = read( fds[0], buffer + n, sizeof(FitResult) - n );
+    if( r <= 0 ){
+      break;
+    }
+    n += r;
+  }
+  close( fds[0] );
+  if( n != sizeof(FitResult) ){
+    result = failedFitResult();
+  }
+
+  int status;
+  struct rusage usage;
+  wait4( pid, &status, 0, &usage );
+  result.peakMemory = usage.ru_maxrss;
+  if( !WIFEXITED( status ) || WEXITSTATUS( status ) != 0 ){
+    std::cerr << "Fit of " << filename << " terminated abnormally" << std::endl;
+    long peakMemory = result.peakMemory;
+    result = failedFitResult();
+    result.peakMemory = peakMemory;
+  }
+  return result;
+};
+
+
+
+std::string groundTruthFilename(const std::string &filename){
+  size_t dot = filename.find_last_of( '.' );
+  size_t slash = filename.find_last_of( '/' );
+  if( dot == std::string::npos || ( slash != std::string::npos && dot < slash ) ){
+    return catStrings( filename, ".txt" );
+  }
+  return catStrings( filename.substr( 0, dot ), ".txt" );
+};
+
+
+
+double centerDistance(const double *c1, const double *c2){
+  return std::sqrt( ( c1[0] - c2[0] ) * ( c1[0] - c2[0] ) +
+                    ( c1[1] - c2[1] ) * ( c1[1] - c2[1] ) );
+};
+
+
+
+int main(int argc, char **argv ){
+
+  //Command line parsing
+  TCLAP::CmdLine cmd("Compare a candidate fitting configuration against the reference", ' ', "1");
+
+  TCLAP::MultiArg<std::string> candidateArg("c","candidate","Parameter of the candidate configuration", false,
+      "name=value");
+  cmd.add(candidateArg);
+
+  TCLAP::MultiArg<std::string> referenceArg("r","reference","Parameter of the reference configuration, defaults otherwise", false,
+      "name=value");
+  cmd.add(referenceArg);
+
+  TCLAP::ValueArg<double> centerTolArg("","center-tolerance","Maximal eye center distance", false, 2.0,
+      "double");
+  cmd.add(centerTolArg);
+
+  TCLAP::ValueArg<double> axisTolArg("","axis-tolerance","Maximal difference of eye minor and major axis", false, 2.0,
+      "double");
+  cmd.add(axisTolArg);
+
+  TCLAP::ValueArg<double> widthTolArg("","width-tolerance","Maximal difference of optic nerve width", false, 0.5,
+      "double");
+  cmd.add(widthTolArg);
+
+  TCLAP::ValueArg<std::string> csvArg("","csv","Write per image results to CSV file", false, "",
+      "filename");
+  cmd.add(csvArg);
+
+  TCLAP::SwitchArg verboseArg("v","verbose","Show output of the fits" );
+  cmd.add(verboseArg);
+
+  TCLAP::UnlabeledMultiArg<std::string> imagesArg("images","Input images", true,
+      "filename");
+  cmd.add(imagesArg);
+
+  try{
+    cmd.parse( argc, argv );
+  }
+  catch (TCLAP::ArgException &e){
+    std::cerr << "error: " << e.error() << " for arg " << e.argId() << std::endl;
+    return -1;
+  }
+
+  FitParameters reference;
+  for(unsigned int i=0; i<referenceArg.getValue().size(); i++){
+    if( !setFitParameter( reference, referenceArg.getValue()[i] ) ){
+      std::cerr << "error: invalid parameter " << referenceArg.getValue()[i] << std::endl;
+      return -1;
+    }
+  }
+  FitParameters candidate = reference;
+  for(unsigned int i=0; i<candidateArg.getValue().size(); i++){
+    if( !setFitParameter( candidate, candidateArg.getValue()[i] ) ){
+      std::cerr << "error: invalid parameter " << candidateArg.getValue()[i] << std::endl;
+      return -1;
+    }
+  }
+
+  std::cout << "Candidate:";
+  for(unsigned int i=0; i<candidateArg.getValue().size(); i++){
+    std::cout << " " << candidateArg.getValue()[i];
+  }
+  std::cout << std::endl << std::endl;
+
+  std::ofstream csv;
+  if( csvArg.isSet() ){
+    csv.open( csvArg.getValue().c_str() );
+    csv << "image,reference_ok,candidate_ok,d_center,d_minor,d_major,"
+        << "reference_width,candidate_width,d_width,"
+        << "reference_s,candidate_s,reference_kb,candidate_kb,"
+        << "truth_width,reference_width_error,candidate_width_error,"
+        << "reference_eye_iterations,candidate_eye_iterations,"
+        << "reference_eye_evaluations,candidate_eye_evaluations,"
+        << "reference_stem_iterations,candidate_stem_iterations,"
+        << "reference_stem_evaluations,candidate_stem_evaluations,"
+        << "reference_eye_level,candidate_eye_level,"
+        << "reference_stem_level,candidate_stem_level,"
+        << "reference_status,candidate_status" << std::endl;
+  }
+
+  std::cout << std::left << std::setw(32) << "image" << std::right
+            << std::setw(10) << "dCenter" << std::setw(10) << "dMinor" << std::setw(10) << "dMajor"
+            << std::setw(10) << "refWidth" << std::setw(10) << "dWidth"
+            << std::setw(10) << "ref s" << std::setw(10) << "cand s"
+            << std::setw(10) << "ref MB" << std::setw(10) << "cand MB"
+            << std::setw(12) << "truth err" << std::endl;
+
+  const std::vector<std::string> &images = imagesArg.getValue();
+  unsigned int nFailed = 0;
+  unsigned int nCompared = 0;
+  double maxCenter = 0, maxAxis = 0, maxWidth = 0;
+  double sumWidth = 0;
+  double referenceTime = 0, candidateTime = 0;
+  long referencePeak = 0, candidatePeak = 0;
+  unsigned long referenceEvaluations = 0, candidateEvaluations = 0;
+
+  for(unsigned int i=0; i<images.size(); i++){
+    FitResult r = runIsolatedFit( images[i], reference, verboseArg.getValue() );
+    FitResult c = runIsolatedFit( images[i], candidate, verboseArg.getValue() );
+
+    Phantom truth;
+    bool hasTruth = readPhantomGroundTruth( groundTruthFilename( images[i] ), truth );
+
+    referenceTime += r.seconds;
+    candidateTime += c.seconds;
+    referencePeak = std::max( referencePeak, r.peakMemory );
+    candidatePeak = std::max( candidatePeak, c.peakMemory );
+    referenceEvaluations += r.eyeEvaluations + r.stemEvaluations;
+    candidateEvaluations += c.eyeEvaluations + c.stemEvaluations;
+
+    double dCenter = centerDistance( r.eyeCenter, c.eyeCenter );
+    double dMinor = std::fabs( r.eyeMinor - c.eyeMinor );
+    double dMajor = std::fabs( r.eyeMajor - c.eyeMajor );
+    double dWidth = std::fabs( r.nerveWidth - c.nerveWidth );
+
+    bool failed = false;
+    if( r.ok ){
+      nCompared++;
+      failed = !c.ok || dCenter > centerTolArg.getValue() ||
+               dMinor > axisTolArg.getValue() || dMajor > axisTolArg.getValue() ||
+               dWidth > widthTolArg.getValue();
+      if( c.ok ){
+        maxCenter = std::max( maxCenter, dCenter );
+        maxAxis = std::max( maxAxis, std::max( dMinor, dMajor ) );
+        maxWidth = std::max( maxWidth, dWidth );
+        sumWidth += dWidth;
+      }
+    }
+    if( failed ){
+      nFailed++;
+    }
+
+    std::cout << std::left << std::setw(32) << images[i] << std::right << std::fixed << std::setprecision(3);
+    if( r.ok && c.ok ){
+      std::cout << std::setw(10) << dCenter << std::setw(10) << dMinor << std::setw(10) << dMajor
+                << std::setw(10) << r.nerveWidth << std::setw(10) << dWidth;
+    }
+    else{
+      std::cout << std::setw(50) << ( r.ok ? "candidate failed" : ( c.ok ? "reference failed" : "both failed" ) );
+    }
+    std::cout << std::setw(10) << r.seconds << std::setw(10) << c.seconds
+              << std::setw(10) << r.peakMemory / 1024.0 << std::setw(10) << c.peakMemory / 1024.0;
+    if( hasTruth ){
+      std::cout << std::setw(6) << std::setprecision(2) << r.nerveWidth - truth.nerveWidth
+                << std::setw(6) << c.nerveWidth - truth.nerveWidth;
+    }
+    std::cout << ( failed ? "  FAIL" : "" ) << std::endl;
+
+    if( csvArg.isSet() ){
+      csv << images[i] << "," << r.ok << "," << c.ok << "," << dCenter << "," << dMinor << ","
+          << dMajor << "," << r.nerveWidth << "," << c.nerveWidth << "," << dWidth << ","
+          << r.seconds << "," << c.seconds << "," << r.peakMemory << "," << c.peakMemory << ",";
+      if( hasTruth ){
+        csv << truth.nerveWidth << "," << r.nerveWidth - truth.nerveWidth << ","
+            << c.nerveWidth - truth.nerveWidth;
+      }
+      else{
+        csv << ",,";
+      }
+      csv << "," << r.eyeIterations << "," << c.eyeIterations << ","
+          << r.eyeEvaluations << "," << c.eyeEvaluations << ","
+          << r.stemIterations << "," << c.stemIterations << ","
+          << r.stemEvaluations << "," << c.stemEvaluations << ","
+          << fitLevelName( (FitLevel) r.eyeLevel ) << "," << fitLevelName( (FitLevel) c.eyeLevel ) << ","
+          << fitLevelName( (FitLevel) r.stemLevel ) << "," << fitLevelName( (FitLevel) c.stemLevel ) << ","
+          << fitStatusName( r.status ) << "," << fitStatusName( c.status );
+      csv << std::endl;
+    }
+  }
+
+  std::cout << std::endl << std::setprecision(3);
+  std::cout << "Max eye center difference: " << maxCenter << std::endl;
+  std::cout << "Max eye axis difference: " << maxAxis << std::endl;
+  std::cout << "Max optic nerve width difference: " << maxWidth << std::endl;
+  if( nCompared > 0 ){
+    std::cout << "Mean optic nerve width difference: " << sumWidth / nCompared << std::endl;
+  }
+  std::cout << "Total time reference: " << referenceTime << " s, candidate: " << candidateTime << " s";
+  if( candidateTime > 0 ){
+    std::cout << ", speedup " << referenceTime / candidateTime;
+  }
+  std::cout << std::endl;
+  std::cout << "Peak memory reference: " << referencePeak / 1024.0 << " MB, candidate: "
+            << candidatePeak / 1024.0 << " MB" << std::endl;
+  std::cout << "Registration metric evaluations reference: " << referenceEvaluations
+            << ", candidate: " << candidateEvaluations << std::endl;
+  std::cout << nFailed << " of " << nCompared << " images exceed the tolerances" << std::endl;
+
+  return nFailed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,249 @@
+#ifndef DEBUGDUMPS_H
+#define DEBUGDUMPS_H
+
+
+//Runtime selected dumps of the intermediate images of fitEye and fitStem.
+//
+//The caller marks the fit of an image with a DebugDumpCapture for the
+//prefix passed to fitEye and fitStem. Images are dumped for every Nth
+//capture and, if enabled, for failed fits. Intermediate images are
+//referenced when added and kept until the capture ends, only images a 
+//later stage modifies in place are copied. Then they are either discarded
+//or handed to compressing background writers. The writer queues are bounded, images that do not fit
+//are dropped and counted instead of stalling the fitting.
+//
+//When dumps are disabled a stage checks a single atomic flag. Failure
+//dumps capture every fit, so the stage outputs of each fit in flight stay
+//alive until it ends: about ten images of the input or stem region size.
+
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <utility>
+
+#include "itkImageDuplicator.h"
+
+#include "EyeAndStemFitting.h"
+#include "AsyncImageWriter.h"
+
+
+class DebugDumps{
+
+  public:
+
+  static DebugDumps &Instance(){
+    static DebugDumps dumps;
+    return dumps;
+  };
+
+
+  //Dump every Nth captured image, 0 for none, and all failed fits if
+  //failures is set. maxQueued bounds the images waiting for each writer.
+  void Configure(unsigned int every, bool failures, unsigned int maxQueued = 32){
+    std::lock_guard<std::mutex> lock( m_Mutex );
+    m_Every = every;
+    m_Failures = failures;
+    if( every > 0 || failures ){
+      m_ImageWriter.reset( new AsyncImageWriter<ImageType>( maxQueued ) );
+      m_MaskWriter.reset( new AsyncImageWriter<UnsignedCharImageType>( maxQueued ) );
+      m_RGBWriter.reset( new AsyncImageWriter<RGBImageType>( maxQueued ) );
+      m_ImageWriter->SetUseCompression( true );
+      m_MaskWriter->SetUseCompression( true );
+      m_RGBWriter->SetUseCompression( true );
+    }
+    m_Enabled.store( every > 0 || failures, std::memory_order_relaxed );
+  };
+
+  bool IsEnabled() const{
+    return m_Enabled.load( std::memory_order_relaxed );
+  };
+
+
+  //Whether images added for prefix are kept. Stages use this to skip
+  //creating images that are only needed for dumps.
+  bool IsCapturing(const std::string &prefix){
+    if( !IsEnabled() ){
+      return false;
+    }
+    std::lock_guard<std::mutex> lock( m_Mutex );
+    return m_Captures.find( prefix ) != m_Captures.end();
+  };
+
+
+  //Add an intermediate image, written as prefix + suffix. Images a later
+  //stage modifies in place have to be copied.
+  void Add(const std::string &prefix, ImageType::Pointer image, const std::string &suffix,
+           bool copy = false){
+    Add( prefix, image, suffix, copy, &Capture::images );
+  };
+
+  void Add(const std::string &prefix, UnsignedCharImageType::Pointer image,
+           const std::string &suffix, bool copy = false){
+    Add( prefix, image, suffix, copy, &Capture::masks );
+  };
+
+  void Add(const std::string &prefix, RGBImageType::Pointer image, const std::string &suffix,
+           bool copy = false){
+    Add( prefix, image, suffix, copy, &Capture::overlays );
+  };
+
+
+  //Start and end a capture, see DebugDumpCapture
+  void Begin(const std::string &prefix){
+    if( !IsEnabled() ){
+      return;
+    }
+    std::lock_guard<std::mutex> lock( m_Mutex );
+    bool sampled = m_Every > 0 && m_Count++ % m_Every == 0;
+    if( sampled || m_Failures ){
+      m_Captures[prefix].sampled = sampled;
+    }
+  };
+
+  void End(const std::string &prefix, bool failed){
+    if( !IsEnabled() ){
+      return;
+    }
+    Capture capture;
+    {
+      std::lock_guard<std::mutex> lock( m_Mutex );
+      std::map<std::string, Capture>::iterator it = m_Captures.find( prefix );
+      if( it == m_Captures.end() ){
+        return;
+      }
+      std::swap( capture, it->second );
+      m_Captures.erase( it );
+    }
+    if( !capture.sampled && !( failed && m_Failures ) ){
+      return;
+    }
+    Write( *m_ImageWriter, capture.images );
+    Write( *m_MaskWriter, capture.masks );
+    Write( *m_RGBWriter, capture.overlays );
+  };
+
+
+  //Wait for all queued images to be written
+  void Finish(){
+    if( m_ImageWriter ){
+      m_ImageWriter->Finish();
+      m_MaskWriter->Finish();
+      m_RGBWriter->Finish();
+    }
+  };
+
+  unsigned int NumberOfWritten() const{
+    return m_Written.load();
+  };
+
+  unsigned int NumberOfDropped() const{
+    return m_Dropped.load();
+  };
+
+
+
+  private:
+
+    template <typename TImage>
+    struct Images : public std::vector< std::pair<typename TImage::Pointer, std::string> >{};
+
+    struct Capture{
+      bool sampled = false;
+      Images<ImageType> images;
+      Images<UnsignedCharImageType> masks;
+      Images<RGBImageType> overlays;
+    };
+
+
+    DebugDumps() : m_Enabled( false ), m_Every( 0 ), m_Failures( false ), m_Count( 0 ),
+                   m_Written( 0 ), m_Dropped( 0 ) {};
+
+
+    template <typename TImage>
+    void Add(const std::string &prefix, typename TImage::Pointer image, const std::string &suffix,
+             bool copy, Images<TImage> Capture::*images){
+      if( !IsCapturing( prefix ) ){
+        return;
+      }
+      //Pipeline outputs may not be computed yet
+      image->Update();
+      if( copy ){
+        typedef itk::ImageDuplicator<TImage> Duplicator;
+        typename Duplicator::Pointer duplicator = Duplicator::New();
+        duplicator->SetInputImage( image );
+        duplicator->Update();
+        image = duplicator->GetOutput();
+      }
+      std::lock_guard<std::mutex> lock( m_Mutex );
+      std::map<std::string, Capture>::iterator it = m_Captures.find( prefix );
+      if( it != m_Captures.end() ){
+        ( it->second.*images ).push_back( std::make_pair( image, prefix + suffix ) );
+      }
+    };
+
+
+    template <typename TImage>
+    void Write(AsyncImageWriter<TImage> &writer, const Images<TImage> &images){
+      for(unsigned int i=0; i<images.size(); i++){
+        if( writer.TryWrite( images[i].first, images[i].second ) ){
+          m_Written++;
+        }
+        else{
+          m_Dropped++;
+        }
+      }
+    };
+
+
+    std::atomic<bool> m_Enabled;
+    unsigned int m_Every;
+    bool m_Failures;
+    unsigned long m_Count;
+    std::atomic<unsigned int> m_Written;
+    std::atomic<unsigned int> m_Dropped;
+    std::mutex m_Mutex;
+    std::map<std::string, Capture> m_Captures;
+    std::unique_ptr< AsyncImageWriter<ImageType> > m_ImageWriter;
+    std::unique_ptr< AsyncImageWriter<UnsignedCharImageType> > m_MaskWriter;
+    std::unique_ptr< AsyncImageWriter<RGBImageType> > m_RGBWriter;
+
+};
+
+
+
+//Captures the intermediate images of fitting one image for DebugDumps.
+//Set the outcome before the capture goes out of scope, captures of fits
+//ending with an exception count as failed.
+class DebugDumpCapture{
+
+  public:
+
+  DebugDumpCapture(const std::string &prefix) : m_Prefix( prefix ), m_Failed( true ){
+    DebugDumps::Instance().Begin( m_Prefix );
+  };
+
+  ~DebugDumpCapture(){
+    DebugDumps::Instance().End( m_Prefix, m_Failed );
+  };
+
+  void SetStatus(FitStatus status){
+    m_Failed = status != FIT_OK;
+  };
+
+
+  private:
+
+    DebugDumpCapture(const DebugDumpCapture &);
+    DebugDumpCapture &operator=(const DebugDumpCapture &);
+
+    std::string m_Prefix;
+    bool m_Failed;
+
+};
+
+
+#endif
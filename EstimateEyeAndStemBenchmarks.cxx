@@ -0,0 +1,540 @@
+//Microbenchmarks for the individual stages of the eye and stem fitting.
+//
+//Each stage runs on synthetic eye phantoms at several sizes, from 320x240 up
+//to 3840x2160, so per-stage regressions and the scaling with resolution can
+//be tracked. A stage is repeated until at least min-time seconds have passed
+//and it has run at least min-iterations times. The report gives the mean,
+//minimum and standard deviation of a single run in milliseconds, and the
+//throughput in megapixels of the benchmark image per second.
+//
+//Stages:
+// - every ITKFilterFunctions helper, out of place and in place
+// - CreateEllipseImage, CreateEllipseRingImage and CreateBarsImage
+// - every distance transform of the pipeline (eye, eye slabs, stem)
+// - closing of the eye and opening of the stem
+// - eye and stem registration, the stem also with the automatic schedule of
+//   stemLevelSchedule against the single level default, including the
+//   agreement of the optic nerve widths, and both with FastMeanSquaresMetric
+//   against the ITK metric, including the agreement of the parameters
+// - overlay rendering and writing
+// - complete eye and stem fits, also with the templates of repeated fits
+//   shared through TemplateCache
+
+
+
+#include <tclap/CmdLine.h>
+
+#include <functional>
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cmath>
+
+#include "EyeAndStemFitting.h"
+#include "PhantomGenerator.h"
+#include "ImageIO.h"
+
+
+typedef ITKFilterFunctions<ImageType> FilterFunctions;
+
+
+
+//Runs and reports benchmarks
+class BenchmarkRunner{
+
+  public:
+
+  BenchmarkRunner(double minTime, unsigned int minIterations, const std::string &filter,
+                  std::ostream *csv)
+    : m_MinTime(minTime), m_MinIterations(minIterations), m_Filter(filter), m_CSV(csv) {
+
+    std::cout << std::left << std::setw(28) << "stage" << std::right
+              << std::setw(12) << "size" << std::setw(8) << "iters"
+              << std::setw(12) << "mean ms" << std::setw(12) << "min ms"
+              << std::setw(12) << "stddev ms" << std::setw(12) << "Mpix/s" << std::endl;
+    if( m_CSV != NULL ){
+      *m_CSV << "stage,width,height,iterations,mean_ms,min_ms,stddev_ms,mpix_per_s" << std::endl;
+    }
+  };
+
+
+  bool IsSelected(const std::string &name) const{
+    return m_Filter.empty() || name.find( m_Filter ) != std::string::npos;
+  };
+
+
+  //Run f repeatedly, size is the size of the benchmark image and only used
+  //for reporting
+  void Run(const std::string &name, ImageType::SizeType size, std::function<void()> f){
+    if( !IsSelected( name ) ){
+      return;
+    }
+
+    std::vector<double> times;
+    double total = 0;
+    while( total < m_MinTime || times.size() < m_MinIterations ){
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      f();
+      std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+      double t = std::chrono::duration<double>( end - start ).count();
+      times.push_back( t );
+      total += t;
+    }
+
+    double mean = total / times.size();
+    double minT = times[0];
+    double var = 0;
+    for(unsigned int i=0; i<times.size(); i++){
+      minT = std::min( minT, times[i] );
+      var += ( times[i] - mean ) * ( times[i] - mean );
+    }
+    double stddev = std::sqrt( var / times.size() );
+    double mpix = (double) size[0] * size[1] / 1.0e6 / mean;
+
+    std::stringstream sizeString;
+    sizeString << size[0] << "x" << size[1];
+    std::cout << std::left << std::setw(28) << name << std::right
+              << std::setw(12) << sizeString.str() << std::setw(8) << times.size()
+              << std::fixed << std::setprecision(3)
+              << std::setw(12) << mean * 1000 << std::setw(12) << minT * 1000
+              << std::setw(12) << stddev * 1000 << std::setw(12) << mpix << std::endl;
+    if( m_CSV != NULL ){
+      *m_CSV << name << "," << size[0] << "," << size[1] << "," << times.size() << ","
+             << mean * 1000 << "," << minT * 1000 << "," << stddev * 1000 << "," << mpix
+             << std::endl;
+    }
+  };
+
+
+  private:
+
+    double m_MinTime;
+    unsigned int m_MinIterations;
+    std::string m_Filter;
+    std::ostream *m_CSV;
+
+};
+
+
+
+UnsignedCharImageType::Pointer toUnsignedChar(ImageType::Pointer image){
+  CastFilter::Pointer castFilter = CastFilter::New();
+  castFilter->SetInput( image );
+  castFilter->Update();
+  return castFilter->GetOutput();
+};
+
+
+
+//Synthetic B-mode like image with the default phantom geometry
+ImageType::Pointer createBenchmarkImage(ImageType::SizeType size, unsigned int seed){
+  PhantomParameters parameters;
+  parameters.width = size[0];
+  parameters.height = size[1];
+  parameters.seed = seed;
+  return createPhantom( parameters ).image;
+};
+
+
+
+//Optic nerve widths of the single level and the automatic stem schedule
+void reportStemWidths(const std::string &name, ImageType::SizeType size,
+                      const std::vector<unsigned int> &shrinkFactors,
+                      double singleWidth, double autoWidth){
+  std::stringstream sizeString;
+  sizeString << size[0] << "x" << size[1];
+  std::stringstream levels;
+  for(unsigned int i=0; i<shrinkFactors.size(); i++){
+    levels << ( i > 0 ? "," : "" ) << shrinkFactors[i];
+  }
+  std::cout << std::left << std::setw(28) << name << std::right
+            << std::setw(12) << sizeString.str() << std::fixed << std::setprecision(3)
+            << "  width single " << singleWidth << ", auto " << autoWidth 
+            << " (levels " << levels.str() << "), difference " 
+            << std::fabs( autoWidth - singleWidth ) << std::endl;
+};
+
+
+
+//Largest parameter difference of a registration with FitParameters::fastMetric
+//against the ITK metric
+void reportFastMetric(const std::string &name, ImageType::SizeType size,
+                      const itk::OptimizerParameters<double> &itkParameters,
+                      const itk::OptimizerParameters<double> &fastParameters){
+  std::stringstream sizeString;
+  sizeString << size[0] << "x" << size[1];
+  double difference = 0;
+  for(unsigned int i=0; i<itkParameters.GetSize(); i++){
+    difference = std::max( difference, std::fabs( fastParameters[i] - itkParameters[i] ) );
+  }
+  std::cout << std::left << std::setw(28) << name << std::right
+            << std::setw(12) << sizeString.str() << std::scientific << std::setprecision(3)
+            << "  largest parameter difference to the ITK metric " << difference 
+            << std::fixed << std::endl;
+};
+
+
+
+//Runs all stages on an image of the given size
+void runBenchmarks(BenchmarkRunner &runner, ImageType::SizeType size,
+                   const std::string &prefix){
+
+  ImageType::Pointer image = createBenchmarkImage( size, 0 );
+  ImageType::SpacingType spacing = image->GetSpacing();
+  ImageType::PointType origin = image->GetOrigin();
+  ImageType::Pointer other = createBenchmarkImage( size, 1 );
+
+  FilterFunctions::SigmaArrayType sigma;
+  sigma[0] = 10 * spacing[0];
+  sigma[1] = 10 * spacing[1];
+
+
+  ////
+  //ITKFilterFunctions helpers
+  ////
+
+  runner.Run( "Rescale", size, [&](){ FilterFunctions::Rescale( image, 0, 100 ); } );
+  runner.Run( "GaussSmooth", size, [&](){ FilterFunctions::GaussSmooth( image, sigma ); } );
+  runner.Run( "ThresholdAbove", size, [&](){ FilterFunctions::ThresholdAbove( image, 70, 70 ); } );
+  runner.Run( "ThresholdBelow", size, [&](){ FilterFunctions::ThresholdBelow( image, 30, 30 ); } );
+  runner.Run( "BinaryThreshold", size, [&](){ FilterFunctions::BinaryThreshold( image, -1, 25, 0, 100 ); } );
+  runner.Run( "Subtract", size, [&](){ FilterFunctions::Subtract( image, other ); } );
+  runner.Run( "Add", size, [&](){ FilterFunctions::Add( image, other ); } );
+
+  //In place variants work on a rescaled copy, the result replaces the copy 
+  //since the input buffer is taken over by the output
+  ImageType::Pointer work = FilterFunctions::Rescale( image, 0, 100 );
+  runner.Run( "RescaleInPlace", size, [&](){ work = FilterFunctions::RescaleInPlace( work, 0, 100 ); } );
+  runner.Run( "ThresholdAboveInPlace", size, [&](){ work = FilterFunctions::ThresholdAboveInPlace( work, 70, 70 ); } );
+  runner.Run( "ThresholdBelowInPlace", size, [&](){ work = FilterFunctions::ThresholdBelowInPlace( work, 30, 30 ); } );
+  runner.Run( "BinaryThresholdInPlace", size, [&](){ work = FilterFunctions::BinaryThresholdInPlace( work, -1, 25, 0, 100 ); } );
+  runner.Run( "SubtractInPlace", size, [&](){ work = FilterFunctions::SubtractInPlace( work, other ); } );
+  runner.Run( "AddInPlace", size, [&](){ work = FilterFunctions::AddInPlace( work, other ); } );
+  runner.Run( "AddHorizontalBorder", size, [&](){ FilterFunctions::AddHorizontalBorder( work, 30 ); } );
+  runner.Run( "AddVerticalBorder", size, [&](){ FilterFunctions::AddVerticalBorder( work, 50 ); } );
+  runner.Run( "AddBorder", size, [&](){ FilterFunctions::AddBorder( work, 2 ); } );
+  runner.Run( "RescaleRows", size, [&](){ FilterFunctions::RescaleRows( work ); } );
+
+
+  ////
+  //Template images
+  ////
+
+  ImageType::PointType center;
+  center[0] = 0.52 * size[0];
+  center[1] = 0.31 * size[1];
+  double r2 = 0.2 * size[1];
+  double r1 = 1.3 * r2;
+  double rf = 1.3;
+
+  runner.Run( "CreateEllipseImage", size, [&](){
+    CreateEllipseImage( spacing, size, origin, center, r1, r2 );
+  } );
+  runner.Run( "CreateEllipseRingImage", size, [&](){
+    CreateEllipseRingImage( spacing, size, origin, center, r1, r2, rf );
+  } );
+
+
+  ////
+  //Eye distance transforms and closing
+  ////
+
+  ImageType::Pointer eyeBinary = FilterFunctions::BinaryThreshold(
+                                   FilterFunctions::Rescale( image, 0, 100 ), -1, 25, 0, 100 );
+  UnsignedCharImageType::Pointer eyeBinaryUC = toUnsignedChar( eyeBinary );
+
+  ImageType::IndexType slabIndex;
+  slabIndex[0] = 0.5 * size[0] - 10;
+  slabIndex[1] = 0;
+  ImageType::SizeType slabSize;
+  slabSize[0] = 20;
+  slabSize[1] = size[1];
+  ITKPipeline<ImageType> slabYPipeline( eyeBinary );
+  slabYPipeline.Extract( ImageType::RegionType( slabIndex, slabSize ) );
+  UnsignedCharImageType::Pointer slabY = toUnsignedChar( slabYPipeline.Update() );
+
+  slabIndex[0] = 0;
+  slabIndex[1] = 0.3 * size[1] - 10;
+  slabSize[0] = size[0];
+  slabSize[1] = 20;
+  ITKPipeline<ImageType> slabXPipeline( eyeBinary );
+  slabXPipeline.Extract( ImageType::RegionType( slabIndex, slabSize ) );
+  UnsignedCharImageType::Pointer slabX = toUnsignedChar( slabXPipeline.Update() );
+
+  auto distance = []( UnsignedCharImageType::Pointer binary ){
+    SignedDistanceFilter::Pointer signedDistance = SignedDistanceFilter::New();
+    signedDistance->SetInput( binary );
+    signedDistance->SetInsideValue(100);
+    signedDistance->SetOutsideValue(0);
+    signedDistance->Update();
+  };
+  runner.Run( "DistanceEye", size, [&](){ distance( eyeBinaryUC ); } );
+  runner.Run( "DistanceEyeSlabY", size, [&](){ distance( slabY ); } );
+  runner.Run( "DistanceEyeSlabX", size, [&](){ distance( slabX ); } );
+
+  runner.Run( "ClosingEye", size, [&](){
+    StructuringElementType structuringElement;
+    structuringElement.SetRadius( 70 );
+    structuringElement.CreateStructuringElement();
+    ClosingFilter::Pointer closingFilter = ClosingFilter::New();
+    closingFilter->SetInput( eyeBinary );
+    closingFilter->SetKernel( structuringElement );
+    closingFilter->SetForegroundValue( 100.0 );
+    closingFilter->Update();
+  } );
+
+
+  ////
+  //Stem region, bars, distance transform and opening
+  ////
+
+  ImageType::IndexType stemIndex;
+  stemIndex[0] = 0.2 * size[0];
+  stemIndex[1] = 0.55 * size[1];
+  ImageType::SizeType stemSize;
+  stemSize[0] = 0.6 * size[0];
+  stemSize[1] = 0.3 * size[1];
+  ImageType::RegionType stemRegion( stemIndex, stemSize );
+
+  ITKPipeline<ImageType> stemPipeline( image );
+  stemPipeline.Extract( stemRegion ).Rescale( 0, 100 ).BinaryThreshold( -1, 65, 0, 100 );
+  ImageType::Pointer stemBinary = stemPipeline.Update();
+  UnsignedCharImageType::Pointer stemBinaryUC = toUnsignedChar( stemBinary );
+
+  runner.Run( "DistanceStem", stemSize, [&](){ distance( stemBinaryUC ); } );
+
+  runner.Run( "OpeningStem", stemSize, [&](){
+    StructuringElementType structuringElement;
+    structuringElement.SetRadius( 15 );
+    structuringElement.CreateStructuringElement();
+    OpeningFilter::Pointer openingFilter = OpeningFilter::New();
+    openingFilter->SetInput( stemBinary );
+    openingFilter->SetKernel( structuringElement );
+    openingFilter->SetForegroundValue( 100.0 );
+    openingFilter->Update();
+  } );
+
+  Stem stem;
+  stem.originalImageRegion = stemRegion;
+  ImageType::RegionType barsRegion = stemTemplateRegion( stem );
+  ImageType::PointType stemOrigin = stemTemplateOrigin( stem, image );
+  int bandWidth = 0.1 * size[1];
+  int bandStart = 0.5 * size[0] - bandWidth / 2 - stemIndex[0];
+  stem.barsYStart = 0.01 * size[1];
+  stem.barsXStart1 = bandStart - bandWidth / 2;
+  stem.barsXEnd1 = bandStart;
+  stem.barsXStart2 = bandStart + bandWidth;
+  stem.barsXEnd2 = bandStart + bandWidth + bandWidth / 2;
+
+  runner.Run( "CreateBarsImage", stemSize, [&](){
+    CreateBarsImage( barsRegion, spacing, stemOrigin, stem.barsYStart,
+                     stem.barsXStart1, stem.barsXEnd1, stem.barsXStart2, stem.barsXEnd2 );
+  } );
+
+
+  ////
+  //Registrations, started slightly off the optimum
+  ////
+
+  ImageType::Pointer ring = CreateEllipseRingImage( spacing, size, origin, center, r1, r2, rf );
+  ImageType::Pointer ringMask = CreateEllipseImage( spacing, size, origin, center,
+                                                    r1*(rf+1)/2, r2*(rf+1)/2, 0, 100 );
+  ITKPipeline<ImageType> smoothPipeline( eyeBinary );
+  smoothPipeline.GaussSmooth( sigma ).ThresholdAbove( 70, 70 ).Rescale( 0, 100 );
+  ImageType::Pointer eyeSmooth = smoothPipeline.Update();
+
+  runner.Run( "RegisterEye", size, [&](){ registerEye( ring, eyeSmooth, ringMask, center ); } );
+
+  FilterFunctions::SigmaArrayType barsSigma;
+  barsSigma[0] = 3.0 * spacing[0];
+  barsSigma[1] = 3.0 * spacing[1];
+  ImageType::Pointer bars = FilterFunctions::GaussSmooth(
+                              CreateBarsImage( barsRegion, spacing, stemOrigin, stem.barsYStart,
+                                               stem.barsXStart1 + 2, stem.barsXEnd1 + 2,
+                                               stem.barsXStart2 + 2, stem.barsXEnd2 + 2 ),
+                              barsSigma );
+  ImageType::Pointer stemSmooth = FilterFunctions::GaussSmooth( stemBinary, barsSigma );
+  UnsignedCharImageType::Pointer barsMask = toUnsignedChar(
+                                              CreateBarsImage( barsRegion, spacing, stemOrigin,
+                                                               stem.barsYStart, stem.barsXStart1,
+                                                               stem.barsXEnd2, 0, 0, 255 ) );
+  ImageType::IndexType stemCenterIndex;
+  stemCenterIndex[0] = bandStart + bandWidth / 2;
+  stemCenterIndex[1] = stemSize[1] / 2;
+  stemBinary->TransformIndexToPhysicalPoint( stemCenterIndex, stem.initialCenter );
+
+  runner.Run( "RegisterStem", stemSize, [&](){
+    registerStem( bars, stemSmooth, barsMask, stem.initialCenter );
+  } );
+
+  //The bars are initialWidth / 2 wide and 2 initialWidth apart
+  double barsInitialWidth = 0.5 * bandWidth * spacing[0];
+  FitParameters autoLevels;
+  autoLevels.stemAutoLevels = true;
+  stemLevelSchedule( stemSize, spacing, barsInitialWidth, autoLevels,
+                     autoLevels.stemShrinkFactors, autoLevels.stemSmoothingSigmas );
+  runner.Run( "RegisterStemAutoLevels", stemSize, [&](){
+    registerStem( bars, stemSmooth, barsMask, stem.initialCenter, autoLevels );
+  } );
+  if( runner.IsSelected( "RegisterStemAutoLevels" ) ){
+    //Nerve width is twice the scaled initial width
+    double singleWidth = 2 * barsInitialWidth * 
+      registerStem( bars, stemSmooth, barsMask, stem.initialCenter )->GetScale();
+    double autoWidth = 2 * barsInitialWidth * 
+      registerStem( bars, stemSmooth, barsMask, stem.initialCenter, autoLevels )->GetScale();
+    reportStemWidths( "RegisterStemAutoLevels", stemSize, autoLevels.stemShrinkFactors,
+                      singleWidth, autoWidth );
+  }
+
+  //Same registrations with the fast metric, the ITK metric runs above
+  FitParameters fastMetric;
+  fastMetric.fastMetric = true;
+  runner.Run( "RegisterEyeFastMetric", size, [&](){ 
+    registerEye( ring, eyeSmooth, ringMask, center, fastMetric ); 
+  } );
+  if( runner.IsSelected( "RegisterEyeFastMetric" ) ){
+    reportFastMetric( "RegisterEyeFastMetric", size, 
+                      registerEye( ring, eyeSmooth, ringMask, center )->GetParameters(),
+                      registerEye( ring, eyeSmooth, ringMask, center, fastMetric )->GetParameters() );
+  }
+  runner.Run( "RegisterStemFastMetric", stemSize, [&](){
+    registerStem( bars, stemSmooth, barsMask, stem.initialCenter, fastMetric );
+  } );
+  if( runner.IsSelected( "RegisterStemFastMetric" ) ){
+    reportFastMetric( "RegisterStemFastMetric", stemSize, 
+                      registerStem( bars, stemSmooth, barsMask, stem.initialCenter )->GetParameters(),
+                      registerStem( bars, stemSmooth, barsMask, stem.initialCenter, fastMetric )->GetParameters() );
+  }
+
+
+  ////
+  //Overlay, drawn from identity transforms
+  ////
+
+  Eye eye;
+  eye.initialCenter = center;
+  eye.r1 = r1;
+  eye.r2 = r2;
+  eye.rf = rf;
+  AffineTransformType::Pointer eyeIdentity = AffineTransformType::New();
+  eye.transformParameters = eyeIdentity->GetParameters();
+  SimilarityTransformType::Pointer stemIdentity = SimilarityTransformType::New();
+  stem.transformParameters = stemIdentity->GetParameters();
+
+  runner.Run( "OverlayRender", size, [&](){
+    OverlayRenderer<ImageType>::EllipseRing eyeRing = overlayRing( eye );
+    OverlayRenderer<ImageType>::Bars stemBars = overlayBars( stem, image );
+    OverlayRenderer<ImageType>::Render( image, &eyeRing, &stemBars );
+  } );
+
+  OverlayRenderer<ImageType>::EllipseRing eyeRing = overlayRing( eye );
+  OverlayRenderer<ImageType>::Bars stemBars = overlayBars( stem, image );
+  RGBImageType::Pointer overlay = OverlayRenderer<ImageType>::Render( image, &eyeRing, &stemBars );
+  runner.Run( "OverlayWrite", size, [&](){
+    ImageIO<RGBImageType>::WriteImage( overlay, catStrings( prefix, "-overlay.png" ) );
+  } );
+
+
+  ////
+  //Complete fits
+  ////
+
+  runner.Run( "GateInput", size, [&](){ gateInput( image ); } );
+  runner.Run( "FitEye", size, [&](){ fitEye( image, prefix ); } );
+
+  Eye fittedEye = fitEye( image, prefix );
+  runner.Run( "FitStem", size, [&](){ fitStem( image, fittedEye, prefix ); } );
+
+  FitParameters autoFit;
+  autoFit.stemAutoLevels = true;
+  runner.Run( "FitStemAutoLevels", size, [&](){ fitStem( image, fittedEye, prefix, autoFit ); } );
+  if( runner.IsSelected( "FitStemAutoLevels" ) ){
+    Stem singleStem = fitStem( image, fittedEye, prefix );
+    Stem autoStem = fitStem( image, fittedEye, prefix, autoFit );
+    std::vector<unsigned int> shrinkFactors;
+    for(unsigned int i=0; i<autoStem.registration.levels.size(); i++){
+      shrinkFactors.push_back( autoStem.registration.levels[i].shrinkFactor );
+    }
+    reportStemWidths( "FitStemAutoLevels", size, shrinkFactors,
+                      2 * singleStem.width, 2 * autoStem.width );
+  }
+
+  //Every run after the first finds the templates in the cache
+  FitParameters cachedFit;
+  cachedFit.templateCache = true;
+  runner.Run( "FitEyeTemplateCache", size, [&](){ fitEye( image, prefix, cachedFit ); } );
+  Eye cachedEye = fitEye( image, prefix, cachedFit );
+  runner.Run( "FitStemTemplateCache", size, [&](){ fitStem( image, cachedEye, prefix, cachedFit ); } );
+};
+
+
+
+int main(int argc, char **argv ){
+
+  //Command line parsing
+  TCLAP::CmdLine cmd("Benchmark the stages of the eye and stem fitting", ' ', "1");
+
+  TCLAP::ValueArg<std::string> sizesArg("s","sizes","Comma separated image sizes", false,
+      "320x240,640x480,1280x720,1920x1080,3840x2160", "WxH,...");
+  cmd.add(sizesArg);
+
+  TCLAP::ValueArg<std::string> filterArg("f","filter","Only run stages whose name contains this string", false, "",
+      "string");
+  cmd.add(filterArg);
+
+  TCLAP::ValueArg<double> minTimeArg("t","min-time","Minimum time in seconds per stage and size", false, 0.5,
+      "seconds");
+  cmd.add(minTimeArg);
+
+  TCLAP::ValueArg<unsigned int> minIterationsArg("n","min-iterations","Minimum number of runs per stage and size", false, 3,
+      "count");
+  cmd.add(minIterationsArg);
+
+  TCLAP::ValueArg<std::string> csvArg("c","csv","Write results to CSV file", false, "",
+      "filename");
+  cmd.add(csvArg);
+
+  TCLAP::ValueArg<std::string> prefixArg("p","prefix","Prefix for images written by the benchmarks", false, "benchmark",
+      "filename");
+  cmd.add(prefixArg);
+
+  try{
+    cmd.parse( argc, argv );
+  }
+  catch (TCLAP::ArgException &e){
+    std::cerr << "error: " << e.error() << " for arg " << e.argId() << std::endl;
+    return -1;
+  }
+
+  std::vector<ImageType::SizeType> sizes;
+  std::stringstream sizesStream( sizesArg.getValue() );
+  std::string sizeString;
+  while( std::getline( sizesStream, sizeString, ',' ) ){
+    ImageType::SizeType size;
+    char x;
+    std::stringstream sizeStream( sizeString );
+    if( !( sizeStream >> size[0] >> x >> size[1] ) || x != 'x' ){
+      std::cerr << "error: invalid size " << sizeString << std::endl;
+      return -1;
+    }
+    sizes.push_back( size );
+  }
+
+  std::ofstream csv;
+  if( csvArg.isSet() ){
+    csv.open( csvArg.getValue().c_str() );
+  }
+
+  BenchmarkRunner runner( minTimeArg.getValue(), minIterationsArg.getValue(),
+                          filterArg.getValue(), csvArg.isSet() ? &csv : NULL );
+  for(unsigned int i=0; i<sizes.size(); i++){
+    runBenchmarks( runner, sizes[i], prefixArg.getValue() );
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,143 @@
+//Estimates the width of the optic nerve from a cine loop of B-mode
+//ultrasound frames, see CineFitting.h.
+//
+//Frames are given either as individual 2D images or as a single 3D image
+//with one frame per slice. All frames are scored, the best k are fitted
+//and the robust aggregate of their widths is reported in the same form as
+//the output of EstimateEyeAndStem.
+
+
+
+#include <tclap/CmdLine.h>
+
+#include <algorithm>
+
+#include "itkExtractImageFilter.h"
+
+#include "CineFitting.h"
+#include "ImageIO.h"
+#include "StageTracer.h"
+
+
+
+typedef itk::Image< PixelType, 3 > LoopImageType;
+typedef itk::ExtractImageFilter< LoopImageType, ImageType > FrameExtractFilter;
+
+
+
+int main(int argc, char **argv ){
+
+  //Command line parsing
+  TCLAP::CmdLine cmd("Fit stem to the best frames of an eye ultrasound cine loop", ' ', "1");
+
+  TCLAP::MultiArg<std::string> imageArg("i","image","Ultrasound frame, repeat for each frame", false,
+      "filename");
+  cmd.add(imageArg);
+
+  TCLAP::ValueArg<std::string> loopArg("l","loop","Cine loop as 3D image, one frame per slice", false, "",
+      "filename");
+  cmd.add(loopArg);
+
+  TCLAP::ValueArg<unsigned int> kArg("k","best","Number of best scoring frames to fit", false, 5,
+      "unsigned int");
+  cmd.add(kArg);
+
+  TCLAP::ValueArg<unsigned int> shrinkArg("","shrink","Shrink factor of the coarse frames used for scoring", false, 4,
+      "unsigned int");
+  cmd.add(shrinkArg);
+
+  TCLAP::ValueArg<double> outlierArg("","outlier-factor","Reject widths further than this many scaled median absolute deviations from the median", false, 3,
+      "double");
+  cmd.add(outlierArg);
+
+  TCLAP::SwitchArg scoresArg("","scores","Report the scores of all frames" );
+  cmd.add(scoresArg);
+
+  TCLAP::SwitchArg timesArg("","times","Report times of individual steps" );
+  cmd.add(timesArg);
+
+  TCLAP::MultiArg<std::string> setArg("s","set","Set a fitting parameter, see FitParameters in EyeAndStemFitting.h", false,
+      "name=value");
+  cmd.add(setArg);
+
+  try{
+    cmd.parse( argc, argv );
+  }
+  catch (TCLAP::ArgException &e){
+    std::cerr << "error: " << e.error() << " for arg " << e.argId() << std::endl;
+    return -1;
+  }
+
+  FitParameters parameters;
+  for(unsigned int i=0; i<setArg.getValue().size(); i++){
+    if( !setFitParameter( parameters, setArg.getValue()[i] ) ){
+      std::cerr << "error: invalid parameter " << setArg.getValue()[i] << std::endl;
+      return -1;
+    }
+  }
+
+  StageTracer &tracer = StageTracer::Instance();
+  tracer.SetEnabled( timesArg.getValue() );
+
+
+  //Read frames
+  TraceSpan spanRead( "Read frames" );
+  std::vector<ImageType::Pointer> frames;
+  for(unsigned int i=0; i<imageArg.getValue().size(); i++){
+    frames.push_back( ImageIO<ImageType>::ReadImage( imageArg.getValue()[i] ) );
+  }
+  if( loopArg.isSet() ){
+    LoopImageType::Pointer loop = ImageIO<LoopImageType>::ReadImage( loopArg.getValue() );
+    LoopImageType::RegionType loopRegion = loop->GetLargestPossibleRegion();
+    for(unsigned int z=0; z<loopRegion.GetSize()[2]; z++){
+      LoopImageType::RegionType frameRegion = loopRegion;
+      frameRegion.SetIndex( 2, loopRegion.GetIndex()[2] + z );
+      frameRegion.SetSize( 2, 0 );
+      FrameExtractFilter::Pointer extractFilter = FrameExtractFilter::New();
+      extractFilter->SetInput( loop );
+      extractFilter->SetExtractionRegion( frameRegion );
+      extractFilter->SetDirectionCollapseToSubmatrix();
+      extractFilter->Update();
+      frames.push_back( extractFilter->GetOutput() );
+    }
+  }
+  spanRead.Stop();
+
+  if( frames.empty() ){
+    std::cerr << "error: no frames given, use -i or -l" << std::endl;
+    return -1;
+  }
+
+
+  CineResult result = fitCine( frames, kArg.getValue(), parameters,
+                               shrinkArg.getValue(), outlierArg.getValue() );
+
+
+  if( scoresArg.getValue() ){
+    std::cout << "frame score eye stem_contrast stem_sharpness" << std::endl;
+    for(unsigned int i=0; i<result.scores.size(); i++){
+      const FrameScore &s = result.scores[i];
+      std::cout << s.frame << " " << s.score << " " << s.eye << " "
+                << s.stemContrast << " " << s.stemSharpness << std::endl;
+    }
+    std::cout << std::endl;
+  }
+
+  for(unsigned int i=0; i<result.selected.size(); i++){
+    std::cout << "Frame " << result.selected[i] << ": width " << result.widths[i]
+              << ( result.inliers[i] ? "" : " (rejected)" ) << std::endl;
+  }
+
+  unsigned int nInliers = std::count( result.inliers.begin(), result.inliers.end(), true );
+  std::cout << std::endl;
+  std::cout << "Estimated optic nerve width: " << result.width << std::endl;
+  std::cout << "Frames: " << frames.size() << ", fitted " << result.selected.size()
+            << ", used " << nInliers << ", median absolute deviation " << result.mad << std::endl;
+  std::cout << std::endl;
+
+  if( timesArg.getValue() ){
+    tracer.PrintSummary( std::cout );
+  }
+
+  return result.selected.empty() ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,146 @@
+//Estimates the width of the optic nerve from live scanner frames in a
+//shared memory ring, see LiveFrames.h.
+//
+//The newest frame is converted to float straight from the shared mapping,
+//frames arriving while a frame is fitted are skipped. A FrameResult is
+//written to the result ring for every processed frame. Stops when the
+//frame ring is closed or after --count frames.
+
+
+
+#include <tclap/CmdLine.h>
+
+#include <thread>
+
+#include "EyeAndStemFitting.h"
+#include "LiveFrames.h"
+#include "StageTracer.h"
+
+
+
+int main(int argc, char **argv ){
+
+  //Command line parsing
+  TCLAP::CmdLine cmd("Fit stem to live eye ultrasound frames from shared memory", ' ', "1");
+
+  TCLAP::ValueArg<std::string> framesArg("f","frames","Name of the shared memory frame ring", false, "/ons-frames",
+      "name");
+  cmd.add(framesArg);
+
+  TCLAP::ValueArg<std::string> resultsArg("r","results","Name of the shared memory result ring", false, "/ons-results",
+      "name");
+  cmd.add(resultsArg);
+
+  TCLAP::ValueArg<unsigned int> countArg("n","count","Stop after this many frames, 0 to run until the frame ring is closed", false, 0,
+      "unsigned int");
+  cmd.add(countArg);
+
+  TCLAP::ValueArg<double> waitArg("","wait","Seconds to wait for the rings to be created", false, 10,
+      "seconds");
+  cmd.add(waitArg);
+
+  TCLAP::SwitchArg timesArg("","times","Report times of individual steps" );
+  cmd.add(timesArg);
+
+  TCLAP::MultiArg<std::string> setArg("s","set","Set a fitting parameter, see FitParameters in EyeAndStemFitting.h", false,
+      "name=value");
+  cmd.add(setArg);
+
+  try{
+    cmd.parse( argc, argv );
+  }
+  catch (TCLAP::ArgException &e){
+    std::cerr << "error: " << e.error() << " for arg " << e.argId() << std::endl;
+    return -1;
+  }
+
+  FitParameters parameters;
+  for(unsigned int i=0; i<setArg.getValue().size(); i++){
+    if( !setFitParameter( parameters, setArg.getValue()[i] ) ){
+      std::cerr << "error: invalid parameter " << setArg.getValue()[i] << std::endl;
+      return -1;
+    }
+  }
+
+  StageTracer &tracer = StageTracer::Instance();
+  tracer.SetEnabled( timesArg.getValue() );
+
+
+  //The grabber creates the rings
+  std::unique_ptr<SharedRing> frames;
+  std::unique_ptr<SharedRing> results;
+  int64_t waitEnd = monotonicNanoseconds() + (int64_t) ( waitArg.getValue() * 1e9 );
+  while( true ){
+    if( !frames ){
+      frames = SharedRing::Open( framesArg.getValue() );
+    }
+    if( !results ){
+      results = SharedRing::Open( resultsArg.getValue() );
+    }
+    if( frames && results ){
+      break;
+    }
+    if( monotonicNanoseconds() > waitEnd ){
+      std::cerr << "error: could not open " << ( frames ? resultsArg.getValue() : framesArg.getValue() ) << std::endl;
+      return -1;
+    }
+    std::this_thread::sleep_for( std::chrono::milliseconds( 10 ) );
+  }
+  if( results->PayloadBytes() < sizeof(FrameResult) ){
+    std::cerr << "error: result ring slots are too small" << std::endl;
+    return -1;
+  }
+
+
+  ImageType::Pointer image;
+  uint64_t lastSequence = 0;
+  unsigned int nProcessed = 0;
+  uint64_t nSkipped = 0;
+  while( countArg.getValue() == 0 || nProcessed < countArg.getValue() ){
+    FrameHeader header;
+    uint64_t sequence = LiveFrames<ImageType>::ReadNewest( *frames, lastSequence, image, header );
+    if( sequence == 0 ){
+      if( frames->IsClosed() && frames->Newest() <= lastSequence ){
+        break;
+      }
+      std::this_thread::sleep_for( std::chrono::microseconds( 200 ) );
+      continue;
+    }
+    if( lastSequence > 0 ){
+      nSkipped += sequence - lastSequence - 1;
+    }
+    lastSequence = sequence;
+
+    Eye eye = fitEye( image, "", parameters );
+    Stem stem = fitStem( image, eye, "", parameters );
+
+    FrameResult result;
+    std::memset( &result, 0, sizeof(FrameResult) );
+    result.frameSequence = sequence;
+    result.frameNumber = header.frameNumber;
+    result.frameTimestamp = header.timestamp;
+    result.status = stem.status;
+    //Geometry of failed fits is not set
+    if( eye.status == FIT_OK ){
+      result.eyeCenter[0] = eye.center[0];
+      result.eyeCenter[1] = eye.center[1];
+      result.eyeMinor = eye.minor;
+      result.eyeMajor = eye.major;
+    }
+    if( stem.status == FIT_OK ){
+      result.stemCenter[0] = stem.center[0];
+      result.stemCenter[1] = stem.center[1];
+      result.stemWidth = 2 * stem.width;
+    }
+    result.resultTimestamp = monotonicNanoseconds();
+    writeFrameResult( *results, result );
+    nProcessed++;
+  }
+
+  std::cout << "Processed " << nProcessed << " frames, skipped " << nSkipped << std::endl;
+  if( timesArg.getValue() ){
+    tracer.PrintSummary( std::cout );
+  }
+
+  return EXIT_SUCCESS;
+}
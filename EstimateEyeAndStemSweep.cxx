@@ -0,0 +1,101 @@
+//Fits an eye ultrasound image for all combinations of a grid of fitting
+//parameters, see ParameterSweep.h.
+//
+//Each -g adds an axis name=value1:value2:... to the grid. Stages that do
+//not depend on the swept parameters are computed once and shared, e.g.
+//  -g stemRefineThreshold=55:60:65:70:75
+//fits the eye and extracts the stem region once and runs five stem fits.
+//One CSV line per grid point is written.
+
+
+
+#include <tclap/CmdLine.h>
+
+#include <fstream>
+
+#include "ParameterSweep.h"
+#include "ImageIO.h"
+#include "StageTracer.h"
+
+
+
+int main(int argc, char **argv ){
+
+  //Command line parsing
+  TCLAP::CmdLine cmd("Fit stem to eye ultrasound for a grid of parameters", ' ', "1");
+
+  TCLAP::ValueArg<std::string> imageArg("i","image","Ultrasound input image", true, "",
+      "filename");
+  cmd.add(imageArg);
+
+  TCLAP::MultiArg<std::string> gridArg("g","grid","Add a grid axis, values are colon separated", true,
+      "name=value1:value2:...");
+  cmd.add(gridArg);
+
+  TCLAP::ValueArg<std::string> csvArg("o","output","Write the results as CSV to a file instead of the standard output", false, "",
+      "filename");
+  cmd.add(csvArg);
+
+  TCLAP::SwitchArg timesArg("","times","Report times of individual steps" );
+  cmd.add(timesArg);
+
+  TCLAP::MultiArg<std::string> setArg("s","set","Set a fitting parameter for all grid points, see FitParameters in EyeAndStemFitting.h", false,
+      "name=value");
+  cmd.add(setArg);
+
+  try{
+    cmd.parse( argc, argv );
+  }
+  catch (TCLAP::ArgException &e){
+    std::cerr << "error: " << e.error() << " for arg " << e.argId() << std::endl;
+    return -1;
+  }
+
+  FitParameters parameters;
+  for(unsigned int i=0; i<setArg.getValue().size(); i++){
+    if( !setFitParameter( parameters, setArg.getValue()[i] ) ){
+      std::cerr << "error: invalid parameter " << setArg.getValue()[i] << std::endl;
+      return -1;
+    }
+  }
+
+  std::vector<SweepAxis> axes;
+  for(unsigned int i=0; i<gridArg.getValue().size(); i++){
+    SweepAxis axis;
+    if( !parseSweepAxis( gridArg.getValue()[i], axis ) ){
+      std::cerr << "error: invalid grid axis " << gridArg.getValue()[i] << std::endl;
+      return -1;
+    }
+    axes.push_back( axis );
+  }
+
+  StageTracer &tracer = StageTracer::Instance();
+  tracer.SetEnabled( timesArg.getValue() );
+
+
+  TraceSpan spanRead( "Read image" );
+  ImageType::Pointer image = ImageIO<ImageType>::ReadImage( imageArg.getValue() );
+  spanRead.Stop();
+
+  std::vector<SweepPoint> points = expandSweep( parameters, axes );
+  SweepStatistics statistics = runSweep( image, points );
+
+
+  if( csvArg.isSet() ){
+    std::ofstream out( csvArg.getValue().c_str() );
+    writeSweepCSV( axes, points, out );
+  }
+  else{
+    writeSweepCSV( axes, points, std::cout );
+  }
+
+  std::cerr << points.size() << " grid points: " << statistics.eyeFits << " eye fits, "
+            << statistics.stemRegions << " stem regions, " << statistics.stemFits
+            << " stem fits" << std::endl;
+
+  if( timesArg.getValue() ){
+    tracer.PrintSummary( std::cerr );
+  }
+
+  return EXIT_SUCCESS;
+}
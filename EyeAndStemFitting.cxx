@@ -0,0 +1,2332 @@
+//Implementation of the eye and stem fitting, see EyeAndStemFitting.h for
+//an overview of the pipeline.
+
+
+//If DEBUG_PRINT is defined print out intermediate messages
+//#define DEBUG_PRINT
+
+
+
+#include "EyeAndStemFitting.h"
+
+#include "StageTracer.h"
+#include "TaskGraph.h"
+#include "DebugDumps.h"
+#include "FastMeanSquaresMetric.h"
+#include "TemplateCache.h"
+
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <limits>
+
+
+
+//Helper function
+std::string catStrings(std::string s1, std::string s2){
+  std::stringstream out;
+  out << s1 << s2;
+  return out.str();
+};
+
+
+
+//Parse a single value or a comma separated list
+template <typename T>
+bool parseFitParameter(const std::string &value, T &result){
+  std::stringstream in( value );
+  T tmp;
+  if( !( in >> tmp ) || !( in >> std::ws ).eof() ){
+    return false;
+  }
+  result = tmp;
+  return true;
+};
+
+template <typename T>
+bool parseFitParameter(const std::string &value, std::vector<T> &result){
+  std::vector<T> tmp;
+  std::stringstream in( value );
+  std::string item;
+  while( std::getline( in, item, ',' ) ){
+    T v;
+    if( !parseFitParameter( item, v ) ){
+      return false;
+    }
+    tmp.push_back( v );
+  }
+  if( tmp.empty() ){
+    return false;
+  }
+  result = tmp;
+  return true;
+};
+
+template <typename T>
+void printFitParameter(std::ostream &out, const std::string &name, const T &value){
+  out << name << "=" << value << std::endl;
+};
+
+template <typename T>
+void printFitParameter(std::ostream &out, const std::string &name, const std::vector<T> &value){
+  out << name << "=";
+  for(unsigned int i=0; i<value.size(); i++){
+    out << ( i > 0 ? "," : "" ) << value[i];
+  }
+  out << std::endl;
+};
+
+
+
+bool setFitParameter(FitParameters &parameters, const std::string &name, 
+                     const std::string &value){
+  if( name == "eyeSigma" ) return parseFitParameter( value, parameters.eyeSigma );
+  if( name == "eyeThreshold" ) return parseFitParameter( value, parameters.eyeThreshold );
+  if( name == "eyeClosingRadius" ) return parseFitParameter( value, parameters.eyeClosingRadius );
+  if( name == "eyeAspectRatio" ) return parseFitParameter( value, parameters.eyeAspectRatio );
+  if( name == "eyeRingFactor" ) return parseFitParameter( value, parameters.eyeRingFactor );
+  if( name == "eyeShrinkFactors" ) return parseFitParameter( value, parameters.eyeShrinkFactors );
+  if( name == "eyeSmoothingSigmas" ) return parseFitParameter( value, parameters.eyeSmoothingSigmas );
+  if( name == "eyeHypothesisCenters" ) return parseFitParameter( value, parameters.eyeHypothesisCenters );
+  if( name == "eyeHypothesisAspectRatios" ) return parseFitParameter( value, parameters.eyeHypothesisAspectRatios );
+  if( name == "eyeHypothesisSeparation" ) return parseFitParameter( value, parameters.eyeHypothesisSeparation );
+  if( name == "eyeHypothesisEvaluations" ) return parseFitParameter( value, parameters.eyeHypothesisEvaluations );
+  if( name == "stemSigmaX" ) return parseFitParameter( value, parameters.stemSigmaX );
+  if( name == "stemSigmaY" ) return parseFitParameter( value, parameters.stemSigmaY );
+  if( name == "stemThreshold" ) return parseFitParameter( value, parameters.stemThreshold );
+  if( name == "stemOpeningRadius" ) return parseFitParameter( value, parameters.stemOpeningRadius );
+  if( name == "stemRefineThreshold" ) return parseFitParameter( value, parameters.stemRefineThreshold );
+  if( name == "stemRegistrationSigma" ) return parseFitParameter( value, parameters.stemRegistrationSigma );
+  if( name == "stemShrinkFactors" ) return parseFitParameter( value, parameters.stemShrinkFactors );
+  if( name == "stemSmoothingSigmas" ) return parseFitParameter( value, parameters.stemSmoothingSigmas );
+  if( name == "stemAutoLevels" ) return parseFitParameter( value, parameters.stemAutoLevels );
+  if( name == "stemMaxShrinkFactor" ) return parseFitParameter( value, parameters.stemMaxShrinkFactor );
+  if( name == "stemMinBarPixels" ) return parseFitParameter( value, parameters.stemMinBarPixels );
+  if( name == "stemMinLevelSize" ) return parseFitParameter( value, parameters.stemMinLevelSize );
+  if( name == "gradientConvergenceTolerance" ) return parseFitParameter( value, parameters.gradientConvergenceTolerance );
+  if( name == "lineSearchAccuracy" ) return parseFitParameter( value, parameters.lineSearchAccuracy );
+  if( name == "defaultStepLength" ) return parseFitParameter( value, parameters.defaultStepLength );
+  if( name == "maximumNumberOfFunctionEvaluations" ) return parseFitParameter( value, parameters.maximumNumberOfFunctionEvaluations );
+  if( name == "fastMetric" ) return parseFitParameter( value, parameters.fastMetric );
+  if( name == "templateCache" ) return parseFitParameter( value, parameters.templateCache );
+  if( name == "templateCacheSize" ) return parseFitParameter( value, parameters.templateCacheSize );
+  if( name == "templateRadiusStep" ) return parseFitParameter( value, parameters.templateRadiusStep );
+  if( name == "deadline" ) return parseFitParameter( value, parameters.deadline );
+  if( name == "inputGate" ) return parseFitParameter( value, parameters.inputGate );
+  if( name == "gateBlockSize" ) return parseFitParameter( value, parameters.gateBlockSize );
+  if( name == "gateMinContrast" ) return parseFitParameter( value, parameters.gateMinContrast );
+  if( name == "gateMinEyeArea" ) return parseFitParameter( value, parameters.gateMinEyeArea );
+  if( name == "stageThreads" ) return parseFitParameter( value, parameters.stageThreads );
+  return false;
+};
+
+
+
+bool setFitParameter(FitParameters &parameters, const std::string &assignment){
+  size_t equal = assignment.find( '=' );
+  if( equal == std::string::npos ){
+    return false;
+  }
+  return setFitParameter( parameters, assignment.substr( 0, equal ), assignment.substr( equal + 1 ) );
+};
+
+
+
+void printFitParameters(const FitParameters &parameters, std::ostream &out){
+  printFitParameter( out, "eyeSigma", parameters.eyeSigma );
+  printFitParameter( out, "eyeThreshold", parameters.eyeThreshold );
+  printFitParameter( out, "eyeClosingRadius", parameters.eyeClosingRadius );
+  printFitParameter( out, "eyeAspectRatio", parameters.eyeAspectRatio );
+  printFitParameter( out, "eyeRingFactor", parameters.eyeRingFactor );
+  printFitParameter( out, "eyeShrinkFactors", parameters.eyeShrinkFactors );
+  printFitParameter( out, "eyeSmoothingSigmas", parameters.eyeSmoothingSigmas );
+  printFitParameter( out, "eyeHypothesisCenters", parameters.eyeHypothesisCenters );
+  printFitParameter( out, "eyeHypothesisAspectRatios", parameters.eyeHypothesisAspectRatios );
+  printFitParameter( out, "eyeHypothesisSeparation", parameters.eyeHypothesisSeparation );
+  printFitParameter( out, "eyeHypothesisEvaluations", parameters.eyeHypothesisEvaluations );
+  printFitParameter( out, "stemSigmaX", parameters.stemSigmaX );
+  printFitParameter( out, "stemSigmaY", parameters.stemSigmaY );
+  printFitParameter( out, "stemThreshold", parameters.stemThreshold );
+  printFitParameter( out, "stemOpeningRadius", parameters.stemOpeningRadius );
+  printFitParameter( out, "stemRefineThreshold", parameters.stemRefineThreshold );
+  printFitParameter( out, "stemRegistrationSigma", parameters.stemRegistrationSigma );
+  printFitParameter( out, "stemShrinkFactors", parameters.stemShrinkFactors );
+  printFitParameter( out, "stemSmoothingSigmas", parameters.stemSmoothingSigmas );
+  printFitParameter( out, "stemAutoLevels", parameters.stemAutoLevels );
+  printFitParameter( out, "stemMaxShrinkFactor", parameters.stemMaxShrinkFactor );
+  printFitParameter( out, "stemMinBarPixels", parameters.stemMinBarPixels );
+  printFitParameter( out, "stemMinLevelSize", parameters.stemMinLevelSize );
+  printFitParameter( out, "gradientConvergenceTolerance", parameters.gradientConvergenceTolerance );
+  printFitParameter( out, "lineSearchAccuracy", parameters.lineSearchAccuracy );
+  printFitParameter( out, "defaultStepLength", parameters.defaultStepLength );
+  printFitParameter( out, "maximumNumberOfFunctionEvaluations", parameters.maximumNumberOfFunctionEvaluations );
+  printFitParameter( out, "fastMetric", parameters.fastMetric );
+  printFitParameter( out, "templateCache", parameters.templateCache );
+  printFitParameter( out, "templateCacheSize", parameters.templateCacheSize );
+  printFitParameter( out, "templateRadiusStep", parameters.templateRadiusStep );
+  printFitParameter( out, "deadline", parameters.deadline );
+  printFitParameter( out, "inputGate", parameters.inputGate );
+  printFitParameter( out, "gateBlockSize", parameters.gateBlockSize );
+  printFitParameter( out, "gateMinContrast", parameters.gateMinContrast );
+  printFitParameter( out, "gateMinEyeArea", parameters.gateMinEyeArea );
+  printFitParameter( out, "stageThreads", parameters.stageThreads );
+};
+
+
+
+const char *fitStatusName(FitStatus status){
+  switch( status ){
+    case FIT_OK: return "ok";
+    case FIT_LOW_CONTRAST: return "low contrast";
+    case FIT_NO_EYE: return "no eye";
+    case FIT_NO_STEM_AREA: return "no stem area";
+    case FIT_NO_STEM: return "no stem";
+    case FIT_ERROR: return "error";
+    default: return "unknown";
+  }
+};
+
+
+
+const char *fitLevelName(FitLevel level){
+  switch( level ){
+    case FIT_INITIAL: return "initial";
+    case FIT_PARTIAL: return "partial";
+    case FIT_FULL: return "full";
+    default: return "none";
+  }
+};
+
+
+
+//Create ellipse image
+ImageType::Pointer CreateEllipseImage( ImageType::SpacingType spacing, 
+		                       ImageType::SizeType size, 
+				       ImageType::PointType origin,
+				       ImageType::PointType center,
+				       double r1, double r2, 
+               double outside, double inside){
+ 
+  SpatialObjectToImageFilterType::Pointer imageFilter =
+    SpatialObjectToImageFilterType::New();
+  
+  //origin[0] -= 0.5 * size[0] * spacing[0];
+  //origin[1] -= 0.5 * size[1] * spacing[1];
+  //size[0] *= 2;
+  //size[1] *= 2;
+  ImageType::SizeType smallSize = size;
+  smallSize[0] = 100;
+  smallSize[1] = 100;
+  ImageType::SpacingType smallSpacing = spacing;
+  smallSpacing[0] = ( smallSpacing[0] / smallSize[0] ) * size[0];
+  smallSpacing[1] = ( smallSpacing[1] / smallSize[1] ) * size[1];
+
+  imageFilter->SetSize( smallSize );
+  imageFilter->SetOrigin( origin );
+  imageFilter->SetSpacing( smallSpacing );
+ 
+  EllipseType::Pointer ellipse   = EllipseType::New();
+  EllipseType::ArrayType radiusArray;
+  radiusArray[0] = r1;
+  radiusArray[1] = r2;
+  ellipse->SetRadius(radiusArray);
+ 
+  EllipseTransformType::Pointer transform = EllipseTransformType::New();
+  transform->SetIdentity();
+  EllipseTransformType::OutputVectorType  translation;
+  translation[ 0 ] =  center[0];
+  translation[ 1 ] =  center[1];
+  transform->Translate( translation, false );
+  ellipse->SetObjectToParentTransform( transform );
+ 
+  imageFilter->SetInput(ellipse);
+  ellipse->SetDefaultInsideValue( inside );
+  ellipse->SetDefaultOutsideValue( outside );
+  imageFilter->SetUseObjectValue( true );
+  imageFilter->SetOutsideValue( outside );
+  imageFilter->Update();
+ 
+  ResampleFilterType::Pointer resampler = ResampleFilterType::New();
+  resampler->SetInput( imageFilter->GetOutput() );
+  resampler->SetSize( size );
+  resampler->SetOutputOrigin(  origin );
+  resampler->SetOutputSpacing( spacing );
+  //resampler->SetOutputDirection( stemImage->GetDirection() );
+  resampler->SetDefaultPixelValue( 0 );
+  resampler->Update();
+  
+  return resampler->GetOutput();
+
+  //return imageFilter->GetOutput();
+};
+
+
+
+//Create the fixed image of the eye registration, an ellipse ring with 
+//radii r1, r2 and rf*r1, rf*r2. Steps B 1. and 2. of the eye estimation.
+ImageType::Pointer CreateEllipseRingImage( ImageType::SpacingType spacing, 
+		                           ImageType::SizeType size, 
+				           ImageType::PointType origin,
+				           ImageType::PointType center,
+				           double r1, double r2, double rf ){
+  double outside = 100;  
+  ImageType::Pointer e1 = CreateEllipseImage( spacing, size, origin, 
+		                               center, r1, r2, outside);
+  ImageType::Pointer e2 = CreateEllipseImage( spacing, size, origin, 
+		                              center, r1*rf, r2*rf, outside );
+
+  ITKFilterFunctions<ImageType>::SigmaArrayType sigma;
+  sigma[0] = 10 * spacing[0]; 
+  sigma[1] = 10 * spacing[1];
+  ITKPipeline<ImageType> ellipsePipeline( e1, true );
+  ellipsePipeline.Subtract( e2 ).GaussSmooth( sigma ).ThresholdAbove( 70, 70 ).Rescale( 0, 100 );
+  return ellipsePipeline.Update();
+};
+
+
+
+//Create a black and white image with two bars covering the columns 
+//[xStart1, xEnd1) and [xStart2, xEnd2) from row yStart on
+ImageType::Pointer CreateBarsImage( ImageType::RegionType region,
+                                    ImageType::SpacingType spacing, 
+                                    ImageType::PointType origin,
+                                    int yStart, int xStart1, int xEnd1, 
+                                    int xStart2, int xEnd2,
+                                    double inside ){
+  ImageType::Pointer bars = ImageType::New();
+  bars->SetRegions(region);
+  bars->Allocate();
+  bars->FillBuffer( 0.0 );
+  bars->SetSpacing(spacing);
+  bars->SetOrigin(origin);
+
+  ImageType::SizeType size = region.GetSize();
+  for(int i=yStart; i<size[1]; i++){
+     ImageType::IndexType index;
+     index[1] = i;
+     for(int j=xStart1; j<xEnd1; j++){
+       index[0]=j;
+       bars->SetPixel(index, inside);
+     }
+     for(int j=xStart2; j<xEnd2; j++){
+       index[0]=j;
+       bars->SetPixel(index, inside);
+     }    
+  }
+  return bars;
+};
+
+
+
+//Fitted eye and stem transforms from the stored parameters
+AffineTransformType::Pointer eyeTransform(const Eye &eye){
+  AffineTransformType::Pointer transform = AffineTransformType::New();
+  transform->SetCenter( eye.initialCenter );
+  transform->SetParameters( eye.transformParameters );
+  return transform;
+};
+
+SimilarityTransformType::Pointer stemTransform(const Stem &stem){
+  SimilarityTransformType::Pointer transform = SimilarityTransformType::New();
+  transform->SetCenter( stem.initialCenter );
+  transform->SetParameters( stem.transformParameters );
+  return transform;
+};
+
+
+
+//Geometry of the stem region of interest within image
+ImageType::RegionType stemTemplateRegion(const Stem &stem){
+  ImageType::IndexType index;
+  index.Fill(0);
+  return ImageType::RegionType( index, stem.originalImageRegion.GetSize() );
+};
+
+ImageType::PointType stemTemplateOrigin(const Stem &stem, ImageType::Pointer image){
+  ImageType::PointType origin;
+  image->TransformIndexToPhysicalPoint( stem.originalImageRegion.GetIndex(), origin );
+  return origin;
+};
+
+
+
+//Rasterize the fitted ellipse ring on the grid of image
+ImageType::Pointer rasterizeEye(const Eye &eye, ImageType::Pointer image){
+  ImageType::Pointer ellipse = CreateEllipseRingImage( image->GetSpacing(), 
+                                 image->GetLargestPossibleRegion().GetSize(),
+                                 image->GetOrigin(), eye.initialCenter, 
+                                 eye.r1, eye.r2, eye.rf );
+
+  AffineTransformType::Pointer inverse = AffineTransformType::New();
+  eyeTransform( eye )->GetInverse( inverse );
+
+  ResampleFilterType::Pointer resampler = ResampleFilterType::New();
+  resampler->SetInput( ellipse );
+  resampler->SetTransform( inverse );
+  resampler->SetSize( image->GetLargestPossibleRegion().GetSize() );
+  resampler->SetOutputOrigin(  image->GetOrigin() );
+  resampler->SetOutputSpacing( image->GetSpacing() );
+  resampler->SetOutputDirection( image->GetDirection() );
+  resampler->SetDefaultPixelValue( 0 );
+  resampler->Update();
+  return resampler->GetOutput();
+};
+
+
+
+//Rasterize the fitted bars on the grid of the stem region of image
+ImageType::Pointer rasterizeStem(const Stem &stem, ImageType::Pointer image){
+  ImageType::RegionType stemRegion = stemTemplateRegion( stem );
+  ImageType::PointType stemOrigin = stemTemplateOrigin( stem, image );
+  ImageType::Pointer bars = CreateBarsImage( stemRegion, image->GetSpacing(), stemOrigin,
+                                             stem.barsYStart, stem.barsXStart1, stem.barsXEnd1,
+                                             stem.barsXStart2, stem.barsXEnd2 );
+  ITKFilterFunctions<ImageType>::SigmaArrayType sigma;
+  sigma[0] = 3.0 * image->GetSpacing()[0]; 
+  sigma[1] = 3.0 * image->GetSpacing()[1]; 
+  bars = ITKFilterFunctions<ImageType>::GaussSmooth(bars, sigma);
+
+  SimilarityTransformType::Pointer inverse = SimilarityTransformType::New();
+  stemTransform( stem )->GetInverse( inverse );
+
+  ResampleFilterType::Pointer resampler = ResampleFilterType::New();
+  resampler->SetInput( bars );
+  resampler->SetTransform( inverse );
+  resampler->SetSize( stemRegion.GetSize() );
+  resampler->SetOutputOrigin( stemOrigin );
+  resampler->SetOutputSpacing( image->GetSpacing() );
+  resampler->SetOutputDirection( image->GetDirection() );
+  resampler->SetDefaultPixelValue( 0 );
+  resampler->Update();
+  return resampler->GetOutput();
+};
+
+
+
+//Overlay geometry of the fitted eye ring
+OverlayRenderer<ImageType>::EllipseRing overlayRing(const Eye &eye){
+  AffineTransformType::Pointer inverse = AffineTransformType::New();
+  eyeTransform( eye )->GetInverse( inverse );
+
+  OverlayRenderer<ImageType>::EllipseRing ring;
+  for(int i=0; i<2; i++){
+    ring.center[i] = eye.initialCenter[i];
+    ring.offset[i] = inverse->GetOffset()[i];
+    for(int j=0; j<2; j++){
+      ring.matrix[i][j] = inverse->GetMatrix()(i, j);
+    }
+  }
+  ring.radius[0] = eye.r1;
+  ring.radius[1] = eye.r2;
+  ring.ringFactor = eye.rf;
+  return ring;
+};
+
+
+
+//Overlay geometry of the fitted stem bars
+OverlayRenderer<ImageType>::Bars overlayBars(const Stem &stem, ImageType::Pointer image){
+  SimilarityTransformType::Pointer inverse = SimilarityTransformType::New();
+  stemTransform( stem )->GetInverse( inverse );
+
+  ImageType::PointType stemOrigin = stemTemplateOrigin( stem, image );
+
+  OverlayRenderer<ImageType>::Bars bars;
+  bars.region = stem.originalImageRegion;
+  for(int i=0; i<2; i++){
+    bars.origin[i] = stemOrigin[i];
+    bars.spacing[i] = image->GetSpacing()[i];
+    bars.offset[i] = inverse->GetOffset()[i];
+    for(int j=0; j<2; j++){
+      bars.matrix[i][j] = inverse->GetMatrix()(i, j);
+    }
+  }
+  bars.yStart = stem.barsYStart;
+  bars.yEnd = stem.originalImageRegion.GetSize()[1];
+  bars.xStart1 = stem.barsXStart1;
+  bars.xEnd1 = stem.barsXEnd1;
+  bars.xStart2 = stem.barsXStart2;
+  bars.xEnd2 = stem.barsXEnd2;
+  return bars;
+};
+
+
+
+
+
+
+
+//Multi resolution schedule of a registration, missing smoothing sigmas 
+//are set to zero
+void setRegistrationLevels( RegistrationType::Pointer registration, 
+                            const std::vector<unsigned int> &shrinkFactors,
+                            const std::vector<double> &smoothingSigmas ){
+  unsigned int nLevels = shrinkFactors.size();
+  RegistrationType::ShrinkFactorsArrayType shrinkFactorsPerLevel;
+  shrinkFactorsPerLevel.SetSize( nLevels );
+  RegistrationType::SmoothingSigmasArrayType smoothingSigmasPerLevel;
+  smoothingSigmasPerLevel.SetSize( nLevels );
+  for(unsigned int i=0; i<nLevels; i++){
+    shrinkFactorsPerLevel[i] = shrinkFactors[i];
+    smoothingSigmasPerLevel[i] = i < smoothingSigmas.size() ? smoothingSigmas[i] : 0;
+  }
+  registration->SetNumberOfLevels ( nLevels );
+  registration->SetSmoothingSigmasPerLevel( smoothingSigmasPerLevel );
+  registration->SetShrinkFactorsPerLevel( shrinkFactorsPerLevel );
+};
+
+
+
+//Deadline of the registrations of an image, measured from the start of 
+//fitEye
+RegistrationDeadline fitDeadline( const Eye &eye, const FitParameters &parameters ){
+  RegistrationDeadline deadline;
+  deadline.time = eye.fitStart + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                   std::chrono::duration<double>( parameters.deadline ) );
+  return deadline;
+};
+
+
+
+typedef RegistrationTelemetryObserver<OptimizerType> TelemetryObserverType;
+typedef FastMeanSquaresMetric< ImageType, ImageType > FastMetricType;
+
+
+
+//Stops a registration at a deadline by aborting from within the optimizer.
+//Keeps the parameters of the best iteration of the current level, levels
+//are not compared since the metric values depend on the smoothing.
+class DeadlineObserver : public itk::Command{
+
+  public:
+
+    typedef DeadlineObserver Self;
+    typedef itk::Command Superclass;
+    typedef itk::SmartPointer<Self> Pointer;
+
+    typedef itk::Transform< double, 2, 2 > TransformType;
+
+  itkNewMacro( Self );
+
+
+  template <typename TRegistration>
+  void Observe(TRegistration *registration, OptimizerType *optimizer, 
+               TransformType *transform, RegistrationDeadline *deadline){
+    m_Optimizer = optimizer;
+    m_Transform = transform;
+    m_Deadline = deadline;
+    m_Deadline->reached = false;
+    m_Deadline->iterations = 0;
+    m_BestParameters = transform->GetParameters();
+    registration->AddObserver( itk::MultiResolutionIterationEvent(), this );
+    optimizer->AddObserver( itk::IterationEvent(), this );
+  };
+
+  //Restore the best parameters if the deadline was reached
+  void Finish(){
+    if( m_Deadline != NULL && m_Deadline->reached ){
+      m_Transform->SetParameters( m_BestParameters );
+    }
+  };
+
+
+  void Execute(itk::Object *caller, const itk::EventObject &event) override{
+    Execute( (const itk::Object *) caller, event );
+  };
+
+  void Execute(const itk::Object *, const itk::EventObject &event) override{
+    if( m_Deadline == NULL ){
+      return;
+    }
+    if( itk::MultiResolutionIterationEvent().CheckEvent( &event ) ){
+      m_BestValue = itk::NumericTraits<double>::max();
+      m_BestParameters = m_Transform->GetParameters();
+    }
+    else if( !itk::FunctionEvaluationIterationEvent().CheckEvent( &event ) &&
+             !itk::GradientEvaluationIterationEvent().CheckEvent( &event ) &&
+             !itk::FunctionAndGradientEvaluationIterationEvent().CheckEvent( &event ) ){
+      m_Deadline->iterations++;
+      if( m_Optimizer->GetCachedValue() < m_BestValue ){
+        m_BestValue = m_Optimizer->GetCachedValue();
+        m_BestParameters = m_Transform->GetParameters();
+      }
+    }
+
+    if( std::chrono::steady_clock::now() >= m_Deadline->time ){
+      m_Deadline->reached = true;
+      throw itk::ProcessAborted( __FILE__, __LINE__ );
+    }
+  };
+
+
+  protected:
+
+    DeadlineObserver() : m_Optimizer(NULL), m_Transform(NULL), m_Deadline(NULL),
+                         m_BestValue( itk::NumericTraits<double>::max() ) {};
+
+  private:
+
+    OptimizerType *m_Optimizer;
+    TransformType *m_Transform;
+    RegistrationDeadline *m_Deadline;
+    double m_BestValue;
+    TransformType::ParametersType m_BestParameters;
+
+};
+
+//Label the recorded levels with the shrink factors of the schedule
+void setTelemetryShrinkFactors( RegistrationTelemetry *telemetry, 
+                                const std::vector<unsigned int> &shrinkFactors ){
+  if( telemetry == NULL ){
+    return;
+  }
+  for(unsigned int i=0; i<telemetry->levels.size() && i<shrinkFactors.size(); i++){
+    telemetry->levels[i].shrinkFactor = shrinkFactors[i];
+  }
+};
+
+
+
+//ITK or fast mean squares metric, see FitParameters::fastMetric
+MetricType::Pointer newMetric( const FitParameters &parameters ){
+  if( parameters.fastMetric ){
+    return FastMetricType::New().GetPointer();
+  }
+  return MetricType::New();
+};
+
+
+
+//Affine registration of the smoothed eye image (moving) to the ellipse ring
+//image (fixed) measured within fixedMask. The transform is centered at 
+//center. Step C 2. of the eye estimation.
+AffineTransformType::Pointer registerEye( ImageType::Pointer fixedImage, 
+                                          ImageType::Pointer movingImage,
+                                          ImageType::Pointer fixedMask,
+                                          ImageType::PointType center,
+                                          const FitParameters &parameters,
+                                          RegistrationTelemetry *telemetry,
+                                          RegistrationDeadline *deadline,
+                                          const AffineTransformType::ParametersType *initialParameters ){
+
+  AffineTransformType::Pointer transform = AffineTransformType::New();
+  transform->SetCenter(center);
+  if( initialParameters != NULL ){
+    transform->SetParameters( *initialParameters );
+  }
+
+
+  MetricType::Pointer         metric        = newMetric( parameters );
+  OptimizerType::Pointer      optimizer       = OptimizerType::New();
+  InterpolatorType::Pointer   movingInterpolator  = InterpolatorType::New();
+  InterpolatorType::Pointer   fixedInterpolator  = InterpolatorType::New();
+  RegistrationType::Pointer   registration  = RegistrationType::New();
+
+
+  optimizer->SetGradientConvergenceTolerance( parameters.gradientConvergenceTolerance );
+  optimizer->SetLineSearchAccuracy( parameters.lineSearchAccuracy );
+  optimizer->SetDefaultStepLength( parameters.defaultStepLength );
+#ifdef DEBUG_PRINT
+  optimizer->TraceOn();
+#endif
+  optimizer->SetMaximumNumberOfFunctionEvaluations( parameters.maximumNumberOfFunctionEvaluations );
+
+  
+  OptimizerType::ScalesType scales( transform->GetNumberOfParameters() );
+  scales[0] = 1.0;
+  scales[1] = 1.0;
+  scales[2] = 1.0; 
+  scales[3] = 1.0; 
+  scales[4] = 1.0; 
+  scales[5] = 1.0;  
+  optimizer->SetScales( scales );
+
+
+  metric->SetMovingInterpolator( movingInterpolator );
+  metric->SetFixedInterpolator( fixedInterpolator );  
+
+  
+  CastFilter::Pointer castFilter3 = CastFilter::New();
+  castFilter3->SetInput( fixedMask );
+  castFilter3->Update();
+  MaskType::Pointer  spatialObjectMask = MaskType::New();
+  spatialObjectMask->SetImage( castFilter3->GetOutput() );
+  metric->SetFixedImageMask( spatialObjectMask );
+	  
+
+  registration->SetMetric(        metric        );
+  registration->SetOptimizer(     optimizer     );
+
+  registration->SetMovingImage(    movingImage    );
+  registration->SetFixedImage(   fixedImage   );
+
+#ifdef DEBUG_PRINT
+  std::cout <<  transform->GetParameters()  << std::endl;
+  std::cout <<  transform->GetCenter()  << std::endl;
+#endif
+  registration->SetInitialTransform( transform );
+    
+  setRegistrationLevels( registration, parameters.eyeShrinkFactors, 
+                         parameters.eyeSmoothingSigmas );
+
+  TelemetryObserverType::Pointer observer = TelemetryObserverType::New();
+  if( telemetry != NULL ){
+    observer->Observe( registration.GetPointer(), optimizer.GetPointer(), telemetry );
+  }
+  DeadlineObserver::Pointer deadlineObserver = DeadlineObserver::New();
+  if( deadline != NULL ){
+    deadlineObserver->Observe( registration.GetPointer(), optimizer.GetPointer(), 
+                               transform.GetPointer(), deadline );
+  }
+  
+  //Do registration
+  try{
+	  registration->SetNumberOfThreads(1);
+	  registration->Update();
+  }
+  catch( itk::ExceptionObject & err ){
+#ifdef DEBUG_PRINT
+	  std::cerr << "ExceptionObject caught !" << std::endl;
+	  std::cerr << err << std::endl;
+	  //return EXIT_FAILURE;
+#endif
+  }
+  observer->Finish();
+  deadlineObserver->Finish();
+  setTelemetryShrinkFactors( telemetry, parameters.eyeShrinkFactors );
+
+
+#ifdef DEBUG_PRINT
+  const double bestValue = optimizer->GetValue();
+  std::cout << "Result = " << std::endl;
+  std::cout << " Metric value  = " << bestValue          << std::endl;
+
+  std::cout << "Optimized transform paramters:" << std::endl;
+  std::cout <<  registration->GetTransform()->GetParameters()  << std::endl;
+  std::cout <<  transform->GetCenter()  << std::endl;
+#endif
+
+  return transform;
+};
+
+
+
+//Halves the shrink factor from the coarsest allowed one, see 
+//EyeAndStemFitting.h
+void stemLevelSchedule( ImageType::SizeType size, ImageType::SpacingType spacing,
+                        double initialWidth, const FitParameters &parameters,
+                        std::vector<unsigned int> &shrinkFactors,
+                        std::vector<double> &smoothingSigmas ){
+  //The bars of step B 1. are half the initial width wide
+  double barPixels = 0.5 * initialWidth / spacing[0];
+  unsigned int minSize = std::min( size[0], size[1] );
+  unsigned int coarsest = 1;
+  while( 2 * coarsest <= parameters.stemMaxShrinkFactor &&
+         barPixels / ( 2 * coarsest ) >= parameters.stemMinBarPixels &&
+         minSize / ( 2 * coarsest ) >= parameters.stemMinLevelSize ){
+    coarsest *= 2;
+  }
+
+  //Smoothing sigmas of the registration are in physical units
+  double maxSpacing = std::max( spacing[0], spacing[1] );
+  shrinkFactors.clear();
+  smoothingSigmas.clear();
+  for(unsigned int factor = coarsest; factor >= 1; factor /= 2){
+    shrinkFactors.push_back( factor );
+    smoothingSigmas.push_back( factor > 1 ? 0.25 * factor * maxSpacing : 0 );
+  }
+};
+
+
+
+//Similarity registration of the thresholded stem region (moving) to the 
+//bars image (fixed) measured within fixedMask. The transform is centered at
+//center. Step C 2. of the stem estimation.
+SimilarityTransformType::Pointer registerStem( ImageType::Pointer fixedImage, 
+                                               ImageType::Pointer movingImage,
+                                               UnsignedCharImageType::Pointer fixedMask,
+                                               ImageType::PointType center,
+                                               const FitParameters &parameters,
+                                               RegistrationTelemetry *telemetry,
+                                               RegistrationDeadline *deadline ){
+
+  SimilarityTransformType::Pointer transform = SimilarityTransformType::New();
+  transform->SetCenter( center );
+
+
+  MetricType::Pointer         metric        = newMetric( parameters );
+  OptimizerType::Pointer      optimizer       = OptimizerType::New();
+  InterpolatorType::Pointer   movingInterpolator  = InterpolatorType::New();
+  InterpolatorType::Pointer   fixedInterpolator  = InterpolatorType::New();
+  RegistrationType::Pointer   registration  = RegistrationType::New();
+
+  optimizer->SetGradientConvergenceTolerance( parameters.gradientConvergenceTolerance );
+  optimizer->SetLineSearchAccuracy( parameters.lineSearchAccuracy );
+  optimizer->SetDefaultStepLength( parameters.defaultStepLength );
+#ifdef DEBUG_PRINT
+  optimizer->TraceOn();
+#endif
+  optimizer->SetMaximumNumberOfFunctionEvaluations( parameters.maximumNumberOfFunctionEvaluations );
+
+  
+  //Using a Quasi-Newton method, make sure scales are set to identity to 
+  //not destory the approximation of the Hessian
+#ifdef DEBUG_PRINT
+  std::cout << transform->GetNumberOfParameters() << std::endl;
+#endif
+  OptimizerType::ScalesType scales( transform->GetNumberOfParameters() );
+  scales[0] = 1.0;
+  scales[1] = 1.0;
+  scales[2] = 1.0; 
+  scales[3] = 1.0; 
+  optimizer->SetScales( scales );
+
+
+  metric->SetMovingInterpolator( movingInterpolator );
+  metric->SetFixedInterpolator( fixedInterpolator );  
+ 
+  MaskType::Pointer  spatialObjectMask = MaskType::New();
+  spatialObjectMask->SetImage( fixedMask );
+  metric->SetFixedImageMask( spatialObjectMask );
+
+
+  registration->SetMetric(        metric        );
+  registration->SetOptimizer(     optimizer     );
+  registration->SetMovingImage(    movingImage    );
+  registration->SetFixedImage(   fixedImage  );
+
+#ifdef DEBUG_PRINT
+  std::cout << "Transform parameters: " << std::endl;
+  std::cout <<  transform->GetParameters()  << std::endl;
+  std::cout <<  transform->GetCenter()  << std::endl;
+#endif
+
+  registration->SetInitialTransform( transform );
+    
+  setRegistrationLevels( registration, parameters.stemShrinkFactors, 
+                         parameters.stemSmoothingSigmas );
+
+  TelemetryObserverType::Pointer observer = TelemetryObserverType::New();
+  if( telemetry != NULL ){
+    observer->Observe( registration.GetPointer(), optimizer.GetPointer(), telemetry );
+  }
+  DeadlineObserver::Pointer deadlineObserver = DeadlineObserver::New();
+  if( deadline != NULL ){
+    deadlineObserver->Observe( registration.GetPointer(), optimizer.GetPointer(), 
+                               transform.GetPointer(), deadline );
+  }
+  
+  //Do registration
+  try{
+	  registration->SetNumberOfThreads(1);
+	  registration->Update();
+  }
+  catch( itk::ExceptionObject & err ){
+#ifdef DEBUG_PRINT
+	  std::cerr << "ExceptionObject caught !" << std::endl;
+	  std::cerr << err << std::endl;
+#endif
+	  //return EXIT_FAILURE;
+  }
+  observer->Finish();
+  deadlineObserver->Finish();
+  setTelemetryShrinkFactors( telemetry, parameters.stemShrinkFactors );
+
+ 
+#ifdef DEBUG_PRINT 
+  const double bestValue = optimizer->GetValue();
+  std::cout << "Result = " << std::endl;
+  std::cout << " Metric value  = " << bestValue          << std::endl;
+
+  std::cout << "Registered transform parameters: " << std::endl;
+  std::cout <<  registration->GetTransform()->GetParameters()  << std::endl;
+  std::cout <<  transform->GetCenter()  << std::endl;
+#endif
+
+  return transform;
+};
+
+
+
+
+
+
+//Steps A 4.4.1 and 4.4.2 of the eye estimation: distance transform of a
+//slab of 20 pixels through centerIndex, along y for axis 1 and along x for
+//axis 0. The border and the cast are only computed on the slab pulled by 
+//the distance transform. Returns the largest distance to the eye border.
+double eyeSlabRadius( ImageType::Pointer image, ImageType::IndexType centerIndex,
+                      unsigned int axis, ImageType::Pointer *distance = NULL ){
+
+  ImageType::SizeType slabSize = image->GetLargestPossibleRegion().GetSize();
+  slabSize[1 - axis] = 20;
+  ImageType::IndexType slabIndex;
+  slabIndex[axis] = 0;
+  slabIndex[1 - axis] = centerIndex[1 - axis] - 10;
+  ImageType::RegionType slabRegion( slabIndex, slabSize );
+
+  ITKPipeline<ImageType> slabPipeline( image );
+  slabPipeline.AddVerticalBorder( 2 ).Extract( slabRegion );
+  CastFilter::Pointer castFilter = CastFilter::New();
+  castFilter->SetInput( slabPipeline.GetOutput() );
+
+  SignedDistanceFilter::Pointer signedDistance = SignedDistanceFilter::New();
+  signedDistance->SetInput( castFilter->GetOutput() );
+  signedDistance->SetInsideValue(100);
+  signedDistance->SetOutsideValue(0);
+  signedDistance->Update();
+
+  ImageCalculatorFilterType::Pointer imageCalculator = ImageCalculatorFilterType::New ();
+  imageCalculator->SetImage( signedDistance->GetOutput() );
+  imageCalculator->Compute();
+
+  if( distance != NULL ){
+    *distance = signedDistance->GetOutput();
+  }
+  return imageCalculator->GetMaximum();
+};
+
+
+
+//Step C 1. of the eye estimation: a mask that only measures mismatch in 
+//an ellipse region matching the ellipse ring image, but not including the
+//left and right corners of the eye (they are often black but sometimes 
+//white)
+ImageType::Pointer CreateEyeMaskImage( ImageType::SpacingType spacing, 
+                                       ImageType::SizeType size, 
+                                       ImageType::PointType origin,
+                                       ImageType::PointType center,
+                                       ImageType::IndexType centerIndex,
+                                       double r1, double r2, double rf ){
+
+  ImageType::Pointer mask = CreateEllipseImage( spacing, size, origin, 
+                                                center, r1*(rf+1)/2, r2*(rf+1)/2, 0, 100 );
+  //remove left and right corners from mask
+  for(int i=0; i<centerIndex[0] - 0.9*r1; i++){
+    ImageType::IndexType index;
+    index[0] = i; 
+    for(int j=centerIndex[1] - 0.4 * r2; j < centerIndex[1] + 0.4 * r2; j++){
+      index[1]=j;
+      mask->SetPixel(index, 0);
+    }
+  }
+  for(int i=centerIndex[0] + 0.9*r1; i < size[0]; i++){
+    ImageType::IndexType index;
+    index[0] = i; 
+    for(int j=centerIndex[1] - 0.4 * r2; j < centerIndex[1] + 0.4 * r2; j++){
+      index[1]=j;
+      mask->SetPixel(index, 0);
+    }
+  } 
+  return mask;
+};
+
+
+
+//Initial eye radius rounded to a multiple of FitParameters::templateRadiusStep
+//pixels if templates are cached, unchanged otherwise
+double eyeTemplateRadius( double r, double spacing, const FitParameters &parameters ){
+  if( !parameters.templateCache || parameters.templateRadiusStep <= 0 ){
+    return r;
+  }
+  double step = parameters.templateRadiusStep * spacing;
+  return std::max( step, step * std::floor( r / step + 0.5 ) );
+};
+
+
+std::string eyeTemplateKey( ImageType::SpacingType spacing, ImageType::SizeType size,
+                            double r1, double r2, double rf ){
+  std::stringstream key;
+  key << std::setprecision(17) << size << spacing << " " << r1 << " " << r2 << " " << rf;
+  return key.str();
+};
+
+
+//Whether the ring, including 3 sigma of the smoothing of 
+//CreateEllipseRingImage, lies inside the image
+bool eyeTemplateInside( ImageType::SpacingType spacing, ImageType::SizeType size,
+                        ImageType::IndexType centerIndex, double r1, double r2, double rf ){
+  double margin = 30;
+  double extent[2] = { rf * r1 / spacing[0] + margin, rf * r2 / spacing[1] + margin };
+  for(unsigned int i=0; i<2; i++){
+    if( centerIndex[i] - extent[i] < 0 || centerIndex[i] + extent[i] > size[i] - 1.0 ){
+      return false;
+    }
+  }
+  return true;
+};
+
+
+//Cached eye templates are built centered in the image, see TemplateCache.h
+ImageType::IndexType eyeTemplateBuildAnchor( ImageType::SizeType size ){
+  ImageType::IndexType anchor;
+  anchor[0] = size[0] / 2;
+  anchor[1] = size[1] / 2;
+  return anchor;
+};
+
+
+//Physical point of the template anchor, the center itself if the template
+//is built at the center index
+ImageType::PointType eyeTemplateCenter( ImageType::SpacingType spacing, ImageType::PointType origin,
+                                        ImageType::PointType center, ImageType::IndexType centerIndex,
+                                        ImageType::IndexType anchor ){
+  if( anchor == centerIndex ){
+    return center;
+  }
+  for(unsigned int i=0; i<2; i++){
+    center[i] = origin[i] + spacing[i] * anchor[i];
+  }
+  return center;
+};
+
+
+//CreateEllipseRingImage and CreateEyeMaskImage through TemplateCache if
+//FitParameters::templateCache is set
+ImageType::Pointer eyeRingTemplate( ImageType::SpacingType spacing, 
+                                    ImageType::SizeType size, 
+                                    ImageType::PointType origin,
+                                    ImageType::PointType center,
+                                    ImageType::IndexType centerIndex,
+                                    double r1, double r2, double rf,
+                                    const FitParameters &parameters ){
+  if( !parameters.templateCache ){
+    return CreateEllipseRingImage( spacing, size, origin, center, r1, r2, rf );
+  }
+  ImageType::IndexType buildAnchor = eyeTemplateBuildAnchor( size );
+  bool cacheable = eyeTemplateInside( spacing, size, centerIndex, r1, r2, rf ) &&
+                   eyeTemplateInside( spacing, size, buildAnchor, r1, r2, rf );
+  TemplateCache &cache = TemplateCache::Instance();
+  cache.SetCapacity( parameters.templateCacheSize );
+  return cache.Get<ImageType>( TemplateCache::EYE_RING, eyeTemplateKey( spacing, size, r1, r2, rf ),
+                               centerIndex, buildAnchor, origin, cacheable, 
+                               [&](const ImageType::IndexType &anchor){
+    return CreateEllipseRingImage( spacing, size, origin, 
+                                   eyeTemplateCenter( spacing, origin, center, centerIndex, anchor ),
+                                   r1, r2, rf );
+  } );
+};
+
+
+ImageType::Pointer eyeMaskTemplate( ImageType::SpacingType spacing, 
+                                    ImageType::SizeType size, 
+                                    ImageType::PointType origin,
+                                    ImageType::PointType center,
+                                    ImageType::IndexType centerIndex,
+                                    double r1, double r2, double rf,
+                                    const FitParameters &parameters ){
+  if( !parameters.templateCache ){
+    return CreateEyeMaskImage( spacing, size, origin, center, centerIndex, r1, r2, rf );
+  }
+  ImageType::IndexType buildAnchor = eyeTemplateBuildAnchor( size );
+  bool cacheable = eyeTemplateInside( spacing, size, centerIndex, r1, r2, rf ) &&
+                   eyeTemplateInside( spacing, size, buildAnchor, r1, r2, rf );
+  TemplateCache &cache = TemplateCache::Instance();
+  cache.SetCapacity( parameters.templateCacheSize );
+  return cache.Get<ImageType>( TemplateCache::EYE_MASK, eyeTemplateKey( spacing, size, r1, r2, rf ),
+                               centerIndex, buildAnchor, origin, cacheable, 
+                               [&](const ImageType::IndexType &anchor){
+    return CreateEyeMaskImage( spacing, size, origin, 
+                               eyeTemplateCenter( spacing, origin, center, centerIndex, anchor ),
+                               anchor, r1, r2, rf );
+  } );
+};
+
+
+
+//Local maxima of the distance transform of step A 4.3 of at least half the
+//largest distance, strongest first and at least separation times the 
+//largest distance apart. The first is the global maximum, none are found 
+//in images without an eye blob.
+std::vector<ImageType::IndexType> eyeDistanceMaxima( ImageType::Pointer distance,
+                                                     unsigned int n, double separation ){
+  std::vector<ImageType::IndexType> maxima;
+  ImageType::RegionType region = distance->GetBufferedRegion();
+  int width = region.GetSize()[0];
+  int height = region.GetSize()[1];
+  const PixelType *buffer = distance->GetBufferPointer();
+  PixelType maximum = *std::max_element( buffer, buffer + region.GetNumberOfPixels() );
+  if( maximum <= 0 ){
+    return maxima;
+  }
+
+  //Value and offset of pixels not below any of their 8 neighbors
+  std::vector< std::pair<PixelType, int> > candidates;
+  for(int y=0; y<height; y++){
+    for(int x=0; x<width; x++){
+      PixelType value = buffer[y * width + x];
+      if( value < 0.5 * maximum ){
+        continue;
+      }
+      bool isMaximum = true;
+      for(int dy = std::max( y - 1, 0 ); dy <= std::min( y + 1, height - 1 ) && isMaximum; dy++){
+        for(int dx = std::max( x - 1, 0 ); dx <= std::min( x + 1, width - 1 ); dx++){
+          if( buffer[dy * width + dx] > value ){
+            isMaximum = false;
+            break;
+          }
+        }
+      }
+      if( isMaximum ){
+        candidates.push_back( std::make_pair( value, y * width + x ) );
+      }
+    }
+  }
+  std::stable_sort( candidates.begin(), candidates.end(), 
+                    []( const std::pair<PixelType, int> &a, const std::pair<PixelType, int> &b ){
+                      return a.first > b.first;
+                    } );
+
+  //Suppress maxima close to a stronger one
+  double minimumDistance = separation * maximum;
+  for(unsigned int i=0; i<candidates.size() && maxima.size() < n; i++){
+    ImageType::IndexType index = region.GetIndex();
+    index[0] += candidates[i].second % width;
+    index[1] += candidates[i].second / width;
+    bool separated = true;
+    for(unsigned int j=0; j<maxima.size() && separated; j++){
+      double dx = index[0] - maxima[j][0];
+      double dy = index[1] - maxima[j][1];
+      separated = dx*dx + dy*dy >= minimumDistance * minimumDistance;
+    }
+    if( separated ){
+      maxima.push_back( index );
+    }
+  }
+  return maxima;
+};
+
+
+
+//Initialization of the eye registration, see FitParameters::eyeHypothesisCenters
+struct EyeHypothesis{
+  ImageType::IndexType centerIndex;
+  ImageType::PointType center;
+  double radius = -1;
+  double radiusY = -1;
+  double r1 = -1;
+  double r2 = -1;
+  ImageType::Pointer ring;
+  ImageType::Pointer mask;
+  //Result and metric value of the coarse registration
+  AffineTransformType::ParametersType parameters;
+  double value = std::numeric_limits<double>::max();
+};
+
+
+//Registers every hypothesis on the coarsest level and returns the one with
+//the lowest metric value, ties go to the default initialization. The mean
+//squares are taken within each mask and so are comparable between the 
+//hypotheses. At the deadline, if not NULL, running registrations are 
+//stopped and the others skipped, the best hypothesis registered so far is
+//returned. Returns no ring if no hypothesis could be registered.
+EyeHypothesis selectEyeHypothesis( ImageType::Pointer image, ImageType::Pointer distance,
+                                   ImageType::Pointer imageSmooth, const FitParameters &parameters,
+                                   const RegistrationDeadline *deadline ){
+
+  std::vector<ImageType::IndexType> centers = 
+    eyeDistanceMaxima( distance, parameters.eyeHypothesisCenters, parameters.eyeHypothesisSeparation );
+  std::vector<double> ratios( 1, parameters.eyeAspectRatio );
+  for(unsigned int i=0; i<parameters.eyeHypothesisAspectRatios.size(); i++){
+    if( std::find( ratios.begin(), ratios.end(), parameters.eyeHypothesisAspectRatios[i] ) == ratios.end() ){
+      ratios.push_back( parameters.eyeHypothesisAspectRatios[i] );
+    }
+  }
+
+  FitParameters coarse = parameters;
+  if( !parameters.eyeShrinkFactors.empty() ){
+    coarse.eyeShrinkFactors.assign( 1, parameters.eyeShrinkFactors.front() );
+  }
+  if( !parameters.eyeSmoothingSigmas.empty() ){
+    coarse.eyeSmoothingSigmas.assign( 1, parameters.eyeSmoothingSigmas.front() );
+  }
+  coarse.maximumNumberOfFunctionEvaluations = parameters.eyeHypothesisEvaluations;
+
+  ImageType::SpacingType spacing = image->GetSpacing();
+  ImageType::SizeType size = image->GetLargestPossibleRegion().GetSize();
+  ImageType::PointType origin = image->GetOrigin();
+
+  //The vertical radius is shared by the hypotheses of a center. Each task
+  //reads its own view of the shared images, see TaskGraph.h.
+  std::vector<double> radiiY( centers.size() );
+  std::vector<EyeHypothesis> hypotheses( centers.size() * ratios.size() );
+  std::vector<ImageType::Pointer> slabImages( centers.size() );
+  std::vector<ImageType::Pointer> movingImages( hypotheses.size() );
+  for(unsigned int i=0; i<slabImages.size(); i++){
+    slabImages[i] = ITKFilterFunctions<ImageType>::View( image );
+  }
+  for(unsigned int i=0; i<movingImages.size(); i++){
+    movingImages[i] = ITKFilterFunctions<ImageType>::View( imageSmooth );
+  }
+  TaskGraph graph( parameters.stageThreads );
+  for(unsigned int i=0; i<centers.size(); i++){
+    TaskGraph::TaskId slab = graph.Add( "Eye hypothesis slab", [&, i](){
+      radiiY[i] = eyeSlabRadius( slabImages[i], centers[i], 1 );
+    } );
+    for(unsigned int j=0; j<ratios.size(); j++){
+      graph.Add( "Eye hypothesis", [&, i, j](){
+        if( deadline != NULL && std::chrono::steady_clock::now() >= deadline->time ){
+          return;
+        }
+        EyeHypothesis &h = hypotheses[ i * ratios.size() + j ];
+        h.centerIndex = centers[i];
+        image->TransformIndexToPhysicalPoint( h.centerIndex, h.center );
+        h.radius = distance->GetPixel( h.centerIndex );
+        h.radiusY = radiiY[i];
+        h.r1 = eyeTemplateRadius( ratios[j] * h.radiusY, spacing[0], parameters );
+        h.r2 = eyeTemplateRadius( h.radiusY, spacing[1], parameters );
+        h.ring = eyeRingTemplate( spacing, size, origin, h.center, h.centerIndex, 
+                                  h.r1, h.r2, parameters.eyeRingFactor, parameters );
+        h.mask = eyeMaskTemplate( spacing, size, origin, h.center, h.centerIndex, 
+                                  h.r1, h.r2, parameters.eyeRingFactor, parameters );
+
+        //Each registration reports on its own copy of the deadline
+        RegistrationTelemetry telemetry;
+        RegistrationDeadline hypothesisDeadline;
+        if( deadline != NULL ){
+          hypothesisDeadline.time = deadline->time;
+        }
+        AffineTransformType::Pointer transform = registerEye( h.ring, movingImages[ i * ratios.size() + j ], 
+                                                              h.mask, h.center, coarse, &telemetry,
+                                                              deadline != NULL ? &hypothesisDeadline : NULL );
+        h.parameters = transform->GetParameters();
+        if( !telemetry.levels.empty() && !telemetry.levels.back().metricValues.empty() ){
+          h.value = telemetry.levels.back().metricValues.back();
+        }
+      }, {slab} );
+    }
+  }
+  graph.Run();
+
+  EyeHypothesis best;
+  for(unsigned int i=0; i<hypotheses.size(); i++){
+#ifdef DEBUG_PRINT
+    std::cout << "Eye hypothesis " << hypotheses[i].centerIndex << ", r1 " << hypotheses[i].r1
+              << ", r2 " << hypotheses[i].r2 << ": " << hypotheses[i].value << std::endl;
+#endif
+    if( hypotheses[i].value < best.value ){
+      best = hypotheses[i];
+    }
+  }
+  return best;
+};
+
+
+
+//Cheap rejection of unusable images on block means, see EyeAndStemFitting.h
+FitStatus gateInput(ImageType::Pointer inputImage, const FitParameters &parameters){
+
+  ImageType::SizeType size = inputImage->GetLargestPossibleRegion().GetSize();
+  const PixelType *buffer = inputImage->GetBufferPointer();
+
+  //Block means from a grid of about 4x4 samples per block
+  const unsigned long block = std::max( 1u, parameters.gateBlockSize );
+  const unsigned long step = std::max( 1ul, block / 4 );
+  const unsigned long nx = std::max( 1ul, (unsigned long) size[0] / block );
+  const unsigned long ny = std::max( 1ul, (unsigned long) size[1] / block );
+
+  std::vector<double> means( nx * ny );
+  double minValue = itk::NumericTraits<double>::max();
+  double maxValue = itk::NumericTraits<double>::NonpositiveMin();
+  for(unsigned long by=0; by<ny; by++){
+    unsigned long yEnd = std::min( (by + 1) * block, (unsigned long) size[1] );
+    for(unsigned long bx=0; bx<nx; bx++){
+      unsigned long xEnd = std::min( (bx + 1) * block, (unsigned long) size[0] );
+      double sum = 0;
+      unsigned int n = 0;
+      for(unsigned long y=by*block; y<yEnd; y+=step){
+        const PixelType *row = buffer + y * size[0];
+        for(unsigned long x=bx*block; x<xEnd; x+=step){
+          sum += row[x];
+          n++;
+        }
+      }
+      double mean = sum / n;
+      means[by * nx + bx] = mean;
+      minValue = std::min( minValue, mean );
+      maxValue = std::max( maxValue, mean );
+    }
+  }
+
+  //Contrast as range between the 5 and 95 percentile in input intensities
+  std::vector<double> sorted( means );
+  size_t i5 = sorted.size() * 5 / 100;
+  size_t i95 = std::min( sorted.size() * 95 / 100, sorted.size() - 1 );
+  std::nth_element( sorted.begin(), sorted.begin() + i5, sorted.end() );
+  double p5 = sorted[i5];
+  std::nth_element( sorted.begin(), sorted.begin() + i95, sorted.end() );
+  double p95 = sorted[i95];
+  if( maxValue <= minValue || p95 - p5 < parameters.gateMinContrast ){
+    return FIT_LOW_CONTRAST;
+  }
+
+  //Rescale to [0, 100] as step A 1.
+  for(unsigned int i=0; i<means.size(); i++){
+    means[i] = 100.0 * ( means[i] - minValue ) / ( maxValue - minValue );
+  }
+
+  //Largest 4-connected blob of blocks darker than the step A 4. threshold
+  std::vector<unsigned char> visited( means.size(), 0 );
+  std::vector<unsigned long> stack;
+  unsigned long largest = 0;
+  for(unsigned long i=0; i<means.size(); i++){
+    if( visited[i] || means[i] >= parameters.eyeThreshold ){
+      continue;
+    }
+    unsigned long count = 0;
+    visited[i] = 1;
+    stack.push_back( i );
+    while( !stack.empty() ){
+      unsigned long j = stack.back();
+      stack.pop_back();
+      count++;
+      unsigned long x = j % nx;
+      unsigned long y = j / nx;
+      unsigned long neighbors[4];
+      unsigned int nNeighbors = 0;
+      if( x > 0 ) neighbors[nNeighbors++] = j - 1;
+      if( x + 1 < nx ) neighbors[nNeighbors++] = j + 1;
+      if( y > 0 ) neighbors[nNeighbors++] = j - nx;
+      if( y + 1 < ny ) neighbors[nNeighbors++] = j + nx;
+      for(unsigned int k=0; k<nNeighbors; k++){
+        unsigned long n = neighbors[k];
+        if( !visited[n] && means[n] < parameters.eyeThreshold ){
+          visited[n] = 1;
+          stack.push_back( n );
+        }
+      }
+    }
+    largest = std::max( largest, count );
+  }
+  if( largest < parameters.gateMinEyeArea * means.size() ){
+    return FIT_NO_EYE;
+  }
+
+  return FIT_OK;
+};
+
+
+
+//Fit an ellipse to an eye ultrasound image in three main steps
+// A) Prepare moving Image
+// B) Prepare fixed image
+// C) Affine registration
+//
+//For a detailed descritpion and overview of the whole pipleine
+//see EyeAndStemFitting.h
+Eye fitEye(ImageType::Pointer inputImage, const std::string &prefix,
+           const FitParameters &parameters){
+
+#ifdef DEBUG_PRINT
+  std::cout << "--- Fitting Eye ---" << std::endl << std::endl;
+#endif
+  
+  TraceSpan spanEye( "Eye" );
+
+  Eye eye;
+  eye.fitStart = std::chrono::steady_clock::now();
+
+  //Reject unusable images before the expensive stages
+  if( parameters.inputGate ){
+    TraceSpan spanGate( "Eye gate" );
+    eye.status = gateInput( inputImage, parameters );
+    if( eye.status != FIT_OK ){
+#ifdef DEBUG_PRINT
+      std::cout << "Rejected input: " << fitStatusName( eye.status ) << std::endl;
+#endif
+      return eye;
+    }
+  }
+
+  //The steps of A), B) and C) 1. form a graph of tasks with independent 
+  //branches: step A 5. only needs the closed image of step A 4.1 and runs
+  //concurrently with steps A 4.2 to C 1., which need the initial center 
+  //and radii but not the smoothed image. The two slabs of step A 4.4.1 are
+  //independent as well.
+  TaskGraph graph( parameters.stageThreads );
+
+  ImageType::SpacingType imageSpacing = inputImage->GetSpacing();
+  ImageType::RegionType imageRegion = inputImage->GetLargestPossibleRegion();
+  ImageType::SizeType imageSize = imageRegion.GetSize();
+  ImageType::PointType imageOrigin = inputImage->GetOrigin();
+
+  //Results of the tasks. Concurrent branches read the closed image through
+  //their own views.
+  ImageType::Pointer image;
+  ImageType::Pointer imageSlabY;
+  ImageType::Pointer imageSlabX;
+  ImageType::Pointer imageA5;
+  ImageType::Pointer imageDistance;
+  ImageType::Pointer imageSmooth;
+  ImageType::Pointer ellipse;
+  ImageType::Pointer ellipseMask;
+  double r1 = 0;
+  double r2 = 0;
+  double rf = 0;
+
+  ////
+  //A. Prepare fixed image
+  ///
+
+  //-- Steps 1 to 4.1
+  //   1. Rescale the image to 0, 100
+  //   2. Adding a horizontal border
+  //   3. Gaussian smoothing
+  //   4. Binary Thresholding
+  //   4.1 Morphological closing
+  //   Steps 1 and 2 as well as 4 are fused into single passes and 
+  //   all stages are executed by a single update
+  TaskGraph::TaskId eyeA1 = graph.Add( "Eye A 1-4.1", [&](){
+
+#ifdef DEBUG_PRINT
+    std::cout << "Origin, spacing, size input image" << std::endl;
+    std::cout << imageOrigin << std::endl;
+    std::cout << imageSpacing << std::endl;
+    std::cout << imageSize << std::endl;
+#endif
+
+    ITKFilterFunctions<ImageType>::SigmaArrayType sigma;
+    sigma[0] = parameters.eyeSigma * imageSpacing[0]; 
+    sigma[1] = parameters.eyeSigma * imageSpacing[1]; 
+  
+    StructuringElementType structuringElement;
+    structuringElement.SetRadius( parameters.eyeClosingRadius );
+    structuringElement.CreateStructuringElement();
+    ClosingFilter::Pointer closingFilter = ClosingFilter::New();
+    closingFilter->SetKernel(structuringElement);
+    closingFilter->SetForegroundValue(100.0);
+
+    ITKPipeline<ImageType> eyePipeline( inputImage );
+    eyePipeline.Rescale( 0, 100 )
+               .AddHorizontalBorder( 30 )
+               .GaussSmooth( sigma )
+               .BinaryThreshold( -1, parameters.eyeThreshold, 0, 100 )
+               .Apply( closingFilter );
+    image = eyePipeline.Update();
+    image->DisconnectPipeline();
+    imageSlabY = ITKFilterFunctions<ImageType>::View( image );
+    imageSlabX = ITKFilterFunctions<ImageType>::View( image );
+    imageA5 = ITKFilterFunctions<ImageType>::View( image );
+
+  } );
+
+
+  //-- Steps 4.2 through 4.4
+  //   4.2 Adding a vertical border
+  //   4.3 Distance transfrom
+  //   4.4 Calculate inital center and radius from distance transform (Max)
+  TaskGraph::TaskId eyeA42 = graph.Add( "Eye A 4.2-4.4", [&](){
+  
+    CastFilter::Pointer castFilter = CastFilter::New();
+    castFilter->SetInput( image );
+    castFilter->Update();
+    UnsignedCharImageType::Pointer  sdImage = castFilter->GetOutput();
+  
+  
+    ITKFilterFunctions<UnsignedCharImageType>::AddVerticalBorder( sdImage, 50);
+
+    SignedDistanceFilter::Pointer signedDistanceFilter = SignedDistanceFilter::New();
+    signedDistanceFilter->SetInput( sdImage );
+    signedDistanceFilter->SetInsideValue(100);
+    signedDistanceFilter->SetOutsideValue(0);
+    signedDistanceFilter->Update();
+    imageDistance = signedDistanceFilter->GetOutput();
+
+    DebugDumps::Instance().Add( prefix, imageDistance, "-eye-distance.tif" );
+
+    //Compute max of distance transfrom 
+    ImageCalculatorFilterType::Pointer imageCalculatorFilter = ImageCalculatorFilterType::New ();
+    imageCalculatorFilter->SetImage( imageDistance );
+    imageCalculatorFilter->Compute();
+  
+    eye.initialRadius = imageCalculatorFilter->GetMaximum() ;
+    eye.initialCenterIndex = imageCalculatorFilter->GetIndexOfMaximum();
+    image->TransformIndexToPhysicalPoint(eye.initialCenterIndex, eye.initialCenter);
+  
+
+#ifdef DEBUG_PRINT
+    std::cout << "Eye inital center: " << eye.initialCenterIndex << std::endl;
+    std::cout << "Eye initial radius: "<< eye.initialRadius << std::endl;
+#endif
+
+  }, {eyeA1} );
+  
+
+
+  //-- Steps 4.4.1 through 4.4.2
+  //   4.4.1 Distance transform in X and Y seperately on region of interest 
+  //   	  around slabs of the center
+  //  4.4.2 Calculate inital x and y radius from those distamnce transforms
+  //  The vertical slab also determines the radii of the ellipse of step B.
+
+
+  //Compute vertical distance to eye border
+  TaskGraph::TaskId eyeA441Y = graph.Add( "Eye A 4.4.1-4.4.2 y", [&](){
+
+    ImageType::Pointer imageDistanceY;
+    eye.initialRadiusY = eyeSlabRadius( imageSlabY, eye.initialCenterIndex, 1, &imageDistanceY );
+
+    DebugDumps::Instance().Add( prefix, imageDistanceY, "-eye-ydistance.tif" );
+
+#ifdef DEBUG_PRINT
+    std::cout << "Eye initial radiusY: "<< eye.initialRadiusY << std::endl;
+#endif
+
+    //intial guess of major axis
+    r1 = eyeTemplateRadius( parameters.eyeAspectRatio * eye.initialRadiusY, imageSpacing[0], parameters );
+    //inital guess of minor axis
+    r2 = eyeTemplateRadius( eye.initialRadiusY, imageSpacing[1], parameters );
+    //width of the ellipse ring rf*r1, rf*r2
+    rf = parameters.eyeRingFactor;
+    eye.r1 = r1;
+    eye.r2 = r2;
+    eye.rf = rf;
+
+  }, {eyeA42} );
+  
+  //Compute horizontal distance to eye border
+  graph.Add( "Eye A 4.4.1-4.4.2 x", [&](){
+
+    ImageType::Pointer imageDistanceX;
+    eye.initialRadiusX = eyeSlabRadius( imageSlabX, eye.initialCenterIndex, 0, &imageDistanceX );
+
+    DebugDumps::Instance().Add( prefix, imageDistanceX, "-eye-xdistance.tif" );
+
+#ifdef DEBUG_PRINT
+    std::cout << "Eye initial radiusX: "<< eye.initialRadiusX << std::endl;
+#endif
+
+  }, {eyeA42} );
+
+  //--Step 5
+  //  Gaussian smoothing, threshold and rescale
+  graph.Add( "Eye A 5", [&](){
+
+    ITKFilterFunctions<ImageType>::SigmaArrayType sigma;
+    sigma[0] = parameters.eyeSigma * imageSpacing[0]; 
+    sigma[1] = parameters.eyeSigma * imageSpacing[1]; 
+    ITKPipeline<ImageType> smoothPipeline( imageA5 );
+    smoothPipeline.GaussSmooth( sigma ).ThresholdAbove( 70, 70 ).Rescale( 0, 100 );
+    imageSmooth = smoothPipeline.Update();
+
+    DebugDumps::Instance().Add( prefix, imageSmooth, "-eye-smooth.tif" );
+
+  }, {eyeA1} );
+  
+
+
+
+  ////
+  //B. Prepare fixed image 
+  ////
+
+  //-- Steps 1 through 2
+  //   1. Create ellipse ring image by subtract two ellipse with different 
+  //      radii. The radii are based on the intial radius estimation above.
+  //   2. Gaussian smoothing, threshold, rescale
+  //   With hypotheses steps B and C 1. only run if no hypothesis could be
+  //   registered, see below.
+  std::function<void()> eyeB = [&](){
+
+    ellipse = eyeRingTemplate( imageSpacing, imageSize, imageOrigin, eye.initialCenter, 
+                               eye.initialCenterIndex, r1, r2, rf, parameters );
+
+#ifdef DEBUG_PRINT
+    std::cout << "Origin, spacing, size ellipse image" << std::endl;
+    std::cout << ellipse->GetOrigin() << std::endl;
+    std::cout << ellipse->GetSpacing() << std::endl;
+    std::cout << ellipse->GetLargestPossibleRegion().GetSize() << std::endl;
+#endif
+
+  };
+
+
+  ////
+  //C. Affine registration
+  ////
+ 
+  //-- Step 1
+  //   Create a mask image that only measure mismatch in an ellipse region
+  //   macthing the create ellipse image, but not including left and right corners 
+  //   of the eye (they are often black but sometimes white)
+  std::function<void()> eyeC1 = [&](){
+
+    ellipseMask = eyeMaskTemplate( imageSpacing, imageSize, imageOrigin, eye.initialCenter, 
+                                   eye.initialCenterIndex, r1, r2, rf, parameters );
+
+  };
+
+  if( parameters.eyeHypothesisCenters == 0 ){
+    graph.Add( "Eye B", eyeB, {eyeA441Y} );
+    graph.Add( "Eye C1", eyeC1, {eyeA441Y} );
+  }
+
+  graph.Run();
+
+
+  //-- Multi hypothesis initialization, see FitParameters::eyeHypothesisCenters
+  //   The best of the coarsely registered hypotheses replaces the 
+  //   initialization of steps A 4.4 to C 1. and is refined from the coarse 
+  //   result on the remaining levels.
+  //   The hypotheses share the deadline with step C 2.
+  RegistrationDeadline deadline = fitDeadline( eye, parameters );
+  FitParameters eyeParameters = parameters;
+  AffineTransformType::ParametersType initialParameters;
+  bool hasInitialParameters = false;
+  if( parameters.eyeHypothesisCenters > 0 ){
+    TraceSpan spanHypotheses( "Eye hypotheses" );
+
+    //Views of it are read concurrently by the registrations
+    imageSmooth->DisconnectPipeline();
+    EyeHypothesis best = selectEyeHypothesis( image, imageDistance, imageSmooth, parameters,
+                                              parameters.deadline > 0 ? &deadline : NULL );
+    if( best.ring.IsNotNull() ){
+      if( best.centerIndex != eye.initialCenterIndex ){
+        eye.initialRadiusX = eyeSlabRadius( image, best.centerIndex, 0 );
+      }
+      eye.initialCenterIndex = best.centerIndex;
+      eye.initialCenter = best.center;
+      eye.initialRadius = best.radius;
+      eye.initialRadiusY = best.radiusY;
+      r1 = best.r1;
+      r2 = best.r2;
+      eye.r1 = r1;
+      eye.r2 = r2;
+      ellipse = best.ring;
+      ellipseMask = best.mask;
+
+      initialParameters = best.parameters;
+      hasInitialParameters = true;
+      if( eyeParameters.eyeShrinkFactors.size() > 1 ){
+        eyeParameters.eyeShrinkFactors.erase( eyeParameters.eyeShrinkFactors.begin() );
+      }
+      if( eyeParameters.eyeSmoothingSigmas.size() > 1 ){
+        eyeParameters.eyeSmoothingSigmas.erase( eyeParameters.eyeSmoothingSigmas.begin() );
+      }
+    }
+    else{
+      //No hypothesis registered before the deadline, steps B and C 1. for
+      //the initial center and radii
+      TraceSpan spanEyeB( "Eye B" );
+      eyeB();
+      spanEyeB.Stop();
+      TraceSpan spanEyeC1( "Eye C1" );
+      eyeC1();
+    }
+
+#ifdef DEBUG_PRINT
+    std::cout << "Eye hypothesis center: " << eye.initialCenterIndex << std::endl;
+    std::cout << "Eye hypothesis radii: " << r1 << ", " << r2 << std::endl;
+#endif
+  }
+
+
+  TraceSpan spanEyeC2( "Eye C2" );
+
+  //-- Step 2
+  //   Affine registration centered on the fixed ellipse image
+
+  DebugDumps::Instance().Add( prefix, ellipse, "-eye-moving.tif" );
+  DebugDumps::Instance().Add( prefix, ellipseMask, "-eye-mask.tif" );
+
+  AffineTransformType::Pointer transform = registerEye( ellipse, imageSmooth, ellipseMask, 
+                                                        eye.initialCenter, eyeParameters,
+                                                        &eye.registration,
+                                                        parameters.deadline > 0 ? &deadline : NULL,
+                                                        hasInitialParameters ? &initialParameters : NULL );
+  eye.level = deadline.Level();
+
+  spanEyeC2.Stop();
+
+
+
+
+  TraceSpan spanEyeC3( "Eye C3" );
+ 
+
+  //Keep the fitted transform, images are created on demand from it
+  eye.transformParameters = transform->GetParameters();
+
+  if( DebugDumps::Instance().IsCapturing( prefix ) ){
+    ImageType::Pointer moved = rasterizeEye( eye, inputImage );
+    DebugDumps::Instance().Add( prefix, moved, "-eye-registred.tif", false );
+
+    OverlayRenderer<ImageType>::EllipseRing eyeRing = overlayRing( eye );
+    DebugDumps::Instance().Add( prefix, OverlayRenderer<ImageType>::Render( inputImage, &eyeRing, NULL, 0.5 ), 
+                                "-eye-overlay.png", false );
+  }
+
+
+  
+  //-- Step 3
+  //   Compute minor and major axis by pushing the radii from the created ellipse
+  //   image through the computed transform. If the deadline was reached 
+  //   before the first iteration these are the initial ellipse estimates.
+
+  AffineTransformType::InputPointType tCenter;
+  tCenter[0] = eye.initialCenter[0];
+  tCenter[1] = eye.initialCenter[1];
+  
+  AffineTransformType::InputVectorType tX;
+  tX[0] = r1;
+  tX[1] = 0;
+
+  AffineTransformType::InputVectorType tY;
+  tY[0] = 0;
+  tY[1] = r2;
+  
+  eye.center = transform->TransformPoint(tCenter);
+  image->TransformPhysicalPointToIndex(eye.center, eye.centerIndex);
+
+  AffineTransformType::OutputVectorType tXO = transform->TransformVector(tX, tCenter);
+  AffineTransformType::OutputVectorType tYO = transform->TransformVector(tY, tCenter);
+
+  eye.minor =  sqrt(tXO[0]*tXO[0] + tXO[1]*tXO[1]); 
+  eye.major =  sqrt(tYO[0]*tYO[0] + tYO[1]*tYO[1]); 
+
+  if(eye.major < eye.minor){
+    std::swap(eye.minor, eye.major);
+  }
+
+#ifdef DEBUG_PRINT
+  std::cout << "Eye center: " << eye.centerIndex << std::endl;
+  std::cout << "Eye minor: "  << eye.minor << std::endl;
+  std::cout << "Eye major: "  << eye.major << std::endl;
+
+  std::cout << "--- Done Fitting Eye ---" << std::endl << std::endl;
+#endif
+
+  spanEyeC3.Stop();
+
+  return eye;
+};
+
+
+
+
+
+
+
+
+//Steps B 1., 2. and C 1. of the stem estimation through TemplateCache if
+//FitParameters::templateCache is set. The templates are anchored at the
+//initial center column and keyed by the bar columns relative to it.
+std::string stemTemplateKey( ImageType::RegionType region, ImageType::SpacingType spacing,
+                             int centerColumn, int yStart, int xStart1, int xEnd1, 
+                             int xStart2, int xEnd2, double sigma ){
+  std::stringstream key;
+  key << std::setprecision(17) << region.GetSize() << spacing << " " << yStart << " " 
+      << xStart1 - centerColumn << " " << xEnd1 - centerColumn << " " 
+      << xStart2 - centerColumn << " " << xEnd2 - centerColumn << " " << sigma;
+  return key.str();
+};
+
+
+//Cached stem templates are built with the center in the middle column of
+//the region, see TemplateCache.h
+ImageType::IndexType stemTemplateBuildAnchor( ImageType::RegionType region ){
+  ImageType::IndexType anchor;
+  anchor[0] = region.GetSize()[0] / 2;
+  anchor[1] = 0;
+  return anchor;
+};
+
+
+//Whether the columns [xStart, xEnd) relative to the center lie inside the
+//region with margin when the center is at anchor
+bool stemTemplateInside( ImageType::RegionType region, int xStart, int xEnd,
+                         ImageType::IndexType anchor, int margin ){
+  return anchor[0] + xStart - margin >= 0 && 
+         anchor[0] + xEnd + margin <= (int) region.GetSize()[0];
+};
+
+
+//Registration mask covering the bars and the gap between them
+UnsignedCharImageType::Pointer stemMaskTemplate( ImageType::RegionType region,
+                                                 ImageType::SpacingType spacing, 
+                                                 ImageType::PointType origin,
+                                                 int centerColumn, int yStart, 
+                                                 int xStart, int xEnd, 
+                                                 const FitParameters &parameters ){
+  std::function<UnsignedCharImageType::Pointer(const ImageType::IndexType &)> build = 
+    [&](const ImageType::IndexType &anchor){
+    int shift = anchor[0] - centerColumn;
+    UnsignedCharImageType::Pointer mask = UnsignedCharImageType::New();
+    mask->SetRegions(region);
+    mask->Allocate();
+    mask->FillBuffer( itk::NumericTraits< unsigned char >::Zero);
+    mask->SetSpacing(spacing);
+    mask->SetOrigin(origin);
+
+    ImageType::SizeType size = region.GetSize();
+    for(int i=yStart; i<size[1]; i++){
+       ImageType::IndexType index;
+       index[1] = i;
+       for(int j=xStart+shift; j<xEnd+shift; j++){
+         index[0]=j;
+         mask->SetPixel(index, 255);
+       }
+    }
+    return mask;
+  };
+  ImageType::IndexType anchor;
+  anchor[0] = centerColumn;
+  anchor[1] = 0;
+  if( !parameters.templateCache ){
+    return build( anchor );
+  }
+
+  //The mask has no smoothing and always lies inside the region at the 
+  //center, it only has to lie inside at the build anchor as well
+  ImageType::IndexType buildAnchor = stemTemplateBuildAnchor( region );
+  bool cacheable = stemTemplateInside( region, xStart - centerColumn, xEnd - centerColumn, 
+                                       buildAnchor, 0 );
+  TemplateCache &cache = TemplateCache::Instance();
+  cache.SetCapacity( parameters.templateCacheSize );
+  return cache.Get<UnsignedCharImageType>( TemplateCache::STEM_MASK, 
+                                           stemTemplateKey( region, spacing, centerColumn, yStart,
+                                                            xStart, xStart, xEnd, xEnd, 0 ),
+                                           anchor, buildAnchor, origin, cacheable, build );
+};
+
+
+//Bars image smoothed with FitParameters::stemRegistrationSigma
+ImageType::Pointer stemBarsTemplate( ImageType::RegionType region,
+                                     ImageType::SpacingType spacing, 
+                                     ImageType::PointType origin,
+                                     int centerColumn, int yStart, int xStart1, int xEnd1, 
+                                     int xStart2, int xEnd2, const FitParameters &parameters ){
+  std::function<ImageType::Pointer(const ImageType::IndexType &)> build = 
+    [&](const ImageType::IndexType &anchor){
+    int shift = anchor[0] - centerColumn;
+    ImageType::Pointer bars = CreateBarsImage( region, spacing, origin, yStart, 
+                                               xStart1 + shift, xEnd1 + shift, 
+                                               xStart2 + shift, xEnd2 + shift );
+    ITKFilterFunctions<ImageType>::SigmaArrayType sigma;
+    sigma[0] = parameters.stemRegistrationSigma * spacing[0]; 
+    sigma[1] = parameters.stemRegistrationSigma * spacing[1]; 
+    return ITKFilterFunctions<ImageType>::GaussSmooth(bars, sigma);
+  };
+  ImageType::IndexType anchor;
+  anchor[0] = centerColumn;
+  anchor[1] = 0;
+  if( !parameters.templateCache ){
+    return build( anchor );
+  }
+
+  //Bars within 3 sigma of the left or right border are smoothed 
+  //differently when translated
+  int margin = std::ceil( 3 * parameters.stemRegistrationSigma );
+  ImageType::IndexType buildAnchor = stemTemplateBuildAnchor( region );
+  bool cacheable = stemTemplateInside( region, xStart1 - centerColumn, xEnd2 - centerColumn, 
+                                       anchor, margin ) &&
+                   stemTemplateInside( region, xStart1 - centerColumn, xEnd2 - centerColumn, 
+                                       buildAnchor, margin );
+  TemplateCache &cache = TemplateCache::Instance();
+  cache.SetCapacity( parameters.templateCacheSize );
+  return cache.Get<ImageType>( TemplateCache::STEM_BARS, 
+                               stemTemplateKey( region, spacing, centerColumn, yStart, xStart1, 
+                                                xEnd1, xStart2, xEnd2, 
+                                                parameters.stemRegistrationSigma ),
+                               anchor, buildAnchor, origin, cacheable, build );
+};
+
+
+
+//Fit two bars to an ultrasound image based on eye location and size
+// A) Prepare moving Image
+// B) Prepare fixed image
+// C) Similarity registration
+//
+//For a detailed descritpion and overview of the whole pipleine
+//see EyeAndStemFitting.h
+
+StemRegion extractStemRegion(ImageType::Pointer inputImage, const Eye &eye, 
+                             const std::string &prefix, const FitParameters &parameters){
+
+  StemRegion region;
+  if( eye.status != FIT_OK ){
+    region.status = eye.status;
+    return region;
+  }
+
+
+  ////
+  //A) Prepare moving image
+  ////
+
+  //-- Step 1
+  //   Extract optic nerve region below the eye using the eye location and 
+  //   size estimates.
+  TraceSpan spanStemA1( "Stem A 1" );
+
+  ImageType::SpacingType imageSpacing = inputImage->GetSpacing();
+  ImageType::RegionType imageRegion = inputImage->GetLargestPossibleRegion();
+  ImageType::SizeType imageSize = imageRegion.GetSize();
+  ImageType::PointType imageOrigin = inputImage->GetOrigin();
+
+
+  ImageType::IndexType desiredStart;
+  desiredStart[0] = eye.center[0] - 1 * eye.major;
+  desiredStart[1] = eye.center[1] + 1 * eye.minor ;
+ 
+  ImageType::SizeType desiredSize;
+  desiredSize[0] = 2 * eye.major;
+  desiredSize[1] = 1.2 * eye.minor;
+
+  if(desiredStart[1] > imageSize[1] ){
+#ifdef DEBUG_PRINT
+    std::cout << "Could not locate stem area" << std::endl;
+#endif
+    region.status = FIT_NO_STEM_AREA;
+    return region;
+  }
+  if(desiredStart[1] + desiredSize[1] > imageSize[1] ){
+    desiredSize[1] = imageSize[1] - desiredStart[1];
+  }
+
+  if(desiredStart[0] < 0 ){
+    desiredStart[0] = 0;
+  }
+  if(desiredStart[0] + desiredSize[0] > imageSize[0] ){
+    desiredSize[0] = imageSize[0] - desiredStart[0];
+  }
+
+ 
+  region.region = ImageType::RegionType(desiredStart, desiredSize);
+
+  spanStemA1.Stop();
+
+  //-- Step 2 through 3
+  //   2. Gaussian smoothing
+  //   3. Rescale individual rows to 0 100
+  //   Extraction and smoothing are executed together, only the region of
+  //   interest is pulled from the input image
+  TraceSpan spanStemA2( "Stem A 2-3" );
+
+  ITKFilterFunctions<ImageType>::SigmaArrayType sigma;
+  sigma[0] = parameters.stemSigmaX * inputImage->GetSpacing()[0]; 
+  sigma[1] = parameters.stemSigmaY * inputImage->GetSpacing()[1]; 
+  //sigma[1] = stemSize[1]/12.0 * stemSpacing[1]; 
+
+  ITKPipeline<ImageType> stemPipeline( inputImage );
+  stemPipeline.Extract( region.region );
+  ImageType::Pointer stemImageOrig = stemPipeline.GetOutput();
+  stemPipeline.GaussSmooth( sigma );
+  ImageType::Pointer stemImage = stemPipeline.Update();
+
+#ifdef DEBUG_PRINT
+  std::cout << "Origin, spacing, size and index of stem image" << std::endl;
+  std::cout << stemImageOrig->GetOrigin() << std::endl;
+  std::cout << stemImageOrig->GetSpacing() << std::endl;
+  std::cout << stemImageOrig->GetLargestPossibleRegion().GetSize() << std::endl;
+  std::cout << stemImageOrig->GetLargestPossibleRegion().GetIndex() << std::endl;
+#endif
+
+
+  DebugDumps::Instance().Add( prefix, stemImageOrig, "-stem.tif" );
+
+
+
+  //Rescale indiviudal rows 
+  ITKFilterFunctions<ImageType>::RescaleRows(stemImage);
+
+
+  stemImage = ITKFilterFunctions<ImageType>::RescaleInPlace(stemImage, 0, 100);
+
+  
+  DebugDumps::Instance().Add( prefix, stemImage, "-stem-smooth.tif" );
+
+  spanStemA2.Stop();
+
+  region.original = stemImageOrig;
+  region.smoothed = stemImage;
+  return region;
+};
+
+
+
+Stem fitStem(ImageType::Pointer inputImage, Eye &eye, const StemRegion &region,
+             const std::string &prefix, const FitParameters &parameters){
+
+  Stem stem;
+  if( region.status != FIT_OK ){
+    stem.status = region.status;
+    return stem;
+  }
+  stem.originalImageRegion = region.region;
+
+  //Steps 4 and 5 work in place
+  ImageType::Pointer stemImage = region.smoothed;
+  if( region.shared ){
+    stemImage = ITKFilterFunctions<ImageType>::Duplicate( region.smoothed );
+  }
+
+  ImageType::RegionType stemRegion = region.original->GetLargestPossibleRegion();
+  ImageType::SizeType stemSize = stemRegion.GetSize();
+  ImageType::PointType stemOrigin = region.original->GetOrigin();
+  ImageType::SpacingType stemSpacing = region.original->GetSpacing();
+
+
+  //-- Step 3.1 through 3.6 
+  //   3.1 Binary threshold
+  //   3.2 Morphological opening
+  //   3.3 Add vertical border
+  //   3.4 Add small horizontal border
+  //   3.5 Distance transform
+  //   3.6 Calcuate inital optic nerve width and center   
+  TraceSpan spanStemA31( "Stem A 3.1-3.6" );
+  
+  StructuringElementType structuringElement;
+  structuringElement.SetRadius( parameters.stemOpeningRadius );
+  structuringElement.CreateStructuringElement();
+  OpeningFilter::Pointer openingFilter = OpeningFilter::New();
+  openingFilter->SetKernel(structuringElement);
+  openingFilter->SetForegroundValue(100.0);
+
+  ITKPipeline<ImageType> stemOpeningPipeline( stemImage );
+  stemOpeningPipeline.BinaryThreshold( -1, parameters.stemThreshold, 0, 100 );
+  //Referencing the intermediate output keeps it from being overwritten in
+  //place, only done for dumps
+  ImageType::Pointer stemImageThreshold;
+  if( DebugDumps::Instance().IsCapturing( prefix ) ){
+    stemImageThreshold = stemOpeningPipeline.GetOutput();
+  }
+  stemOpeningPipeline.Apply( openingFilter );
+  ImageType::Pointer stemImageB = stemOpeningPipeline.Update();
+
+  if( stemImageThreshold ){
+    DebugDumps::Instance().Add( prefix, stemImageThreshold, "-stem-sd-thres.tif" );
+  }
+ 
+  DebugDumps::Instance().Add( prefix, stemImageB, "-stem-morpho.tif" );
+
+  CastFilter::Pointer stemCastFilter = CastFilter::New();
+  stemCastFilter->SetInput( stemImageB );
+  stemCastFilter->Update();
+  UnsignedCharImageType::Pointer stemImage2 = stemCastFilter->GetOutput();
+
+  ITKFilterFunctions<UnsignedCharImageType>::AddVerticalBorder(stemImage2, 20);
+  ITKFilterFunctions<UnsignedCharImageType>::AddHorizontalBorder(stemImage2, 2);
+
+  SignedDistanceFilter::Pointer stemDistanceFilter = SignedDistanceFilter::New();
+  stemDistanceFilter->SetInput( stemImage2 );
+  stemDistanceFilter->SetInsideValue(100);
+  stemDistanceFilter->SetOutsideValue(0);
+  stemDistanceFilter->Update();
+  ImageType::Pointer stemDistance = stemDistanceFilter->GetOutput();
+
+  DebugDumps::Instance().Add( prefix, stemDistance, "-stem-distance.tif" );
+ 
+  //Compute max of distance transfrom 
+  ImageCalculatorFilterType::Pointer stemCalculatorFilter  = ImageCalculatorFilterType::New ();
+  stemCalculatorFilter->SetImage( stemDistance );
+  stemCalculatorFilter->Compute();
+  
+  stem.initialWidth = stemCalculatorFilter->GetMaximum() ;
+  stem.initialCenterIndex = stemCalculatorFilter->GetIndexOfMaximum();
+  stemImage->TransformIndexToPhysicalPoint(stem.initialCenterIndex, stem.initialCenter);
+
+#ifdef DEBUG_PRINT
+  std::cout << "Approximate width of stem: " <<  2 * stem.initialWidth << std::endl;
+  std::cout << "Approximate stem center: " << stem.initialCenter << std::endl;
+  std::cout << "Approximate stem center Index: " << stem.initialCenterIndex << std::endl;
+#endif
+
+  spanStemA31.Stop();
+
+  //-- Step 4 
+  //   Rescale rows left and right of the approximate center to 0 - 100
+  TraceSpan spanStemA4( "Stem A 4" );
+
+  float centerIntensity = stemImage->GetPixel( stem.initialCenterIndex );
+#ifdef DEBUG_PRINT
+  std::cout << "Approximate stem center intensity: " << centerIntensity << std::endl;
+#endif
+  for(int i=0; i<stemSize[1]; i++){
+    ImageType::IndexType index;
+    index[1] = i;
+    float maxIntensityLeft = 0;
+    for(int j=0; j<stem.initialCenterIndex[0]; j++){
+      index[0] = j;
+      maxIntensityLeft = std::max( stemImage->GetPixel(index), maxIntensityLeft );
+    }
+    for(int j=0; j<stem.initialCenterIndex[0]; j++){
+      index[0] = j;
+      float value = 0;
+      if(maxIntensityLeft > centerIntensity ){
+        value = ( stemImage->GetPixel(index) - centerIntensity ) / 
+		    ( maxIntensityLeft - centerIntensity )  ;
+        value = std::max(0.f, value)*100;
+        value = std::min(100.f, value);
+      }
+      stemImage->SetPixel(index, value );
+    }
+    
+    float maxIntensityRight = 0;
+    for(int j=stem.initialCenterIndex[0]; j<stemSize[0]; j++){
+      index[0] = j;
+      maxIntensityRight = std::max( stemImage->GetPixel(index), maxIntensityRight );
+    }
+    for(int j=stem.initialCenterIndex[0]; j<stemSize[0]; j++){
+      index[0] = j;
+      float value = 0;
+      if(maxIntensityRight > centerIntensity ){
+        value = ( stemImage->GetPixel(index) - centerIntensity ) / 
+		    ( maxIntensityRight - centerIntensity ) ;
+        value = std::max(0.f, value) * 100;
+        value = std::min(100.f, value);
+      }
+      stemImage->SetPixel(index, value  );
+    }
+    
+
+  }
+
+  //Thresholded in place by step 5
+  DebugDumps::Instance().Add( prefix, stemImage, "-stem-scaled.tif", true );
+
+  spanStemA4.Stop();
+
+
+  //-- Step 5 
+  //   Binary threshold
+  TraceSpan spanStemA5( "Stem A 5" );
+
+  float tb = parameters.stemRefineThreshold;
+  stemImage =   ITKFilterFunctions<ImageType>::BinaryThresholdInPlace(stemImage, -1, tb, 0, 100);
+  
+#ifdef DEBUG_PRINT
+  std::cout << "Stem threshold: " << tb << std::endl;
+#endif
+
+  spanStemA5.Stop();
+
+/*  
+  StructuringElementType structuringElement2;
+  structuringElement2.SetRadius( 10 );
+  structuringElement2.CreateStructuringElement();
+  OpeningFilter::Pointer openingFilter2 = OpeningFilter::New();
+  openingFilter2->SetInput(stemImage);
+  openingFilter2->SetKernel(structuringElement2);
+  openingFilter2->SetForegroundValue(100.0);
+  openingFilter2->Update();
+  stemImage = openingFilter2->GetOutput();
+*/
+ 
+
+
+
+  //-- Step 5.1 through 5.4
+  //  5.1 Add vertica border
+  //  5.2 Add horizontal border
+  //  5.3 Distance transform
+  //  5.4 Refine intial estimates
+  TraceSpan spanStemA51( "Stem A 5.1-5.4" );
+
+  CastFilter::Pointer stemCastFilter2 = CastFilter::New();
+  stemCastFilter2->SetInput( stemImage );
+  stemCastFilter2->Update();
+  UnsignedCharImageType::Pointer stemImage3 = stemCastFilter2->GetOutput();
+
+  ITKFilterFunctions<UnsignedCharImageType>::AddVerticalBorder(stemImage3, 20);
+  ITKFilterFunctions<UnsignedCharImageType>::AddHorizontalBorder(stemImage3, 2);
+  
+  SignedDistanceFilter::Pointer stemDistanceFilter2 = SignedDistanceFilter::New();
+  stemDistanceFilter2->SetInput( stemImage3 );
+  stemDistanceFilter2->SetInsideValue(100);
+  stemDistanceFilter2->SetOutsideValue(0);
+  stemDistanceFilter2->Update();
+  ImageType::Pointer stemDistance2 = stemDistanceFilter2->GetOutput();
+
+
+  
+  DebugDumps::Instance().Add( prefix, stemDistance, "-stem-scaled-distance.tif" );
+ 
+  //Compute max of distance transfrom 
+  ImageCalculatorFilterType::Pointer stemCalculatorFilter2  = ImageCalculatorFilterType::New ();
+  stemCalculatorFilter2->SetImage( stemDistance2 );
+  stemCalculatorFilter2->Compute();
+
+  stem.initialWidth = stemCalculatorFilter2->GetMaximum() ;
+  stem.initialCenterIndex = stemCalculatorFilter2->GetIndexOfMaximum();
+  stemImage->TransformIndexToPhysicalPoint(stem.initialCenterIndex, stem.initialCenter);
+
+#ifdef DEBUG_PRINT
+  std::cout << "Refined approximate width of stem: " <<  2 * stem.initialWidth << std::endl;
+  std::cout << "Refined approximate stem center: " << stem.initialCenter << std::endl;
+  std::cout << "Refined approximate stem center Index: " << stem.initialCenterIndex << std::endl;
+#endif
+
+  spanStemA51.Stop();
+
+
+
+
+
+
+
+
+  //-- Step 6
+  //   Add a bit of smoothing for the registration process
+  TraceSpan spanStemA6( "Stem A 6" );
+  ITKFilterFunctions<ImageType>::SigmaArrayType sigma;
+  sigma[0] = parameters.stemRegistrationSigma * stemSpacing[0]; 
+  sigma[1] = parameters.stemRegistrationSigma * stemSpacing[1]; 
+  stemImage = ITKFilterFunctions<ImageType>::GaussSmooth(stemImage, sigma);
+  
+
+  DebugDumps::Instance().Add( prefix, stemImage, "-stem-thres.tif" );
+
+  spanStemA6.Stop();
+
+
+  /////
+  //B. Prepare fixed image.
+  //  Create artifical stem image to fit to region of interest.
+  /////
+  
+  TraceSpan spanStemB( "Stem B" );
+
+  //--Step 1 and C) 1
+  //  Create a black and white image with two bars that
+  //  are an intial estimate of the width apart. 
+  //  Create registration mask image.
+
+
+  int stemYStart   = eye.initialRadiusY * 0.05;
+  int stemXStart1  = stem.initialCenterIndex[0] - 1.5 * stem.initialWidth / stemSpacing[0];
+  int stemXEnd1    = stem.initialCenterIndex[0] - 1 * stem.initialWidth / stemSpacing[0];
+  int stemXStart2  = stem.initialCenterIndex[0] + 1 * stem.initialWidth / stemSpacing[0];
+  int stemXEnd2    = stem.initialCenterIndex[0] + 1.5 * stem.initialWidth / stemSpacing[0];
+
+
+  if(stemXStart1 < 0){
+    stemXStart1 = 0;
+  }
+  if( stemXEnd2 >= stemSize[0] ){
+    stemXEnd2 = stemSize[0];
+  }
+  if(stemXEnd2 < stemXStart2){ 
+#ifdef DEBUG_PRINT
+    std::cout << "Failed to locate stem" << std::endl;
+#endif
+    stem.status = FIT_NO_STEM;
+    return stem;
+  }
+
+  stem.barsYStart = stemYStart;
+  stem.barsXStart1 = stemXStart1;
+  stem.barsXEnd1 = stemXEnd1;
+  stem.barsXStart2 = stemXStart2;
+  stem.barsXEnd2 = stemXEnd2;
+
+  UnsignedCharImageType::Pointer movingMask = stemMaskTemplate( stemRegion, stemSpacing, stemOrigin, 
+                                                                stem.initialCenterIndex[0], stemYStart,
+                                                                stemXStart1, stemXEnd2, parameters );
+
+  DebugDumps::Instance().Add( prefix, movingMask, "-stem-mask.tif" );
+
+
+  //-- Step 2
+  //   Gauss smoothing
+
+  ImageType::Pointer moving = stemBarsTemplate( stemRegion, stemSpacing, stemOrigin, 
+                                                stem.initialCenterIndex[0], stemYStart, 
+                                                stemXStart1, stemXEnd1, stemXStart2, stemXEnd2,
+                                                parameters );
+  
+  DebugDumps::Instance().Add( prefix, moving, "-stem-moving.tif" );
+
+  spanStemB.Stop();
+
+  ////
+  //C. Registration of artifical stem image to threhsold stem image
+  ////
+  
+  TraceSpan spanStemC1( "Stem C1" );
+
+  //-- Step 2 (Step 1 was inclued in B)
+  //   Similarity transfrom registration centered on the fixed bars image
+
+
+  
+  //If the deadline was reached before the first iteration the transform 
+  //is the identity and the width the initial estimate of step A 5.
+  //Most iterations run on the coarse levels of the automatic schedule, 
+  //the registration starts each level from the result of the previous one
+  FitParameters stemParameters = parameters;
+  if( parameters.stemAutoLevels ){
+    stemLevelSchedule( stemSize, stemSpacing, stem.initialWidth, parameters,
+                       stemParameters.stemShrinkFactors, stemParameters.stemSmoothingSigmas );
+  }
+
+  RegistrationDeadline deadline = fitDeadline( eye, parameters );
+  SimilarityTransformType::Pointer transform = registerStem( moving, stemImage, movingMask, 
+                                                            stem.initialCenter, stemParameters,
+                                                            &stem.registration,
+                                                            parameters.deadline > 0 ? &deadline : NULL );
+  stem.level = deadline.Level();
+
+  spanStemC1.Stop();
+
+  TraceSpan spanStemC2( "Stem C2" );
+
+  //Keep the fitted transform, images are created on demand from it
+  stem.transformParameters = transform->GetParameters();
+
+  if( DebugDumps::Instance().IsCapturing( prefix ) ){
+    ImageType::Pointer moved = rasterizeStem( stem, inputImage );
+    DebugDumps::Instance().Add( prefix, moved, "-stem-registered.tif", false );
+
+    OverlayRenderer<ImageType>::Bars stemBars = overlayBars( stem, inputImage );
+    DebugDumps::Instance().Add( prefix, OverlayRenderer<ImageType>::Render( inputImage, NULL, &stemBars ), 
+                                "-stem-overlay.png", false );
+  }
+
+
+
+  //-- Step 3
+  //   Compute stem width by pushing intital width through the transform
+
+  SimilarityTransformType::InputPointType tCenter;
+  tCenter[0] = stem.initialCenter[0];
+  tCenter[1] = stem.initialCenter[1];
+  
+  SimilarityTransformType::InputVectorType tX;
+  tX[0] = stem.initialWidth;
+  tX[1] = 0;
+
+  stem.center = transform->TransformPoint(tCenter);
+  stemImage->TransformPhysicalPointToIndex(stem.center, stem.centerIndex);
+
+  SimilarityTransformType::OutputVectorType tXO = transform->TransformVector(tX, tCenter);
+
+  stem.width =  sqrt(tXO[0]*tXO[0] + tXO[1]*tXO[1]); 
+
+#ifdef DEBUG_PRINT
+  std::cout << "Stem center: " << stem.centerIndex << std::endl;
+  std::cout << "Stem width: "  << stem.width*2 << std::endl;
+
+  std::cout << "--- Done fitting stem ---" << std::endl << std::endl;
+#endif
+
+  spanStemC2.Stop();
+
+  return stem;
+};
+
+
+
+Stem fitStem(ImageType::Pointer inputImage, Eye &eye, const std::string &prefix,
+             const FitParameters &parameters){
+  
+#ifdef DEBUG_PRINT
+  std::cout << "--- Fit stem ---" << std::endl << std::endl;
+#endif
+
+  TraceSpan spanStem( "Stem" );
+
+  StemRegion region = extractStemRegion( inputImage, eye, prefix, parameters );
+  return fitStem( inputImage, eye, region, prefix, parameters );
+};
@@ -0,0 +1,560 @@
+#ifndef EYEANDSTEMFITTING_H
+#define EYEANDSTEMFITTING_H
+
+
+//Estimation of the width of the optic nerve from a B-mode ultrasound 
+//image. Used by EstimateEyeAndStem and the benchmark and tool executables.
+//
+//The inut image is expected to be oriented such that the optic nerve 
+//is towards the bottom of the image and depth is along the y-Axis.
+//
+//The computation involves two main steps:
+// 1. Estimation of the eye orb location and minor and major axis length
+// 2. Estimation of the optic nerve width
+//Both steps include several substeps which results in many parameters 
+//that can be tuned if needed.
+//
+//EYE ESTIMATION:
+//---------------
+//(sub-steps indicate that a new image was created and the pipeline will use 
+//the image from the last step at the same granularity)
+// 
+// A) Prepare moving Image:
+//  1. Rescale the image to 0, 100
+//  2. Adding a horizontal border
+//  3. Gaussian smoothing
+//  4. Binary Thresholding
+//  4.1 Morphological closing
+//  4.2 Adding a vertical border
+//  4.3 Distance transfrom
+//  4.4 Calculate inital center and radius from distance transform (Max)
+//  4.4.1 Distance transform in X and Y seperately on region of interest 
+//   	  around slabs of the center
+//  4.4.2 Calculate inital x and y radius from those distamnce transforms
+//  5. Gaussian smoothing, threshold and rescale
+// 
+// B) Prepare fixed image
+//  1. Create ellipse ring image by subtract two ellipse with different 
+//     radii. The radii are based on the intial radius estimation above.
+//  2. Gaussian smoothing, threshold, rescale
+//
+// C) Affine registration
+//  1. Create a mask image that only measure mismatch in an ellipse region
+//     macthing the create ellipse image, but not including left and right corners 
+//     of the eye (they are often black but sometimes white)
+//  2. Affine registration centered on the fixed ellipse image
+//  3. Compute minor and major axis by pushing the radii from the created ellipse
+//     image through the computed transform
+// 
+//OPTIC NERVE ESTIMATION:
+//-----------------------
+//(sub-steps indicate that a new image was created and the pipeline will use 
+//the image from the last step at the same granularity)
+// 
+// A) Prepare moving image
+//  1. Extract optic nerve region below the eye using the eye location and 
+//     size estimates
+//  2. Gaussian smoothing
+//  3. Rescale individual rows to 0 100
+//  3.1 Binary threshold
+//  3.2 Morphological opening
+//  3.3 Add vertical border
+//  3.4 Add small horizontal border
+//  3.5 Distance transform
+//  3.6 Calcuate inital optic nerve width and center
+//  4. Scale rows 0, 100 on each side of the optice nerve center independently
+//  5. Binary threhsold
+//  5.1 Add vertica border
+//  5.2 Add horizontal border
+//  5.3 Distance transform
+//  5.4 Refine intial estimates
+//  6. Gaussian smoothing
+//
+// B) Prepare fixed image
+//  1. Create a black and white image with two bars that
+//     are an intial estimate of the width apart
+//  2. Gauss smoothing
+//
+// C) Similarity transfrom registration
+//  1. Create a mask that includes the two bars only
+//  2. Similarity transfrom registration centered on the fixed bars image
+//  3. Compute stem width by pushing intital width through the transform
+//
+
+
+
+
+#include "itkImage.h"
+#include "itkImageRegistrationMethodv4.h"
+#include "itkLinearInterpolateImageFunction.h"
+#include "itkMeanSquaresImageToImageMetricv4.h"
+#include "itkLBFGSOptimizerv4.h"
+#include "itkResampleImageFilter.h"
+#include "itkApproximateSignedDistanceMapImageFilter.h"
+#include "itkCastImageFilter.h"
+#include <itkImageMaskSpatialObject.h>
+#include <itkBinaryMorphologicalClosingImageFilter.h>
+#include <itkBinaryMorphologicalOpeningImageFilter.h>
+#include <itkGrayscaleMorphologicalOpeningImageFilter.h>
+#include "itkBinaryBallStructuringElement.h"
+#include "itkMinimumMaximumImageCalculator.h"
+#include "itkRGBPixel.h"
+#include "itkRegionOfInterestImageFilter.h"
+#include <itkSimilarity2DTransform.h>
+
+#include "itkImageMaskSpatialObject.h"
+#include "itkEllipseSpatialObject.h"
+#include "itkSpatialObjectToImageFilter.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <ostream>
+#include <chrono>
+
+#include "ITKFilterFunctions.h"
+#include "ITKPipeline.h"
+#include "OverlayRenderer.h"
+#include "RegistrationTelemetry.h"
+#include "itkImageRegionIterator.h"
+
+typedef  float  PixelType;
+typedef itk::Image< PixelType, 2 >  ImageType;
+typedef itk::Image<unsigned char, 2>  UnsignedCharImageType;
+
+typedef itk::CastImageFilter< ImageType, UnsignedCharImageType > CastFilter;
+typedef itk::ApproximateSignedDistanceMapImageFilter< UnsignedCharImageType, ImageType  > SignedDistanceFilter;
+ 
+typedef itk::BinaryBallStructuringElement<ImageType::PixelType, ImageType::ImageDimension> StructuringElementType;
+typedef itk::BinaryMorphologicalClosingImageFilter<ImageType, ImageType, StructuringElementType> ClosingFilter;
+typedef itk::BinaryMorphologicalOpeningImageFilter<ImageType, ImageType, StructuringElementType> OpeningFilter;
+typedef itk::GrayscaleMorphologicalOpeningImageFilter<ImageType, ImageType, StructuringElementType> GrayOpeningFilter;
+
+typedef itk::MinimumMaximumImageCalculator <ImageType> ImageCalculatorFilterType;
+
+//typedef itk::ExtractImageFilter< ImageType, ImageType > ExtractFilter;
+typedef itk::RegionOfInterestImageFilter< ImageType, ImageType > ExtractFilter;
+typedef itk::RegionOfInterestImageFilter< UnsignedCharImageType, UnsignedCharImageType > ExtractFilter2;
+
+
+//Overlay
+typedef itk::RGBPixel<unsigned char> RGBPixelType;
+typedef itk::Image<RGBPixelType> RGBImageType;
+
+
+//registration
+//typedef itk::GradientDescentOptimizer       OptimizerType;
+//typedef itk::ConjugateGradientOptimizer       OptimizerType;
+typedef itk::LBFGSOptimizerv4       OptimizerType;
+
+typedef itk::MeanSquaresImageToImageMetricv4< ImageType, ImageType >  MetricType;
+typedef itk::LinearInterpolateImageFunction< ImageType, double >    InterpolatorType;
+typedef itk::ImageRegistrationMethodv4< ImageType, ImageType >    RegistrationType;
+
+typedef itk::Similarity2DTransform< double >     SimilarityTransformType;
+typedef itk::AffineTransform< double, 2 >     AffineTransformType;
+
+typedef itk::ResampleImageFilter< ImageType, ImageType >    ResampleFilterType;
+
+//Mask image spatical object 
+typedef itk::ImageMaskSpatialObject< 2 >   MaskType;
+
+//Elipse object  
+typedef itk::EllipseSpatialObject< 2 >   EllipseType;
+typedef itk::SpatialObjectToImageFilter< EllipseType, ImageType >   SpatialObjectToImageFilterType;
+typedef EllipseType::TransformType EllipseTransformType;
+
+
+
+
+
+
+//Tunable parameters of the fitting. The defaults are the reference 
+//configuration, faster or experimental modes are selected by changing 
+//them. Lengths are in pixels and scaled by the image spacing. Parameters 
+//can be set by name with setFitParameter, the names are the member names.
+struct FitParameters{
+  //Eye A) 3. and 5. Gaussian smoothing
+  double eyeSigma = 10;
+  //Eye A) 4. Binary threshold
+  double eyeThreshold = 25;
+  //Eye A) 4.1 Closing radius
+  int eyeClosingRadius = 70;
+  //Eye B) Major to minor axis ratio of the initial ellipse and ring width
+  double eyeAspectRatio = 1.3;
+  double eyeRingFactor = 1.3;
+  //Eye C) Multi resolution schedule of the affine registration
+  std::vector<unsigned int> eyeShrinkFactors = {8, 4};
+  std::vector<double> eyeSmoothingSigmas = {2, 0};
+  //Eye C) Multi hypothesis initialization, disabled if eyeHypothesisCenters
+  //is 0. Up to eyeHypothesisCenters local maxima of the distance transform
+  //of step A 4.3, at least eyeHypothesisSeparation times the largest 
+  //distance apart, are combined with eyeAspectRatio and the ratios of 
+  //eyeHypothesisAspectRatios. Each hypothesis is registered on the first
+  //level of eyeShrinkFactors with at most eyeHypothesisEvaluations metric
+  //evaluations, concurrently on stageThreads threads. The best is refined
+  //on the remaining levels.
+  unsigned int eyeHypothesisCenters = 0;
+  std::vector<double> eyeHypothesisAspectRatios = {1.1, 1.5};
+  double eyeHypothesisSeparation = 0.5;
+  unsigned int eyeHypothesisEvaluations = 200;
+
+  //Stem A) 2. Gaussian smoothing
+  double stemSigmaX = 1.5;
+  double stemSigmaY = 20;
+  //Stem A) 3.1 Binary threshold and 3.2 opening radius
+  double stemThreshold = 75;
+  int stemOpeningRadius = 15;
+  //Stem A) 5. Binary threshold
+  double stemRefineThreshold = 65;
+  //Stem A) 6. and B) 2. Gaussian smoothing
+  double stemRegistrationSigma = 3;
+  //Stem C) Multi resolution schedule of the similarity registration
+  std::vector<unsigned int> stemShrinkFactors = {1};
+  std::vector<double> stemSmoothingSigmas = {0};
+  //Stem C) Automatic schedule from the stem region size and initial width,
+  //replaces stemShrinkFactors and stemSmoothingSigmas if set, see 
+  //stemLevelSchedule. The coarsest shrink factor is at most 
+  //stemMaxShrinkFactor and keeps the bars at least stemMinBarPixels wide 
+  //and the region at least stemMinLevelSize pixels along both axes.
+  bool stemAutoLevels = false;
+  unsigned int stemMaxShrinkFactor = 4;
+  double stemMinBarPixels = 3;
+  unsigned int stemMinLevelSize = 32;
+
+  //LBFGS optimizer of both registrations
+  double gradientConvergenceTolerance = 0.000001;
+  double lineSearchAccuracy = 0.5;
+  double defaultStepLength = 0.00001;
+  unsigned int maximumNumberOfFunctionEvaluations = 20000;
+  //Use FastMeanSquaresMetric in both registrations. Same value and
+  //derivative as the ITK metric up to rounding, evaluated row by row with
+  //SIMD. See TestFastMeanSquaresMetric.cxx.
+  bool fastMetric = false;
+  //Share the eye ring and mask and the stem bars and mask between fits
+  //with the same geometry through TemplateCache, at most templateCacheSize
+  //of each. The initial eye radii are rounded to multiples of 
+  //templateRadiusStep pixels first, so eyes of similar size share templates.
+  //Cached templates are built at a fixed anchor and translated, which
+  //changes partial pixel values at the ellipse border compared to building
+  //at the center. Results do not depend on the fits that ran before.
+  bool templateCache = false;
+  unsigned int templateCacheSize = 16;
+  double templateRadiusStep = 1;
+
+  //Time budget in seconds for fitEye and fitStem of one image, 0 for none.
+  //Registrations still running at the deadline are stopped and keep the 
+  //best parameters reached so far, see FitLevel.
+  double deadline = 0;
+
+  //Input gate, see gateInput. Disabled by default. Block size in pixels of
+  //the decimated image, minimal 5 to 95 percentile range of the block means
+  //in input intensities and minimal area of the dark eye blob as fraction 
+  //of the image.
+  bool inputGate = false;
+  unsigned int gateBlockSize = 16;
+  double gateMinContrast = 30;
+  double gateMinEyeArea = 0.02;
+
+  //Threads running independent stages of fitEye concurrently, see 
+  //TaskGraph.h. The eye stages have at most three concurrent branches, 1
+  //runs them in sequence and 0 uses all hardware threads. Does not change
+  //the results, see TestStageThreads.cxx.
+  unsigned int stageThreads = 3;
+};
+
+
+
+//Outcome of a fit, failures skip the remaining stages
+enum FitStatus{
+  FIT_OK,
+  //Rejected by the input gate: not enough contrast
+  FIT_LOW_CONTRAST,
+  //Rejected by the input gate: no dark blob large enough for the eye
+  FIT_NO_EYE,
+  //No room for the optic nerve below the eye
+  FIT_NO_STEM_AREA,
+  //The optic nerve could not be located below the eye
+  FIT_NO_STEM,
+  //The fit threw, there are no estimates
+  FIT_ERROR
+};
+
+const char *fitStatusName(FitStatus status);
+
+
+
+//Refinement level an eye or stem estimate comes from
+enum FitLevel{
+  //No estimate, the fit failed
+  FIT_NONE,
+  //Initial estimate from the distance transforms, the registration was
+  //stopped at the deadline before completing an iteration
+  FIT_INITIAL,
+  //Registration stopped at the deadline
+  FIT_PARTIAL,
+  //Registration ran to convergence
+  FIT_FULL
+};
+
+const char *fitLevelName(FitLevel level);
+
+
+
+//Deadline of a registration. Set time before registering, reached and 
+//iterations report whether and after how many iterations it was stopped.
+struct RegistrationDeadline{
+  std::chrono::steady_clock::time_point time;
+  bool reached = false;
+  unsigned int iterations = 0;
+
+  FitLevel Level() const{
+    if( !reached ){
+      return FIT_FULL;
+    }
+    return iterations > 0 ? FIT_PARTIAL : FIT_INITIAL;
+  };
+};
+
+
+
+//Storage for eye and stem location and sizes
+struct Eye{
+  ImageType::IndexType initialCenterIndex;
+  ImageType::PointType initialCenter;
+  ImageType::IndexType centerIndex;
+  ImageType::PointType center;
+  double initialRadius = -1;
+  double minor = -1;
+  double major = -1;
+
+  double initialRadiusX = -1;
+  double initialRadiusY = -1;
+  
+  //Fitted ellipse ring, stored parametrically: the template ring with 
+  //radii r1, r2 and ring factor rf centered at initialCenter is mapped into
+  //the image by the affine transform with center initialCenter and 
+  //parameters transformParameters. See rasterizeEye to create an image.
+  double r1 = -1;
+  double r2 = -1;
+  double rf = -1;
+  AffineTransformType::ParametersType transformParameters;
+
+  //Convergence of the eye registration
+  RegistrationTelemetry registration;
+
+  FitStatus status = FIT_OK;
+  FitLevel level = FIT_NONE;
+  //Start of fitEye, FitParameters::deadline covers eye and stem
+  std::chrono::steady_clock::time_point fitStart;
+};
+
+
+
+struct Stem{
+  ImageType::IndexType initialCenterIndex;
+  ImageType::PointType initialCenter;
+  ImageType::IndexType centerIndex;
+  ImageType::PointType center;
+  double initialWidth = -1;
+  double width = -1; 
+
+  ImageType::RegionType originalImageRegion;
+
+  //Fitted bars, stored parametrically: the template bars in index 
+  //coordinates of the stem region are mapped into the image by the 
+  //similarity transform with center initialCenter and parameters 
+  //transformParameters. See rasterizeStem to create an image.
+  int barsYStart = 0;
+  int barsXStart1 = 0;
+  int barsXEnd1 = 0;
+  int barsXStart2 = 0;
+  int barsXEnd2 = 0;
+  SimilarityTransformType::ParametersType transformParameters;
+
+  //Convergence of the stem registration
+  RegistrationTelemetry registration;
+
+  FitStatus status = FIT_OK;
+  FitLevel level = FIT_NONE;
+};
+
+
+//Smoothed region of interest of the stem estimation
+struct StemRegion{
+  //FIT_OK or the reason no region could be extracted
+  FitStatus status = FIT_OK;
+  //Region of the input image
+  ImageType::RegionType region;
+  //Extracted region
+  ImageType::Pointer original;
+  //Smoothed, rows rescaled to [0, 100]
+  ImageType::Pointer smoothed;
+  //Set if the region is fitted more than once, see fitStem
+  bool shared = false;
+};
+
+
+//Helper function
+std::string catStrings(std::string s1, std::string s2);
+
+
+//Set a parameter from its name and a string value, lists are comma 
+//separated. Returns false for unknown names or invalid values.
+bool setFitParameter(FitParameters &parameters, const std::string &name, 
+                     const std::string &value);
+
+//Set a parameter from a name=value string
+bool setFitParameter(FitParameters &parameters, const std::string &assignment);
+
+//Print all parameters as name=value lines
+void printFitParameters(const FitParameters &parameters, std::ostream &out);
+
+
+//Create ellipse image
+ImageType::Pointer CreateEllipseImage( ImageType::SpacingType spacing, 
+		                       ImageType::SizeType size, 
+				       ImageType::PointType origin,
+				       ImageType::PointType center,
+				       double r1, double r2, 
+               double outside = 100, double inside = 0);
+
+//Create the fixed image of the eye registration, an ellipse ring with 
+//radii r1, r2 and rf*r1, rf*r2. Steps B 1. and 2. of the eye estimation.
+ImageType::Pointer CreateEllipseRingImage( ImageType::SpacingType spacing, 
+		                           ImageType::SizeType size, 
+				           ImageType::PointType origin,
+				           ImageType::PointType center,
+				           double r1, double r2, double rf );
+
+//Create a black and white image with two bars covering the columns 
+//[xStart1, xEnd1) and [xStart2, xEnd2) from row yStart on
+ImageType::Pointer CreateBarsImage( ImageType::RegionType region,
+                                    ImageType::SpacingType spacing, 
+                                    ImageType::PointType origin,
+                                    int yStart, int xStart1, int xEnd1, 
+                                    int xStart2, int xEnd2,
+                                    double inside = 100.0 );
+
+//Fixed image and mask of the eye registration and moving image and mask
+//of the stem registration, shared through TemplateCache if 
+//FitParameters::templateCache is set. The eye templates are centered at
+//center with index centerIndex, the stem templates at column centerColumn
+//of region.
+ImageType::Pointer eyeRingTemplate( ImageType::SpacingType spacing, 
+                                    ImageType::SizeType size, 
+                                    ImageType::PointType origin,
+                                    ImageType::PointType center,
+                                    ImageType::IndexType centerIndex,
+                                    double r1, double r2, double rf,
+                                    const FitParameters &parameters );
+ImageType::Pointer eyeMaskTemplate( ImageType::SpacingType spacing, 
+                                    ImageType::SizeType size, 
+                                    ImageType::PointType origin,
+                                    ImageType::PointType center,
+                                    ImageType::IndexType centerIndex,
+                                    double r1, double r2, double rf,
+                                    const FitParameters &parameters );
+ImageType::Pointer stemBarsTemplate( ImageType::RegionType region,
+                                     ImageType::SpacingType spacing, 
+                                     ImageType::PointType origin,
+                                     int centerColumn, int yStart, int xStart1, int xEnd1, 
+                                     int xStart2, int xEnd2, const FitParameters &parameters );
+UnsignedCharImageType::Pointer stemMaskTemplate( ImageType::RegionType region,
+                                                 ImageType::SpacingType spacing, 
+                                                 ImageType::PointType origin,
+                                                 int centerColumn, int yStart, 
+                                                 int xStart, int xEnd, 
+                                                 const FitParameters &parameters );
+
+
+//Fitted eye and stem transforms from the stored parameters
+AffineTransformType::Pointer eyeTransform(const Eye &eye);
+SimilarityTransformType::Pointer stemTransform(const Stem &stem);
+
+//Geometry of the stem region of interest within image
+ImageType::RegionType stemTemplateRegion(const Stem &stem);
+ImageType::PointType stemTemplateOrigin(const Stem &stem, ImageType::Pointer image);
+
+//Rasterize the fitted ellipse ring on the grid of image
+ImageType::Pointer rasterizeEye(const Eye &eye, ImageType::Pointer image);
+
+//Rasterize the fitted bars on the grid of the stem region of image
+ImageType::Pointer rasterizeStem(const Stem &stem, ImageType::Pointer image);
+
+//Overlay geometry of the fitted eye ring and stem bars
+OverlayRenderer<ImageType>::EllipseRing overlayRing(const Eye &eye);
+OverlayRenderer<ImageType>::Bars overlayBars(const Stem &stem, ImageType::Pointer image);
+
+
+//Affine registration of the eye, step C 2. of the eye estimation. 
+//Convergence per pyramid level is recorded into telemetry if given. If a
+//deadline is given the registration stops when it is reached and returns
+//the best parameters so far. Starts from initialParameters if given and 
+//from the identity otherwise.
+AffineTransformType::Pointer registerEye( ImageType::Pointer fixedImage, 
+                                          ImageType::Pointer movingImage,
+                                          ImageType::Pointer fixedMask,
+                                          ImageType::PointType center,
+                                          const FitParameters &parameters = FitParameters(),
+                                          RegistrationTelemetry *telemetry = NULL,
+                                          RegistrationDeadline *deadline = NULL,
+                                          const AffineTransformType::ParametersType *initialParameters = NULL );
+
+//Automatic multi resolution schedule of the stem registration, used by
+//fitStem if FitParameters::stemAutoLevels is set. The shrink factor halves
+//from the coarsest one allowed by the parameters down to 1, a region too
+//small for shrinking gets the single level {1}. Coarse levels are smoothed
+//with a quarter of the shrink factor in pixels. size and spacing are those
+//of the stem region, initialWidth is Stem::initialWidth.
+void stemLevelSchedule( ImageType::SizeType size, ImageType::SpacingType spacing,
+                        double initialWidth, const FitParameters &parameters,
+                        std::vector<unsigned int> &shrinkFactors,
+                        std::vector<double> &smoothingSigmas );
+
+//Similarity registration of the stem, step C 2. of the stem estimation
+SimilarityTransformType::Pointer registerStem( ImageType::Pointer fixedImage, 
+                                               ImageType::Pointer movingImage,
+                                               UnsignedCharImageType::Pointer fixedMask,
+                                               ImageType::PointType center,
+                                               const FitParameters &parameters = FitParameters(),
+                                               RegistrationTelemetry *telemetry = NULL,
+                                               RegistrationDeadline *deadline = NULL );
+
+
+//Fast check whether an image can be fitted, used by fitEye if 
+//FitParameters::inputGate is set. The image is decimated to block means 
+//from a few samples per block. It is rejected if the 5 to 95 percentile 
+//range of the means is below gateMinContrast or if, after rescaling to
+//[0, 100] as in step A 1., the largest connected blob of blocks below 
+//eyeThreshold covers less than gateMinEyeArea of the image.
+FitStatus gateInput(ImageType::Pointer inputImage, 
+                    const FitParameters &parameters = FitParameters());
+
+
+//Fit an ellipse to an eye ultrasound image. Intermediate images are 
+//dumped with the given prefix if it is captured, see DebugDumps.h.
+Eye fitEye(ImageType::Pointer inputImage, const std::string &prefix,
+           const FitParameters &parameters = FitParameters());
+
+//Fit two bars to an ultrasound image based on eye location and size. If 
+//the eye was rejected the stem reports the same status.
+Stem fitStem(ImageType::Pointer inputImage, Eye &eye, const std::string &prefix,
+             const FitParameters &parameters = FitParameters());
+
+//Steps A 1. to 3. of the stem estimation, depends only on the eye and 
+//stemSigmaX, stemSigmaY. Split from fitStem so several stem fits can share
+//the region, see ParameterSweep.h.
+StemRegion extractStemRegion(ImageType::Pointer inputImage, const Eye &eye, 
+                             const std::string &prefix,
+                             const FitParameters &parameters = FitParameters());
+
+//Remaining steps of fitStem on a region from extractStemRegion. Steps 4
+//and 5 work in place on region.smoothed, which must not be used afterwards
+//unless region.shared is set, then they work on a copy.
+Stem fitStem(ImageType::Pointer inputImage, Eye &eye, const StemRegion &region,
+             const std::string &prefix, 
+             const FitParameters &parameters = FitParameters());
+
+
+#endif
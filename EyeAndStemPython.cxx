@@ -0,0 +1,268 @@
+//Python bindings of fitEye and fitStem, built with -DBUILD_PYTHON_MODULE=ON.
+//
+//  import numpy, eyeandstem
+//  eye, stem = eyeandstem.fit( image, spacing=(0.1, 0.1) )
+//  print( 2 * stem["width"] )
+//
+//Images are 2D NumPy arrays indexed [y, x] like the rows of the ultrasound
+//image. C contiguous float32 arrays are used in place without a copy,
+//other arrays are converted once. The GIL is released while fitting, fitMany
+//fits a list of images on native threads. Fitting parameters are given as a
+//dict of FitParameters names and values, see setFitParameter.
+
+
+
+#include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
+#include <pybind11/stl.h>
+
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <sstream>
+
+#include "EyeAndStemFitting.h"
+
+
+namespace py = pybind11;
+
+typedef py::array_t<PixelType, py::array::c_style | py::array::forcecast> PixelArray;
+typedef ImageType::PixelContainer ImportContainer;
+
+
+
+//Image sharing the buffer of array, which has to outlive the image
+ImageType::Pointer viewImage(const PixelArray &array, const std::vector<double> &spacing,
+                             const std::vector<double> &origin){
+  if( array.ndim() != 2 ){
+    throw std::invalid_argument( "image has to be a 2D array" );
+  }
+  if( spacing.size() != 2 || origin.size() != 2 ){
+    throw std::invalid_argument( "spacing and origin need two values (x, y)" );
+  }
+
+  ImageType::SizeType size;
+  size[0] = array.shape(1);
+  size[1] = array.shape(0);
+
+  ImportContainer::Pointer container = ImportContainer::New();
+  container->SetImportPointer( const_cast<PixelType *>( array.data() ),
+                               size[0] * size[1], false );
+
+  ImageType::Pointer image = ImageType::New();
+  image->SetRegions( ImageType::RegionType( size ) );
+  image->SetPixelContainer( container );
+  ImageType::SpacingType imageSpacing;
+  ImageType::PointType imageOrigin;
+  for(unsigned int i=0; i<2; i++){
+    imageSpacing[i] = spacing[i];
+    imageOrigin[i] = origin[i];
+  }
+  image->SetSpacing( imageSpacing );
+  image->SetOrigin( imageOrigin );
+  return image;
+};
+
+
+
+FitParameters toFitParameters(const py::dict &values){
+  FitParameters parameters;
+  for(std::pair<py::handle, py::handle> item : values){
+    std::string name = py::str( item.first );
+    std::string value;
+    if( py::isinstance<py::list>( item.second ) || py::isinstance<py::tuple>( item.second ) ){
+      std::stringstream list;
+      bool first = true;
+      for(py::handle v : item.second){
+        list << ( first ? "" : "," ) << std::string( py::str( v ) );
+        first = false;
+      }
+      value = list.str();
+    }
+    else if( py::isinstance<py::bool_>( item.second ) ){
+      value = item.second.cast<bool>() ? "1" : "0";
+    }
+    else{
+      value = py::str( item.second );
+    }
+    if( !setFitParameter( parameters, name, value ) ){
+      throw std::invalid_argument( "invalid parameter " + name + "=" + value );
+    }
+  }
+  return parameters;
+};
+
+
+
+py::tuple toPair(const ImageType::PointType &p){
+  return py::make_tuple( p[0], p[1] );
+};
+
+py::tuple toPair(const ImageType::IndexType &index){
+  return py::make_tuple( index[0], index[1] );
+};
+
+template <typename TParameters>
+std::vector<double> toList(const TParameters &parameters){
+  std::vector<double> list( parameters.GetSize() );
+  for(unsigned int i=0; i<list.size(); i++){
+    list[i] = parameters[i];
+  }
+  return list;
+};
+
+
+
+//Geometry is only set for successful fits, failed fits report status only
+py::dict eyeToDict(const Eye &eye){
+  py::dict d;
+  d["status"] = fitStatusName( eye.status );
+  d["level"] = fitLevelName( eye.level );
+  if( eye.status == FIT_OK ){
+    d["initialCenter"] = toPair( eye.initialCenter );
+    d["initialCenterIndex"] = toPair( eye.initialCenterIndex );
+    d["center"] = toPair( eye.center );
+    d["centerIndex"] = toPair( eye.centerIndex );
+    d["initialRadius"] = eye.initialRadius;
+    d["initialRadiusX"] = eye.initialRadiusX;
+    d["initialRadiusY"] = eye.initialRadiusY;
+    d["minor"] = eye.minor;
+    d["major"] = eye.major;
+    d["r1"] = eye.r1;
+    d["r2"] = eye.r2;
+    d["rf"] = eye.rf;
+    d["transformParameters"] = toList( eye.transformParameters );
+  }
+  return d;
+};
+
+py::dict stemToDict(const Stem &stem){
+  py::dict d;
+  d["status"] = fitStatusName( stem.status );
+  d["level"] = fitLevelName( stem.level );
+  if( stem.status == FIT_OK ){
+    d["initialCenter"] = toPair( stem.initialCenter );
+    d["initialCenterIndex"] = toPair( stem.initialCenterIndex );
+    d["center"] = toPair( stem.center );
+    d["centerIndex"] = toPair( stem.centerIndex );
+    d["initialWidth"] = stem.initialWidth;
+    d["width"] = stem.width;
+    d["transformParameters"] = toList( stem.transformParameters );
+  }
+  return d;
+};
+
+
+
+//Fits run their stages in sequence unless stageThreads is set, callers
+//may already fit images concurrently with the GIL released
+FitParameters sequentialFitParameters(py::dict values){
+  py::dict sequential;
+  sequential["stageThreads"] = 1;
+  for(std::pair<py::handle, py::handle> item : values){
+    sequential[item.first] = item.second;
+  }
+  return toFitParameters( sequential );
+};
+
+
+
+py::tuple fit(PixelArray array, std::vector<double> spacing, std::vector<double> origin,
+              py::dict values){
+  ImageType::Pointer image = viewImage( array, spacing, origin );
+  FitParameters parameters = sequentialFitParameters( values );
+  Eye eye;
+  Stem stem;
+  {
+    py::gil_scoped_release release;
+    eye = fitEye( image, "", parameters );
+    stem = fitStem( image, eye, "", parameters );
+  }
+  return py::make_tuple( eyeToDict( eye ), stemToDict( stem ) );
+};
+
+
+
+//Images are taken from a shared counter by the threads, each image is
+//fitted with its stages in sequence unless stageThreads is set
+py::list fitMany(std::vector<PixelArray> arrays, std::vector<double> spacing,
+                 std::vector<double> origin, py::dict values, unsigned int numberOfThreads){
+  std::vector<ImageType::Pointer> images;
+  for(unsigned int i=0; i<arrays.size(); i++){
+    images.push_back( viewImage( arrays[i], spacing, origin ) );
+  }
+  //Images already run in parallel, stages only on request
+  FitParameters parameters = sequentialFitParameters( values );
+
+  if( numberOfThreads == 0 ){
+    numberOfThreads = std::max( 1u, std::thread::hardware_concurrency() );
+  }
+  numberOfThreads = std::min( numberOfThreads, (unsigned int) images.size() );
+
+  std::vector<Eye> eyes( images.size() );
+  std::vector<Stem> stems( images.size() );
+  {
+    py::gil_scoped_release release;
+    std::atomic<size_t> next( 0 );
+    std::exception_ptr error;
+    std::mutex errorMutex;
+    auto work = [&](){
+      for(size_t i = next++; i < images.size(); i = next++){
+        try{
+          eyes[i] = fitEye( images[i], "", parameters );
+          stems[i] = fitStem( images[i], eyes[i], "", parameters );
+        }
+        catch( ... ){
+          std::lock_guard<std::mutex> lock( errorMutex );
+          if( !error ){
+            error = std::current_exception();
+          }
+        }
+      }
+    };
+    std::vector<std::thread> threads;
+    for(unsigned int t=1; t<numberOfThreads; t++){
+      threads.push_back( std::thread( work ) );
+    }
+    work();
+    for(unsigned int t=0; t<threads.size(); t++){
+      threads[t].join();
+    }
+    if( error ){
+      std::rethrow_exception( error );
+    }
+  }
+
+  py::list results;
+  for(unsigned int i=0; i<images.size(); i++){
+    results.append( py::make_tuple( eyeToDict( eyes[i] ), stemToDict( stems[i] ) ) );
+  }
+  return results;
+};
+
+
+
+PYBIND11_MODULE(eyeandstem, m){
+  m.doc() = "Estimation of the optic nerve width from B-mode ultrasound images";
+
+  m.def( "fit", &fit,
+         "Fit eye and stem to a 2D image array indexed [y, x], returns the eye and stem as dicts. "
+         "The stages run in sequence unless stageThreads is set.",
+         py::arg( "image" ), py::arg( "spacing" ) = std::vector<double>( 2, 1.0 ),
+         py::arg( "origin" ) = std::vector<double>( 2, 0.0 ),
+         py::arg( "parameters" ) = py::dict() );
+
+  m.def( "fitMany", &fitMany,
+         "Fit a list of images on native threads, 0 threads uses all hardware threads. "
+         "Returns a list of (eye, stem) tuples.",
+         py::arg( "images" ), py::arg( "spacing" ) = std::vector<double>( 2, 1.0 ),
+         py::arg( "origin" ) = std::vector<double>( 2, 0.0 ),
+         py::arg( "parameters" ) = py::dict(), py::arg( "threads" ) = 0 );
+
+  m.def( "parameters", [](){
+           std::stringstream out;
+           printFitParameters( FitParameters(), out );
+           return out.str();
+         },
+         "Default fitting parameters as name=value lines" );
+}
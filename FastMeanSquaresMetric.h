@@ -0,0 +1,360 @@
+#ifndef FASTMEANSQUARESMETRIC_H
+#define FASTMEANSQUARESMETRIC_H
+
+
+//Mean squares metric for the 2D matrix and offset registrations of fitEye
+//and fitStem, used instead of itk::MeanSquaresImageToImageMetricv4 if
+//FitParameters::fastMetric is set.
+//
+//The generic metric transforms, interpolates and differentiates every
+//virtual point through virtual calls. Here the fixed samples inside the
+//fixed mask are collected once per image pair, row by row, and the moving
+//continuous index is advanced by a constant step along each row. The rows
+//are handed to the vectorized kernel of MeanSquaresKernel.h.
+//
+//Value and derivative follow the superclass: linear interpolation, the
+//moving gradient from the gradient filter image or central differences,
+//points outside the moving image skipped and both divided by the number of
+//valid points. Other transforms, moving masks, sampled point sets and
+//non identity directions fall back to the superclass. So does an
+//evaluation without valid points, so the registration sees the same
+//value, derivative and warning or exception as with the ITK metric.
+
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+#include "itkMeanSquaresImageToImageMetricv4.h"
+#include "itkLinearInterpolateImageFunction.h"
+#include "itkCompositeTransform.h"
+#include "itkAffineTransform.h"
+#include "itkSimilarity2DTransform.h"
+#include "itkImageRegionConstIterator.h"
+
+#include "MeanSquaresKernel.h"
+
+
+template <typename TFixedImage, typename TMovingImage>
+class FastMeanSquaresMetric
+  : public itk::MeanSquaresImageToImageMetricv4<TFixedImage, TMovingImage>{
+
+  public:
+
+    typedef FastMeanSquaresMetric Self;
+    typedef itk::MeanSquaresImageToImageMetricv4<TFixedImage, TMovingImage> Superclass;
+    typedef itk::SmartPointer<Self> Pointer;
+    typedef itk::SmartPointer<const Self> ConstPointer;
+
+    typedef typename Superclass::MeasureType MeasureType;
+    typedef typename Superclass::DerivativeType DerivativeType;
+    typedef typename Superclass::VirtualImageType VirtualImageType;
+    typedef typename Superclass::VirtualPointType VirtualPointType;
+    typedef typename Superclass::FixedTransformType FixedTransformType;
+    typedef typename Superclass::MovingImageGradientImageType MovingImageGradientImageType;
+
+    typedef itk::MatrixOffsetTransformBase<double, 2, 2> MatrixOffsetTransformType;
+    typedef itk::AffineTransform<double, 2> AffineType;
+    typedef itk::Similarity2DTransform<double> SimilarityType;
+    typedef itk::CompositeTransform<double, 2> CompositeType;
+
+  itkNewMacro( Self );
+  itkTypeMacro( FastMeanSquaresMetric, MeanSquaresImageToImageMetricv4 );
+
+
+  MeasureType GetValue() const{
+    MeanSquaresSums sums;
+    if( !Accumulate( sums ) || sums.count == 0 ){
+      return Superclass::GetValue();
+    }
+    MeasureType value;
+    ValueFromSums( sums, value );
+    return value;
+  };
+
+
+  void GetValueAndDerivative(MeasureType &value, DerivativeType &derivative) const{
+    MeanSquaresSums sums;
+    if( !Accumulate( sums ) || sums.count == 0 ){
+      Superclass::GetValueAndDerivative( value, derivative );
+      return;
+    }
+
+    if( derivative.GetSize() != this->GetNumberOfParameters() ){
+      derivative.SetSize( this->GetNumberOfParameters() );
+    }
+    ValueFromSums( sums, value );
+
+    //Chain rule with the Jacobian of the transform at q = point - center
+    double n = sums.count;
+    const MatrixOffsetTransformType *transform = MovingMatrixOffsetTransform();
+    const SimilarityType *similarity = dynamic_cast<const SimilarityType *>( transform );
+    if( similarity != NULL ){
+      double c = std::cos( similarity->GetAngle() );
+      double s = std::sin( similarity->GetAngle() );
+      derivative[0] = ( c * sums.gq[0] - s * sums.gq[1] + s * sums.gq[2] + c * sums.gq[3] ) / n;
+      derivative[1] = similarity->GetScale() *
+                      ( -s * sums.gq[0] - c * sums.gq[1] + c * sums.gq[2] - s * sums.gq[3] ) / n;
+      derivative[2] = sums.g[0] / n;
+      derivative[3] = sums.g[1] / n;
+    }
+    else{
+      for(unsigned int i=0; i<4; i++){
+        derivative[i] = sums.gq[i] / n;
+      }
+      derivative[4] = sums.g[0] / n;
+      derivative[5] = sums.g[1] / n;
+    }
+  };
+
+
+
+  //Whether GetValue and GetValueAndDerivative take the fast path for the
+  //current images, masks and transforms. Evaluations without valid points
+  //still fall back to the superclass.
+  bool IsFastPathSupported() const{
+    return MovingMatrixOffsetTransform() != NULL && Prepare();
+  };
+
+
+
+  protected:
+
+    FastMeanSquaresMetric() : m_PreparedTime( 0 ), m_Prepared( false ) {};
+    ~FastMeanSquaresMetric() {};
+
+
+  private:
+
+    FastMeanSquaresMetric(const Self &);
+    void operator=(const Self &);
+
+
+    //Consecutive fixed samples of a virtual row
+    struct Run{
+      int row;
+      int column;
+      unsigned int n;
+      size_t offset;
+    };
+
+
+    //The optimized affine or similarity transform, NULL if the moving
+    //transform is anything else
+    const MatrixOffsetTransformType *MovingMatrixOffsetTransform() const{
+      const typename Superclass::MovingTransformType *transform = this->m_MovingTransform.GetPointer();
+      const CompositeType *composite = dynamic_cast<const CompositeType *>( transform );
+      if( composite != NULL ){
+        if( composite->GetNumberOfTransforms() != 1 ){
+          return NULL;
+        }
+        transform = composite->GetNthTransform( 0 ).GetPointer();
+      }
+      const AffineType *affine = dynamic_cast<const AffineType *>( transform );
+      if( affine != NULL && affine->GetNumberOfParameters() == 6 ){
+        return affine;
+      }
+      const SimilarityType *similarity = dynamic_cast<const SimilarityType *>( transform );
+      if( similarity != NULL && similarity->GetNumberOfParameters() == 4 ){
+        return similarity;
+      }
+      return NULL;
+    };
+
+
+    //Sums over all fixed samples, false if the fast path does not apply
+    bool Accumulate(MeanSquaresSums &sums) const{
+      const MatrixOffsetTransformType *transform = MovingMatrixOffsetTransform();
+      if( transform == NULL || !Prepare() ){
+        return false;
+      }
+
+      typename MatrixOffsetTransformType::MatrixType A = transform->GetMatrix();
+      typename MatrixOffsetTransformType::OutputVectorType offset = transform->GetOffset();
+      typename MatrixOffsetTransformType::InputPointType center = transform->GetCenter();
+
+      MeanSquaresMoving moving;
+      moving.values = &m_MovingValues[0];
+      moving.gradientX = &m_GradientX[0];
+      moving.gradientY = &m_GradientY[0];
+      moving.width = m_MovingWidth;
+      moving.height = m_MovingHeight;
+      moving.gradientMargin = m_GradientMargin;
+
+      MeanSquaresRun run;
+      run.stepX = A(0, 0) * m_VirtualSpacing[0] / m_MovingSpacing[0];
+      run.stepY = A(1, 0) * m_VirtualSpacing[0] / m_MovingSpacing[1];
+      run.stepQ = m_VirtualSpacing[0];
+      for(unsigned int i=0; i<m_Runs.size(); i++){
+        const Run &r = m_Runs[i];
+        double px = m_VirtualOrigin[0] + r.column * m_VirtualSpacing[0];
+        double py = m_VirtualOrigin[1] + r.row * m_VirtualSpacing[1];
+        double mx = A(0, 0) * px + A(0, 1) * py + offset[0];
+        double my = A(1, 0) * px + A(1, 1) * py + offset[1];
+        run.x = ( mx - m_MovingOrigin[0] ) / m_MovingSpacing[0];
+        run.y = ( my - m_MovingOrigin[1] ) / m_MovingSpacing[1];
+        run.qx = px - center[0];
+        run.qy = py - center[1];
+        run.fixed = &m_FixedValues[r.offset];
+        run.n = r.n;
+        accumulateMeanSquares( moving, run, sums );
+      }
+      return true;
+    };
+
+
+    //Value from the sums of at least one valid point
+    void ValueFromSums(const MeanSquaresSums &sums, MeasureType &value) const{
+      this->m_NumberOfValidPoints = sums.count;
+      value = sums.value / sums.count;
+      this->m_Value = value;
+    };
+
+
+    //Collects the fixed samples and the moving planes whenever the images,
+    //masks or domains changed since the last call. Done lazily since the
+    //registration replaces the images and reinitializes for every level.
+    bool Prepare() const{
+      itk::ModifiedTimeType time = std::max( this->GetMTime(), this->m_FixedTransform->GetMTime() );
+      time = std::max( time, this->m_FixedImage->GetMTime() );
+      time = std::max( time, this->m_MovingImage->GetMTime() );
+      if( this->m_FixedImageMask.IsNotNull() ){
+        time = std::max( time, this->m_FixedImageMask->GetMTime() );
+      }
+      if( this->GetUseMovingImageGradientFilter() && this->m_MovingImageGradientImage.IsNotNull() ){
+        time = std::max( time, this->m_MovingImageGradientImage->GetMTime() );
+      }
+      if( time != m_PreparedTime ){
+        m_PreparedTime = time;
+        m_Prepared = Supported() && PrepareMoving() && PrepareFixed();
+      }
+      return m_Prepared;
+    };
+
+
+    bool Supported() const{
+      typedef itk::LinearInterpolateImageFunction<TMovingImage, double> LinearType;
+      if( this->GetUseFixedSampledPointSet() || this->m_MovingImageMask.IsNotNull() ||
+          dynamic_cast<const LinearType *>( this->m_MovingInterpolator.GetPointer() ) == NULL ){
+        return false;
+      }
+      if( this->GetUseMovingImageGradientFilter() && this->m_MovingImageGradientImage.IsNull() ){
+        return false;
+      }
+      typename TMovingImage::DirectionType identity;
+      identity.SetIdentity();
+      return this->m_MovingImage->GetDirection() == identity &&
+             this->GetVirtualDirection() == identity;
+    };
+
+
+    //Moving image and gradient planes of the buffered region
+    bool PrepareMoving() const{
+      typename TMovingImage::RegionType region = this->m_MovingImage->GetBufferedRegion();
+      m_MovingWidth = region.GetSize()[0];
+      m_MovingHeight = region.GetSize()[1];
+      if( m_MovingWidth < 2 || m_MovingHeight < 2 ){
+        return false;
+      }
+      //Continuous indices relative to the start of the buffer
+      for(unsigned int i=0; i<2; i++){
+        m_MovingSpacing[i] = this->m_MovingImage->GetSpacing()[i];
+        m_MovingOrigin[i] = this->m_MovingImage->GetOrigin()[i] +
+                            region.GetIndex()[i] * m_MovingSpacing[i];
+      }
+
+      m_MovingValues.resize( region.GetNumberOfPixels() );
+      itk::ImageRegionConstIterator<TMovingImage> it( this->m_MovingImage, region );
+      for(size_t k = 0; !it.IsAtEnd(); ++it, ++k){
+        m_MovingValues[k] = it.Get();
+      }
+
+      //The gradient filter image is sampled like the moving image, central
+      //differences need both neighbors inside
+      if( this->GetUseMovingImageGradientFilter() ){
+        m_GradientMargin = 0;
+        m_GradientX.resize( region.GetNumberOfPixels() );
+        m_GradientY.resize( region.GetNumberOfPixels() );
+        itk::ImageRegionConstIterator<MovingImageGradientImageType>
+          git( this->m_MovingImageGradientImage, region );
+        for(size_t k = 0; !git.IsAtEnd(); ++git, ++k){
+          m_GradientX[k] = git.Get()[0];
+          m_GradientY[k] = git.Get()[1];
+        }
+      }
+      else{
+        m_GradientMargin = 1;
+        centralDifferencePlanes( &m_MovingValues[0], m_MovingWidth, m_MovingHeight,
+                                 m_MovingSpacing[0], m_MovingSpacing[1], m_GradientX, m_GradientY );
+      }
+      return true;
+    };
+
+
+    //Fixed values of the virtual points that map inside the fixed mask and
+    //image, as runs along the rows
+    bool PrepareFixed() const{
+      m_Runs.clear();
+      m_FixedValues.clear();
+      for(unsigned int i=0; i<2; i++){
+        m_VirtualSpacing[i] = this->GetVirtualSpacing()[i];
+        m_VirtualOrigin[i] = this->GetVirtualOrigin()[i];
+      }
+
+      typename VirtualImageType::RegionType region = this->GetVirtualRegion();
+      int x0 = region.GetIndex()[0];
+      int y0 = region.GetIndex()[1];
+      int x1 = x0 + (int) region.GetSize()[0];
+      int y1 = y0 + (int) region.GetSize()[1];
+      for(int y = y0; y < y1; y++){
+        bool open = false;
+        for(int x = x0; x < x1; x++){
+          VirtualPointType point;
+          point[0] = m_VirtualOrigin[0] + x * m_VirtualSpacing[0];
+          point[1] = m_VirtualOrigin[1] + y * m_VirtualSpacing[1];
+          typename FixedTransformType::OutputPointType fixedPoint =
+            this->m_FixedTransform->TransformPoint( point );
+          if( ( this->m_FixedImageMask.IsNotNull() && !this->m_FixedImageMask->IsInside( fixedPoint ) ) ||
+              !this->m_FixedInterpolator->IsInsideBuffer( fixedPoint ) ){
+            open = false;
+            continue;
+          }
+
+          if( !open ){
+            Run run;
+            run.row = y;
+            run.column = x;
+            run.n = 0;
+            run.offset = m_FixedValues.size();
+            m_Runs.push_back( run );
+            open = true;
+          }
+          m_Runs.back().n++;
+          m_FixedValues.push_back( this->m_FixedInterpolator->Evaluate( fixedPoint ) );
+        }
+      }
+      return true;
+    };
+
+
+    mutable itk::ModifiedTimeType m_PreparedTime;
+    mutable bool m_Prepared;
+
+    mutable std::vector<Run> m_Runs;
+    mutable std::vector<float> m_FixedValues;
+    mutable double m_VirtualOrigin[2];
+    mutable double m_VirtualSpacing[2];
+
+    mutable std::vector<float> m_MovingValues;
+    mutable std::vector<double> m_GradientX;
+    mutable std::vector<double> m_GradientY;
+    mutable int m_MovingWidth;
+    mutable int m_MovingHeight;
+    mutable double m_MovingOrigin[2];
+    mutable double m_MovingSpacing[2];
+    mutable double m_GradientMargin;
+
+};
+
+
+#endif
@@ -0,0 +1,141 @@
+//Generates synthetic B-mode like eye images with known eye and optic nerve
+//geometry, see PhantomGenerator.h.
+//
+//For each phantom an 8-bit image <prefix>.png and the ground truth
+//<prefix>.txt are written. With --count N a set of phantoms
+//<prefix>-000.png, ... is created with consecutive seeds, geometry
+//randomly varied by --jitter and rotations drawn from
+//[-max-rotation, max-rotation] around --rotation.
+
+
+
+#include <tclap/CmdLine.h>
+
+#include <iomanip>
+#include <sstream>
+
+#include "itkMersenneTwisterRandomVariateGenerator.h"
+
+#include "PhantomGenerator.h"
+#include "ImageIO.h"
+
+
+
+int main(int argc, char **argv ){
+
+  //Command line parsing
+  TCLAP::CmdLine cmd("Generate synthetic eye ultrasound phantoms with ground truth", ' ', "1");
+
+  TCLAP::ValueArg<std::string> prefixArg("p","prefix","Prefix for phantom images and ground truth files", true, "",
+      "filename");
+  cmd.add(prefixArg);
+
+  TCLAP::ValueArg<std::string> sizeArg("s","size","Image size", false, "640x480",
+      "WxH");
+  cmd.add(sizeArg);
+
+  TCLAP::ValueArg<double> spacingArg("","spacing","Pixel spacing", false, 1.0,
+      "double");
+  cmd.add(spacingArg);
+
+  TCLAP::ValueArg<double> radiusXArg("","eye-radius-x","Horizontal eye radius as fraction of the image height", false, 0.3,
+      "fraction");
+  cmd.add(radiusXArg);
+
+  TCLAP::ValueArg<double> radiusYArg("","eye-radius-y","Vertical eye radius as fraction of the image height", false, 0.25,
+      "fraction");
+  cmd.add(radiusYArg);
+
+  TCLAP::ValueArg<double> nerveArg("","nerve-width","Optic nerve width as fraction of the image height", false, 0.1,
+      "fraction");
+  cmd.add(nerveArg);
+
+  TCLAP::ValueArg<double> rotationArg("r","rotation","Rotation about the eye center in degrees", false, 0,
+      "degrees");
+  cmd.add(rotationArg);
+
+  TCLAP::ValueArg<double> speckleArg("","speckle","Speckle strength from 0 (none) to 1 (fully developed)", false, 0.3,
+      "double");
+  cmd.add(speckleArg);
+
+  TCLAP::ValueArg<double> blurArg("","blur","Point spread function standard deviation in pixels", false, 1.5,
+      "pixels");
+  cmd.add(blurArg);
+
+  TCLAP::ValueArg<unsigned int> seedArg("","seed","Random seed", false, 0,
+      "unsigned int");
+  cmd.add(seedArg);
+
+  TCLAP::ValueArg<unsigned int> countArg("n","count","Number of phantoms to generate", false, 1,
+      "unsigned int");
+  cmd.add(countArg);
+
+  TCLAP::ValueArg<double> jitterArg("","jitter","Relative random variation of eye radii and nerve width for --count > 1", false, 0.1,
+      "fraction");
+  cmd.add(jitterArg);
+
+  TCLAP::ValueArg<double> maxRotationArg("","max-rotation","Maximal random rotation in degrees for --count > 1", false, 5,
+      "degrees");
+  cmd.add(maxRotationArg);
+
+  try{
+    cmd.parse( argc, argv );
+  }
+  catch (TCLAP::ArgException &e){
+    std::cerr << "error: " << e.error() << " for arg " << e.argId() << std::endl;
+    return -1;
+  }
+
+  PhantomParameters parameters;
+  char x;
+  std::stringstream sizeStream( sizeArg.getValue() );
+  if( !( sizeStream >> parameters.width >> x >> parameters.height ) || x != 'x' ){
+    std::cerr << "error: invalid size " << sizeArg.getValue() << std::endl;
+    return -1;
+  }
+  parameters.spacing = spacingArg.getValue();
+  parameters.eyeRadiusX = radiusXArg.getValue();
+  parameters.eyeRadiusY = radiusYArg.getValue();
+  parameters.nerveWidth = nerveArg.getValue();
+  parameters.rotation = rotationArg.getValue();
+  parameters.speckle = speckleArg.getValue();
+  parameters.blur = blurArg.getValue();
+
+  unsigned int count = countArg.getValue();
+
+  typedef itk::Statistics::MersenneTwisterRandomVariateGenerator RandomGenerator;
+  RandomGenerator::Pointer random = RandomGenerator::New();
+  random->SetSeed( seedArg.getValue() );
+
+  for(unsigned int i=0; i<count; i++){
+    PhantomParameters p = parameters;
+    p.seed = seedArg.getValue() + i;
+
+    std::string prefix = prefixArg.getValue();
+    if( count > 1 ){
+      double jitter = jitterArg.getValue();
+      p.eyeRadiusX *= 1.0 + jitter * random->GetUniformVariate( -1.0, 1.0 );
+      p.eyeRadiusY *= 1.0 + jitter * random->GetUniformVariate( -1.0, 1.0 );
+      p.nerveWidth *= 1.0 + jitter * random->GetUniformVariate( -1.0, 1.0 );
+      p.rotation += random->GetUniformVariate( -maxRotationArg.getValue(), maxRotationArg.getValue() );
+
+      std::stringstream name;
+      name << prefix << "-" << std::setw(3) << std::setfill('0') << i;
+      prefix = name.str();
+    }
+
+    Phantom phantom = createPhantom( p );
+
+    CastFilter::Pointer castFilter = CastFilter::New();
+    castFilter->SetInput( phantom.image );
+    castFilter->Update();
+    ImageIO<UnsignedCharImageType>::WriteImage( castFilter->GetOutput(), catStrings(prefix, ".png") );
+
+    if( !writePhantomGroundTruth( phantom, catStrings(prefix, ".txt") ) ){
+      std::cerr << "Could not write ground truth " << prefix << ".txt" << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -9,6 +9,7 @@
 #include "itkSubtractImageFilter.h"
 #include "itkAddImageFilter.h"
 #include "itkBinaryThresholdImageFilter.h"
+#include "itkImageDuplicator.h"
 
 template < typename TImage >
 class ITKFilterFunctions{
@@ -47,6 +48,9 @@ class ITKFilterFunctions{
     typedef itk::BinaryThresholdImageFilter <Image, Image> BinaryThresholdFilter;
     typedef typename BinaryThresholdFilter::Pointer BinaryThresholdFilterPointer;
 
+    typedef itk::ImageDuplicator<Image> Duplicator;
+    typedef typename Duplicator::Pointer DuplicatorPointer;
+
   static ImagePointer Rescale(ImagePointer image, PixelType minI, PixelType maxI){
     RescaleFilterPointer rescale = RescaleFilter::New();
     rescale->SetInput(image);
@@ -114,10 +118,97 @@ class ITKFilterFunctions{
     add->Update();
     return add->GetOutput();
   };
+
+
+  //Deep copy of the pixel buffer and geometry
+  static ImagePointer Duplicate(ImagePointer image){
+    DuplicatorPointer duplicator = Duplicator::New();
+    duplicator->SetInputImage(image);
+    duplicator->Update();
+    return duplicator->GetOutput();
+  };
+
+  //Shallow copy sharing the pixel buffer, without the pipeline of image.
+  //Concurrent readers of an image each need their own view, updating a
+  //filter sets the requested region of its input.
+  static ImagePointer View(ImagePointer image){
+    ImagePointer view = Image::New();
+    view->Graft( image );
+    return view;
+  };
   
 
 
 
+  //In-place variants of the pointwise operations above. The output reuses
+  //the pixel buffer of the input (ITK InPlaceImageFilter semantics), the
+  //input image is released and must not be used afterwards. Use as
+  //  image = ITKFilterFunctions<Image>::RescaleInPlace(image, 0, 100);
+
+  static ImagePointer RescaleInPlace(ImagePointer image, PixelType minI, PixelType maxI){
+    RescaleFilterPointer rescale = RescaleFilter::New();
+    rescale->SetInput(image);
+    rescale->SetOutputMaximum( maxI );
+    rescale->SetOutputMinimum( minI );
+    rescale->InPlaceOn();
+    rescale->Update();
+
+    return rescale->GetOutput();
+  };
+
+
+  static ImagePointer ThresholdAboveInPlace(ImagePointer image, PixelType t, PixelType outside){
+    ThresholdFilterPointer thresholdFilter  = ThresholdFilter::New();
+    thresholdFilter->SetInput( image);
+    thresholdFilter->ThresholdAbove( t );
+    thresholdFilter->SetOutsideValue( outside );
+    thresholdFilter->InPlaceOn();
+    thresholdFilter->Update();
+    return thresholdFilter->GetOutput();
+  };
+
+
+  static ImagePointer ThresholdBelowInPlace(ImagePointer image, PixelType t, PixelType outside){
+    ThresholdFilterPointer thresholdFilter  = ThresholdFilter::New();
+    thresholdFilter->SetInput( image);
+    thresholdFilter->ThresholdBelow( t );
+    thresholdFilter->SetOutsideValue( outside );
+    thresholdFilter->InPlaceOn();
+    thresholdFilter->Update();
+    return thresholdFilter->GetOutput();
+  };
+
+  static ImagePointer BinaryThresholdInPlace(ImagePointer image, PixelType tLow, PixelType tHigh, PixelType inside, PixelType outside){
+    BinaryThresholdFilterPointer thresholdFilter  = BinaryThresholdFilter::New();
+    thresholdFilter->SetInput( image);
+    thresholdFilter->SetLowerThreshold( tLow );
+    thresholdFilter->SetUpperThreshold( tHigh );
+    thresholdFilter->SetOutsideValue( outside );
+    thresholdFilter->SetInsideValue( inside );
+    thresholdFilter->InPlaceOn();
+    thresholdFilter->Update();
+    return thresholdFilter->GetOutput();
+  };
+
+  //The result is stored in the buffer of i1
+  static ImagePointer SubtractInPlace(ImagePointer i1, ImagePointer i2){
+    SubtractFilterPointer subtract = SubtractFilter::New();
+    subtract->SetInput1(i1);
+    subtract->SetInput2(i2);
+    subtract->InPlaceOn();
+    subtract->Update();
+    return subtract->GetOutput();
+  };
+
+  //The result is stored in the buffer of i1
+  static ImagePointer AddInPlace(ImagePointer i1, ImagePointer i2){
+    AddFilterPointer add = AddFilter::New();
+    add->SetInput1(i1);
+    add->SetInput2(i2);
+    add->InPlaceOn();
+    add->Update();
+    return add->GetOutput();
+  };
 
 
 
@@ -0,0 +1,476 @@
+#ifndef ITKPIPELINE_H
+#define ITKPIPELINE_H
+
+//Small lazy pipeline layer on top of ITK.
+//
+//Stages are declared first and executed together by a single Update call.
+//Nothing is computed while the pipeline is built, so ITK's requested region
+//mechanism can restrict the work to the pixels a consumer actually asks for,
+//e.g. a slab extracted with Extract only pulls the slab through the stages
+//before it.
+//
+//Adjacent pointwise stages (Rescale, thresholds, borders) are fused into a
+//single pass over the image. Values are identical to running the
+//corresponding ITKFilterFunctions helpers one after the other.
+
+
+#include "itkImage.h"
+#include "itkInPlaceImageFilter.h"
+#include "itkImageScanlineIterator.h"
+#include "itkImageScanlineConstIterator.h"
+#include "itkNumericTraits.h"
+#include "itkSmoothingRecursiveGaussianImageFilter.h"
+#include "itkRegionOfInterestImageFilter.h"
+#include "itkSubtractImageFilter.h"
+#include "itkAddImageFilter.h"
+
+#include <vector>
+#include <algorithm>
+
+
+//Description of a single pointwise stage
+struct PointwiseOperation{
+  enum Type{
+    RESCALE,
+    THRESHOLD,
+    BINARY_THRESHOLD,
+    HORIZONTAL_BORDER,
+    VERTICAL_BORDER
+  };
+
+  Type type;
+
+  //Threshold interval or output range for rescale
+  double lower;
+  double upper;
+  double inside;
+  double outside;
+  //Border width
+  int width;
+
+  //Linear transform of a rescale, computed when the stage executes
+  double scale;
+  double shift;
+
+  PointwiseOperation(Type t) : type(t), lower(0), upper(0), inside(0),
+                               outside(0), width(0), scale(1), shift(0) {};
+};
+
+
+
+//Applies a sequence of pointwise operations in one pass. Rescale operations
+//need the range of their input, which is computed in a reduction pass over
+//the preceding operations before the main pass; no intermediate image is
+//created.
+template< typename TImage >
+class FusedPointwiseImageFilter : public itk::InPlaceImageFilter< TImage, TImage >{
+
+  public:
+
+    typedef FusedPointwiseImageFilter Self;
+    typedef itk::InPlaceImageFilter< TImage, TImage > Superclass;
+    typedef itk::SmartPointer< Self > Pointer;
+    typedef itk::SmartPointer< const Self > ConstPointer;
+
+    itkNewMacro(Self);
+    itkTypeMacro(FusedPointwiseImageFilter, InPlaceImageFilter);
+
+    typedef TImage Image;
+    typedef typename Image::IndexType ImageIndex;
+    typedef typename Image::PixelType PixelType;
+    typedef typename Image::RegionType ImageRegion;
+    typedef typename ImageRegion::SizeType ImageSize;
+    typedef typename itk::NumericTraits< PixelType >::RealType RealType;
+
+    typedef itk::ImageScanlineConstIterator< Image > InputIterator;
+    typedef itk::ImageScanlineIterator< Image > OutputIterator;
+
+    void SetOperations(const std::vector<PointwiseOperation> &operations){
+      m_Operations = operations;
+      this->Modified();
+    };
+
+    const std::vector<PointwiseOperation> &GetOperations() const{
+      return m_Operations;
+    };
+
+
+  protected:
+
+    FusedPointwiseImageFilter(){
+      this->InPlaceOff();
+    };
+
+    virtual ~FusedPointwiseImageFilter(){};
+
+
+    //A rescale depends on the range of the whole input, same as
+    //RescaleIntensityImageFilter
+    virtual void GenerateInputRequestedRegion(){
+      Superclass::GenerateInputRequestedRegion();
+      if( HasRescale() ){
+        Image *input = const_cast< Image * >( this->GetInput() );
+        if( input ){
+          input->SetRequestedRegionToLargestPossibleRegion();
+        }
+      }
+    };
+
+
+    virtual void BeforeThreadedGenerateData(){
+      const Image *input = this->GetInput();
+      m_Largest = input->GetLargestPossibleRegion();
+
+      for(unsigned int k=0; k<m_Operations.size(); k++){
+        PointwiseOperation &op = m_Operations[k];
+        if(op.type != PointwiseOperation::RESCALE){
+          continue;
+        }
+
+        //Range of the input to this operation
+        PixelType minI = itk::NumericTraits< PixelType >::max();
+        PixelType maxI = itk::NumericTraits< PixelType >::NonpositiveMin();
+        InputIterator it( input, input->GetRequestedRegion() );
+        while( !it.IsAtEnd() ){
+          ImageIndex index = it.GetIndex();
+          while( !it.IsAtEndOfLine() ){
+            PixelType value = Evaluate( it.Get(), index, k );
+            minI = std::min( value, minI );
+            maxI = std::max( value, maxI );
+            ++it;
+            ++index[0];
+          }
+          it.NextLine();
+        }
+
+        //Same as RescaleIntensityImageFilter
+        RealType outMin = static_cast< RealType >( static_cast< PixelType >( op.lower ) );
+        RealType outMax = static_cast< RealType >( static_cast< PixelType >( op.upper ) );
+        if( minI != maxI ){
+          op.scale = ( outMax - outMin ) /
+                     ( static_cast< RealType >( maxI ) - static_cast< RealType >( minI ) );
+        }
+        else if( maxI != itk::NumericTraits< PixelType >::ZeroValue() ){
+          op.scale = ( outMax - outMin ) / static_cast< RealType >( maxI );
+        }
+        else{
+          op.scale = 0.0;
+        }
+        op.shift = outMin - static_cast< RealType >( minI ) * op.scale;
+      }
+    };
+
+
+    virtual void ThreadedGenerateData(const ImageRegion &outputRegionForThread,
+                                      itk::ThreadIdType){
+      const Image *input = this->GetInput();
+      Image *output = this->GetOutput();
+
+      InputIterator inIt( input, outputRegionForThread );
+      OutputIterator outIt( output, outputRegionForThread );
+      while( !inIt.IsAtEnd() ){
+        ImageIndex index = inIt.GetIndex();
+        while( !inIt.IsAtEndOfLine() ){
+          outIt.Set( Evaluate( inIt.Get(), index, m_Operations.size() ) );
+          ++inIt;
+          ++outIt;
+          ++index[0];
+        }
+        inIt.NextLine();
+        outIt.NextLine();
+      }
+    };
+
+
+  private:
+
+    bool HasRescale() const{
+      for(unsigned int k=0; k<m_Operations.size(); k++){
+        if( m_Operations[k].type == PointwiseOperation::RESCALE ){
+          return true;
+        }
+      }
+      return false;
+    };
+
+    //Apply the first n operations to value, casting to the pixel type
+    //after each operation like the individual filters do
+    PixelType Evaluate(PixelType value, const ImageIndex &index, unsigned int n) const{
+      const ImageIndex &start = m_Largest.GetIndex();
+      const ImageSize &size = m_Largest.GetSize();
+
+      for(unsigned int k=0; k<n; k++){
+        const PointwiseOperation &op = m_Operations[k];
+        switch( op.type ){
+          case PointwiseOperation::RESCALE:{
+            PixelType outMin = static_cast< PixelType >( op.lower );
+            PixelType outMax = static_cast< PixelType >( op.upper );
+            RealType v = static_cast< RealType >( value ) * op.scale + op.shift;
+            value = static_cast< PixelType >( v );
+            value = ( value > outMax ) ? outMax : value;
+            value = ( value < outMin ) ? outMin : value;
+            break;
+          }
+          case PointwiseOperation::THRESHOLD:{
+            if( !( static_cast< PixelType >( op.lower ) <= value &&
+                   value <= static_cast< PixelType >( op.upper ) ) ){
+              value = static_cast< PixelType >( op.outside );
+            }
+            break;
+          }
+          case PointwiseOperation::BINARY_THRESHOLD:{
+            if( static_cast< PixelType >( op.lower ) <= value &&
+                value <= static_cast< PixelType >( op.upper ) ){
+              value = static_cast< PixelType >( op.inside );
+            }
+            else{
+              value = static_cast< PixelType >( op.outside );
+            }
+            break;
+          }
+          case PointwiseOperation::HORIZONTAL_BORDER:{
+            long row = index[1] - start[1];
+            if( row < op.width || row >= (long) size[1] - op.width ){
+              value = static_cast< PixelType >( op.inside );
+            }
+            break;
+          }
+          case PointwiseOperation::VERTICAL_BORDER:{
+            long col = index[0] - start[0];
+            if( col < op.width || col >= (long) size[0] - op.width ){
+              value = static_cast< PixelType >( op.inside );
+            }
+            break;
+          }
+        }
+      }
+      return value;
+    };
+
+
+    std::vector<PointwiseOperation> m_Operations;
+    ImageRegion m_Largest;
+
+};
+
+
+
+
+template < typename TImage >
+class ITKPipeline{
+
+  public:
+
+    typedef TImage Image;
+    typedef typename Image::Pointer ImagePointer;
+    typedef typename Image::PixelType PixelType;
+    typedef typename Image::RegionType ImageRegion;
+
+    typedef typename itk::ImageToImageFilter<Image, Image> ImageFilter;
+
+    typedef FusedPointwiseImageFilter<Image> FusedFilter;
+    typedef typename FusedFilter::Pointer FusedFilterPointer;
+
+    typedef typename itk::SmoothingRecursiveGaussianImageFilter<Image, Image> GaussianFilter;
+    typedef typename GaussianFilter::Pointer GaussianFilterPointer;
+    typedef typename GaussianFilter::SigmaArrayType SigmaArrayType;
+
+    typedef typename itk::RegionOfInterestImageFilter<Image, Image> ExtractFilter;
+    typedef typename ExtractFilter::Pointer ExtractFilterPointer;
+
+    typedef typename itk::SubtractImageFilter<Image, Image> SubtractFilter;
+    typedef typename SubtractFilter::Pointer SubtractFilterPointer;
+
+    typedef typename itk::AddImageFilter<Image, Image> AddFilter;
+    typedef typename AddFilter::Pointer AddFilterPointer;
+
+
+  //Start a pipeline on image. If inPlace is set the first stage that can
+  //run in place reuses the buffer of image, which must not be used
+  //afterwards.
+  ITKPipeline(ImagePointer image, bool inPlace = false)
+    : m_Output(image), m_OutputOwned(inPlace) {};
+
+
+  //-- Pointwise stages, fused into a single pass
+
+  ITKPipeline &Rescale(PixelType minI, PixelType maxI){
+    PointwiseOperation op(PointwiseOperation::RESCALE);
+    op.lower = minI;
+    op.upper = maxI;
+    m_Pending.push_back(op);
+    return *this;
+  };
+
+  ITKPipeline &ThresholdAbove(PixelType t, PixelType outside){
+    PointwiseOperation op(PointwiseOperation::THRESHOLD);
+    op.lower = itk::NumericTraits< PixelType >::NonpositiveMin();
+    op.upper = t;
+    op.outside = outside;
+    m_Pending.push_back(op);
+    return *this;
+  };
+
+  ITKPipeline &ThresholdBelow(PixelType t, PixelType outside){
+    PointwiseOperation op(PointwiseOperation::THRESHOLD);
+    op.lower = t;
+    op.upper = itk::NumericTraits< PixelType >::max();
+    op.outside = outside;
+    m_Pending.push_back(op);
+    return *this;
+  };
+
+  ITKPipeline &BinaryThreshold(PixelType tLow, PixelType tHigh, PixelType inside, PixelType outside){
+    PointwiseOperation op(PointwiseOperation::BINARY_THRESHOLD);
+    op.lower = tLow;
+    op.upper = tHigh;
+    op.inside = inside;
+    op.outside = outside;
+    m_Pending.push_back(op);
+    return *this;
+  };
+
+  //Same as ITKFilterFunctions::AddHorizontalBorder
+  ITKPipeline &AddHorizontalBorder(int w, PixelType value = 100){
+    PointwiseOperation op(PointwiseOperation::HORIZONTAL_BORDER);
+    op.width = w;
+    op.inside = value;
+    m_Pending.push_back(op);
+    return *this;
+  };
+
+  //Same as ITKFilterFunctions::AddVerticalBorder
+  ITKPipeline &AddVerticalBorder(int w, PixelType value = 100){
+    PointwiseOperation op(PointwiseOperation::VERTICAL_BORDER);
+    op.width = w;
+    op.inside = value;
+    m_Pending.push_back(op);
+    return *this;
+  };
+
+
+
+  //-- Other stages
+
+  ITKPipeline &GaussSmooth(SigmaArrayType sigma){
+    GaussianFilterPointer smooth = GaussianFilter::New();
+    smooth->SetSigmaArray( sigma );
+    AddStage( smooth );
+    return *this;
+  };
+
+  ITKPipeline &Extract(const ImageRegion &region){
+    ExtractFilterPointer extract = ExtractFilter::New();
+    extract->SetRegionOfInterest( region );
+    AddStage( extract );
+    return *this;
+  };
+
+  //Subtract image from the current stage
+  ITKPipeline &Subtract(ImagePointer image){
+    SubtractFilterPointer subtract = SubtractFilter::New();
+    subtract->SetInput2( image );
+    AddStage( subtract, true );
+    return *this;
+  };
+
+  ITKPipeline &Add(ImagePointer image){
+    AddFilterPointer add = AddFilter::New();
+    add->SetInput2( image );
+    AddStage( add, true );
+    return *this;
+  };
+
+  //Append an arbitrary, fully configured filter, e.g. a morphological
+  //closing
+  ITKPipeline &Apply(ImageFilter *filter){
+    AddStage( filter );
+    return *this;
+  };
+
+
+
+  //Output of the last declared stage, not yet computed. The image is
+  //considered referenced by the caller and is not overwritten by
+  //subsequent in-place stages.
+  ImagePointer GetOutput(){
+    Flush();
+    m_OutputOwned = false;
+    return m_Output;
+  };
+
+  //Execute all stages for the whole output
+  ImagePointer Update(){
+    Flush();
+    m_Output->UpdateOutputInformation();
+    return Update( m_Output->GetLargestPossibleRegion() );
+  };
+
+  //Execute the stages needed to compute region of the output only
+  ImagePointer Update(const ImageRegion &region){
+    Flush();
+    m_Output->UpdateOutputInformation();
+    m_Output->SetRequestedRegion( region );
+    m_Output->PropagateRequestedRegion();
+    m_Output->UpdateOutputData();
+    return m_Output;
+  };
+
+
+
+  private:
+
+    //Connect filter to the current output. Pending pointwise stages are
+    //flushed first.
+    void AddStage(ImageFilter *filter, bool canRunInPlace = false){
+      Flush();
+      Connect( filter );
+      if( canRunInPlace ){
+        SetInPlace( filter );
+      }
+      m_Output = filter->GetOutput();
+      m_OutputOwned = true;
+    };
+
+
+    void Flush(){
+      if( m_Pending.empty() ){
+        return;
+      }
+      FusedFilterPointer fused = FusedFilter::New();
+      fused->SetOperations( m_Pending );
+      Connect( fused );
+      SetInPlace( fused );
+      m_Output = fused->GetOutput();
+      m_OutputOwned = true;
+      m_Pending.clear();
+    };
+
+    void Connect(ImageFilter *filter){
+      //Intermediate images only referenced by the pipeline are released
+      //once the next stage consumed them
+      if( m_OutputOwned ){
+        m_Output->ReleaseDataFlagOn();
+      }
+      filter->SetInput( m_Output );
+      m_Stages.push_back( filter );
+    };
+
+    void SetInPlace(ImageFilter *filter){
+      typedef itk::InPlaceImageFilter<Image, Image> InPlaceFilter;
+      InPlaceFilter *inPlace = dynamic_cast< InPlaceFilter * >( filter );
+      if( inPlace ){
+        inPlace->SetInPlace( m_OutputOwned );
+      }
+    };
+
+
+    ImagePointer m_Output;
+    bool m_OutputOwned;
+    std::vector<PointwiseOperation> m_Pending;
+    std::vector< typename ImageFilter::Pointer > m_Stages;
+
+};
+
+
+#endif
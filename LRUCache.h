@@ -0,0 +1,117 @@
+#ifndef LRUCACHE_H
+#define LRUCACHE_H
+
+
+//Thread safe least recently used cache of at most capacity values.
+//
+//Values are copied in and out under a lock, keep large values behind smart
+//pointers. Hits and misses of Get are counted for statistics.
+
+
+#include <list>
+#include <map>
+#include <mutex>
+#include <utility>
+
+
+template <typename TKey, typename TValue>
+class LRUCache{
+
+  public:
+
+  LRUCache(unsigned int capacity = 32) : m_Capacity( capacity ), m_Hits( 0 ), m_Misses( 0 ) {};
+
+
+  //Copies the value of key and marks it most recently used, false if key
+  //is not cached
+  bool Get(const TKey &key, TValue &value){
+    std::lock_guard<std::mutex> lock( m_Mutex );
+    typename Index::iterator it = m_Index.find( key );
+    if( it == m_Index.end() ){
+      m_Misses++;
+      return false;
+    }
+    m_Entries.splice( m_Entries.begin(), m_Entries, it->second );
+    value = it->second->second;
+    m_Hits++;
+    return true;
+  };
+
+
+  //Inserts or replaces the value of key, evicts the least recently used
+  //values beyond the capacity
+  void Put(const TKey &key, const TValue &value){
+    std::lock_guard<std::mutex> lock( m_Mutex );
+    typename Index::iterator it = m_Index.find( key );
+    if( it != m_Index.end() ){
+      it->second->second = value;
+      m_Entries.splice( m_Entries.begin(), m_Entries, it->second );
+      return;
+    }
+    m_Entries.push_front( std::make_pair( key, value ) );
+    m_Index[key] = m_Entries.begin();
+    Evict();
+  };
+
+
+  void SetCapacity(unsigned int capacity){
+    std::lock_guard<std::mutex> lock( m_Mutex );
+    m_Capacity = capacity;
+    Evict();
+  };
+
+  unsigned int GetCapacity() const{
+    std::lock_guard<std::mutex> lock( m_Mutex );
+    return m_Capacity;
+  };
+
+  unsigned int Size() const{
+    std::lock_guard<std::mutex> lock( m_Mutex );
+    return m_Entries.size();
+  };
+
+  void Clear(){
+    std::lock_guard<std::mutex> lock( m_Mutex );
+    m_Entries.clear();
+    m_Index.clear();
+  };
+
+
+  unsigned long NumberOfHits() const{
+    std::lock_guard<std::mutex> lock( m_Mutex );
+    return m_Hits;
+  };
+
+  unsigned long NumberOfMisses() const{
+    std::lock_guard<std::mutex> lock( m_Mutex );
+    return m_Misses;
+  };
+
+
+
+  private:
+
+    typedef std::list< std::pair<TKey, TValue> > Entries;
+    typedef std::map<TKey, typename Entries::iterator> Index;
+
+
+    //Requires the lock
+    void Evict(){
+      while( m_Entries.size() > m_Capacity ){
+        m_Index.erase( m_Entries.back().first );
+        m_Entries.pop_back();
+      }
+    };
+
+
+    mutable std::mutex m_Mutex;
+    unsigned int m_Capacity;
+    unsigned long m_Hits;
+    unsigned long m_Misses;
+    Entries m_Entries;
+    Index m_Index;
+
+};
+
+
+#endif
@@ -0,0 +1,144 @@
+//Stand-in for a frame grabber to test EstimateEyeAndStemLive.
+//
+//Creates the frame and result rings, publishes the given images in turn
+//at a fixed frame rate and collects the results. Reports the latency from
+//frame acquisition to the result being written and to the result being
+//seen by the grabber, e.g.
+//  LiveFrameProducer -i eye.png --fps 30 -n 300 &
+//  EstimateEyeAndStemLive -n 0
+
+
+
+#include <tclap/CmdLine.h>
+
+#include <thread>
+#include <algorithm>
+
+#include "EyeAndStemFitting.h"
+#include "LiveFrames.h"
+#include "ImageIO.h"
+
+
+
+//Latency percentile in milliseconds
+double percentile(std::vector<double> values, double p){
+  if( values.empty() ){
+    return 0;
+  }
+  std::sort( values.begin(), values.end() );
+  return values[ std::min( values.size() - 1, (size_t) ( p * values.size() ) ) ];
+};
+
+
+
+int main(int argc, char **argv ){
+
+  //Command line parsing
+  TCLAP::CmdLine cmd("Publish ultrasound images as live frames in shared memory", ' ', "1");
+
+  TCLAP::MultiArg<std::string> imageArg("i","image","Frame image, repeat to publish several images in turn", true,
+      "filename");
+  cmd.add(imageArg);
+
+  TCLAP::ValueArg<std::string> framesArg("f","frames","Name of the shared memory frame ring", false, "/ons-frames",
+      "name");
+  cmd.add(framesArg);
+
+  TCLAP::ValueArg<std::string> resultsArg("r","results","Name of the shared memory result ring", false, "/ons-results",
+      "name");
+  cmd.add(resultsArg);
+
+  TCLAP::ValueArg<unsigned int> countArg("n","count","Number of frames to publish", false, 300,
+      "unsigned int");
+  cmd.add(countArg);
+
+  TCLAP::ValueArg<double> fpsArg("","fps","Frames per second", false, 30,
+      "double");
+  cmd.add(fpsArg);
+
+  TCLAP::ValueArg<unsigned int> slotsArg("","slots","Number of slots of the frame ring", false, 4,
+      "unsigned int");
+  cmd.add(slotsArg);
+
+  TCLAP::SwitchArg uint16Arg("","uint16","Publish 16 bit instead of 8 bit pixels" );
+  cmd.add(uint16Arg);
+
+  try{
+    cmd.parse( argc, argv );
+  }
+  catch (TCLAP::ArgException &e){
+    std::cerr << "error: " << e.error() << " for arg " << e.argId() << std::endl;
+    return -1;
+  }
+
+
+  std::vector<ImageType::Pointer> images;
+  uint64_t frameBytes = 0;
+  uint32_t pixelType = uint16Arg.getValue() ? FRAME_UINT16 : FRAME_UINT8;
+  for(unsigned int i=0; i<imageArg.getValue().size(); i++){
+    images.push_back( ImageIO<ImageType>::ReadImage( imageArg.getValue()[i] ) );
+    ImageType::SizeType size = images.back()->GetLargestPossibleRegion().GetSize();
+    frameBytes = std::max( frameBytes, LiveFrames<ImageType>::FrameBytes( size[0], size[1], pixelType ) );
+  }
+
+  std::unique_ptr<SharedRing> frames = SharedRing::Create( framesArg.getValue(), slotsArg.getValue(), frameBytes );
+  std::unique_ptr<SharedRing> results = SharedRing::Create( resultsArg.getValue(), 64, sizeof(FrameResult) );
+  if( !frames || !results ){
+    std::cerr << "error: could not create the shared memory rings" << std::endl;
+    return -1;
+  }
+
+
+  //Results are collected while publishing and for a second afterwards
+  std::vector<double> processingLatency;
+  std::vector<double> roundTripLatency;
+  std::vector<double> widths;
+  uint64_t lastResult = 0;
+  auto collect = [&](){
+    uint64_t newest = results->Newest();
+    for(uint64_t s = std::max( lastResult + 1, newest > 64 ? newest - 63 : 1 ); s <= newest; s++){
+      FrameResult result;
+      if( readFrameResult( *results, s, result ) ){
+        int64_t now = monotonicNanoseconds();
+        processingLatency.push_back( ( result.resultTimestamp - result.frameTimestamp ) / 1e6 );
+        roundTripLatency.push_back( ( now - result.frameTimestamp ) / 1e6 );
+        if( result.status == FIT_OK ){
+          widths.push_back( result.stemWidth );
+        }
+      }
+    }
+    lastResult = newest;
+  };
+
+  std::chrono::duration<double> period( 1.0 / fpsArg.getValue() );
+  std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+  for(unsigned int i=0; i<countArg.getValue(); i++){
+    std::this_thread::sleep_until( next );
+    next += std::chrono::duration_cast<std::chrono::steady_clock::duration>( period );
+    LiveFrames<ImageType>::Write( *frames, images[ i % images.size() ], pixelType,
+                                  i, monotonicNanoseconds() );
+    collect();
+  }
+  frames->Close();
+
+  int64_t end = monotonicNanoseconds() + 1000000000ll;
+  while( monotonicNanoseconds() < end ){
+    collect();
+    std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+  }
+
+
+  std::cout << "Published " << countArg.getValue() << " frames, received "
+            << processingLatency.size() << " results" << std::endl;
+  std::cout << "Frame to result latency (ms): median " << percentile( processingLatency, 0.5 )
+            << ", 95% " << percentile( processingLatency, 0.95 )
+            << ", max " << percentile( processingLatency, 1 ) << std::endl;
+  std::cout << "Frame to grabber latency (ms): median " << percentile( roundTripLatency, 0.5 )
+            << ", 95% " << percentile( roundTripLatency, 0.95 )
+            << ", max " << percentile( roundTripLatency, 1 ) << std::endl;
+  if( !widths.empty() ){
+    std::cout << "Median optic nerve width: " << percentile( widths, 0.5 ) << std::endl;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,223 @@
+#ifndef LIVEFRAMES_H
+#define LIVEFRAMES_H
+
+
+//Frame and result rings for live processing of scanner frames, see
+//SharedRing.h and EstimateEyeAndStemLive.
+//
+//A frame grabber creates a frame ring and a result ring and writes each
+//frame as a FrameHeader followed by the pixels in row order. The fitting
+//process reads the newest frame, converting the pixels to float in a
+//single pass directly from the shared mapping, and writes a FrameResult
+//per processed frame. Timestamps are nanoseconds of the monotonic clock,
+//which is shared by all processes of a machine.
+
+
+#include <chrono>
+#include <cstdint>
+
+#include "itkImage.h"
+
+#include "SharedRing.h"
+
+
+enum FramePixelType{
+  FRAME_UINT8 = 1,
+  FRAME_UINT16 = 2,
+  FRAME_FLOAT32 = 3
+};
+
+
+struct FrameHeader{
+  uint32_t width;
+  uint32_t height;
+  uint32_t pixelType;
+  uint32_t reserved;
+  double spacing[2];
+  double origin[2];
+  //Acquisition time
+  int64_t timestamp;
+  //Numbering of the grabber, the ring has its own sequence numbers
+  uint64_t frameNumber;
+};
+
+
+struct FrameResult{
+  //Ring sequence number and number of the processed frame
+  uint64_t frameSequence;
+  uint64_t frameNumber;
+  int64_t frameTimestamp;
+  //Time the result was written
+  int64_t resultTimestamp;
+  //FitStatus
+  int32_t status;
+  int32_t reserved;
+  double eyeCenter[2];
+  double eyeMinor;
+  double eyeMajor;
+  double stemCenter[2];
+  //Optic nerve width as reported by EstimateEyeAndStem
+  double stemWidth;
+};
+
+
+
+inline int64_t monotonicNanoseconds(){
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+           std::chrono::steady_clock::now().time_since_epoch() ).count();
+};
+
+
+inline uint64_t framePixelBytes(uint32_t pixelType){
+  switch( pixelType ){
+    case FRAME_UINT8: return 1;
+    case FRAME_UINT16: return 2;
+    case FRAME_FLOAT32: return 4;
+  }
+  return 0;
+};
+
+
+
+template <typename TImage>
+class LiveFrames{
+
+  public:
+
+    typedef TImage Image;
+    typedef typename Image::Pointer ImagePointer;
+    typedef typename Image::PixelType PixelType;
+
+
+  //Read the newest frame if it is newer than lastSequence into image,
+  //which is reallocated only if the frame size changes. Returns the
+  //sequence number of the frame or 0 if there is no new complete frame.
+  static uint64_t ReadNewest(const SharedRing &ring, uint64_t lastSequence,
+                             ImagePointer &image, FrameHeader &header){
+    uint64_t sequence = ring.Newest();
+    if( sequence <= lastSequence ){
+      return 0;
+    }
+    const unsigned char *payload = ring.BeginRead( sequence );
+    if( payload == NULL ){
+      return 0;
+    }
+    std::memcpy( &header, payload, sizeof(FrameHeader) );
+    uint64_t bytes = framePixelBytes( header.pixelType ) * header.width * header.height;
+    if( bytes == 0 || sizeof(FrameHeader) + bytes > ring.PayloadBytes() ){
+      return 0;
+    }
+
+    typename Image::SizeType size;
+    size[0] = header.width;
+    size[1] = header.height;
+    if( image.IsNull() || image->GetLargestPossibleRegion().GetSize() != size ){
+      image = Image::New();
+      image->SetRegions( typename Image::RegionType( size ) );
+      image->Allocate();
+    }
+    image->SetSpacing( header.spacing );
+    image->SetOrigin( header.origin );
+
+    const unsigned char *pixels = payload + sizeof(FrameHeader);
+    PixelType *buffer = image->GetBufferPointer();
+    uint64_t n = (uint64_t) header.width * header.height;
+    switch( header.pixelType ){
+      case FRAME_UINT8:
+        Convert( (const uint8_t *) pixels, buffer, n );
+        break;
+      case FRAME_UINT16:
+        Convert( (const uint16_t *) pixels, buffer, n );
+        break;
+      case FRAME_FLOAT32:
+        Convert( (const float *) pixels, buffer, n );
+        break;
+    }
+
+    //Overwritten by the grabber while converting
+    if( !ring.EndRead( sequence ) ){
+      return 0;
+    }
+    return sequence;
+  };
+
+
+  //Write a frame of pixelType from the pixels of image
+  static uint64_t Write(SharedRing &ring, ImagePointer image, uint32_t pixelType,
+                        uint64_t frameNumber, int64_t timestamp){
+    typename Image::SizeType size = image->GetLargestPossibleRegion().GetSize();
+    FrameHeader header;
+    header.width = size[0];
+    header.height = size[1];
+    header.pixelType = pixelType;
+    header.reserved = 0;
+    for(unsigned int i=0; i<2; i++){
+      header.spacing[i] = image->GetSpacing()[i];
+      header.origin[i] = image->GetOrigin()[i];
+    }
+    header.timestamp = timestamp;
+    header.frameNumber = frameNumber;
+
+    uint64_t sequence;
+    unsigned char *payload = ring.BeginWrite( sequence );
+    std::memcpy( payload, &header, sizeof(FrameHeader) );
+    unsigned char *pixels = payload + sizeof(FrameHeader);
+    const PixelType *buffer = image->GetBufferPointer();
+    uint64_t n = (uint64_t) header.width * header.height;
+    switch( pixelType ){
+      case FRAME_UINT8:
+        Convert( buffer, (uint8_t *) pixels, n );
+        break;
+      case FRAME_UINT16:
+        Convert( buffer, (uint16_t *) pixels, n );
+        break;
+      case FRAME_FLOAT32:
+        Convert( buffer, (float *) pixels, n );
+        break;
+    }
+    ring.EndWrite( sequence );
+    return sequence;
+  };
+
+
+  //Payload size of frames of the given size
+  static uint64_t FrameBytes(uint32_t width, uint32_t height, uint32_t pixelType){
+    return sizeof(FrameHeader) + framePixelBytes( pixelType ) * width * height;
+  };
+
+
+
+  private:
+
+    template <typename TIn, typename TOut>
+    static void Convert(const TIn *in, TOut *out, uint64_t n){
+      for(uint64_t i=0; i<n; i++){
+        out[i] = static_cast<TOut>( in[i] );
+      }
+    };
+
+};
+
+
+
+inline void writeFrameResult(SharedRing &ring, const FrameResult &result){
+  uint64_t sequence;
+  unsigned char *payload = ring.BeginWrite( sequence );
+  std::memcpy( payload, &result, sizeof(FrameResult) );
+  ring.EndWrite( sequence );
+};
+
+
+//Read the result with the given sequence number, false if it is not
+//written yet or already overwritten
+inline bool readFrameResult(const SharedRing &ring, uint64_t sequence, FrameResult &result){
+  const unsigned char *payload = ring.BeginRead( sequence );
+  if( payload == NULL ){
+    return false;
+  }
+  std::memcpy( &result, payload, sizeof(FrameResult) );
+  return ring.EndRead( sequence );
+};
+
+
+#endif
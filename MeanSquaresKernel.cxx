@@ -0,0 +1,275 @@
+#include "MeanSquaresKernel.h"
+
+#include <algorithm>
+
+#if defined(__GNUC__) && ( defined(__x86_64__) || defined(__i386__) )
+#define MEANSQUARES_AVX2
+#include <immintrin.h>
+#endif
+
+
+
+void centralDifferencePlanes(const float *image, int width, int height,
+                             double spacingX, double spacingY,
+                             std::vector<double> &gradientX, std::vector<double> &gradientY){
+  gradientX.resize( (size_t) width * height );
+  gradientY.resize( (size_t) width * height );
+  double sx = 0.5 / spacingX;
+  double sy = 0.5 / spacingY;
+  for(int y=0; y<height; y++){
+    int yPrevious = std::max( y - 1, 0 );
+    int yNext = std::min( y + 1, height - 1 );
+    const float *row = image + (size_t) y * width;
+    const float *previous = image + (size_t) yPrevious * width;
+    const float *next = image + (size_t) yNext * width;
+    double *gx = &gradientX[ (size_t) y * width ];
+    double *gy = &gradientY[ (size_t) y * width ];
+    for(int x=0; x<width; x++){
+      int xPrevious = std::max( x - 1, 0 );
+      int xNext = std::min( x + 1, width - 1 );
+      gx[x] = ( (double) row[xNext] - row[xPrevious] ) * sx;
+      gy[x] = ( (double) next[x] - previous[x] ) * sy;
+    }
+  }
+};
+
+
+
+void accumulateMeanSquaresScalar(const MeanSquaresMoving &moving, const MeanSquaresRun &run,
+                                 MeanSquaresSums &sums){
+  const int width = moving.width;
+  const int height = moving.height;
+  const double maxX = width - 1;
+  const double maxY = height - 1;
+  const double lowerGradient = moving.gradientMargin - 0.5;
+  const double upperGradientX = width - 0.5 - moving.gradientMargin;
+  const double upperGradientY = height - 0.5 - moving.gradientMargin;
+  for(unsigned int i=0; i<run.n; i++){
+    double cx = run.x + i * run.stepX;
+    double cy = run.y + i * run.stepY;
+    //Inside the moving image as in itk::ImageFunction::IsInsideBuffer
+    if( !( cx >= -0.5 && cx < width - 0.5 && cy >= -0.5 && cy < height - 0.5 ) ){
+      continue;
+    }
+
+    //Clamped to the border pixels as in itk::LinearInterpolateImageFunction
+    double px = std::min( std::max( cx, 0.0 ), maxX );
+    double py = std::min( std::max( cy, 0.0 ), maxY );
+    double x0 = std::min( (double) (int) px, maxX - 1 );
+    double y0 = std::min( (double) (int) py, maxY - 1 );
+    double fx = px - x0;
+    double fy = py - y0;
+    size_t k = (size_t) y0 * width + (size_t) x0;
+
+    const float *v = moving.values + k;
+    double value = ( v[0] * ( 1 - fx ) + v[1] * fx ) * ( 1 - fy ) +
+                   ( v[width] * ( 1 - fx ) + v[width + 1] * fx ) * fy;
+
+    double gx = 0;
+    if( cx >= lowerGradient && cx < upperGradientX ){
+      const double *g = moving.gradientX + k;
+      gx = ( g[0] * ( 1 - fx ) + g[1] * fx ) * ( 1 - fy ) +
+           ( g[width] * ( 1 - fx ) + g[width + 1] * fx ) * fy;
+    }
+    double gy = 0;
+    if( cy >= lowerGradient && cy < upperGradientY ){
+      const double *g = moving.gradientY + k;
+      gy = ( g[0] * ( 1 - fx ) + g[1] * fx ) * ( 1 - fy ) +
+           ( g[width] * ( 1 - fx ) + g[width + 1] * fx ) * fy;
+    }
+
+    double diff = run.fixed[i] - value;
+    double w = 2 * diff;
+    double qx = run.qx + i * run.stepQ;
+    double wgx = w * gx;
+    double wgy = w * gy;
+    sums.value += diff * diff;
+    sums.g[0] += wgx;
+    sums.g[1] += wgy;
+    sums.gq[0] += wgx * qx;
+    sums.gq[1] += wgx * run.qy;
+    sums.gq[2] += wgy * qx;
+    sums.gq[3] += wgy * run.qy;
+    sums.count++;
+  }
+};
+
+
+
+#ifdef MEANSQUARES_AVX2
+
+__attribute__((target("avx2")))
+static inline __m256d bilinear(__m256d v00, __m256d v01, __m256d v10, __m256d v11,
+                               __m256d fx, __m256d fy, __m256d one){
+  __m256d gx = _mm256_sub_pd( one, fx );
+  __m256d gy = _mm256_sub_pd( one, fy );
+  __m256d top = _mm256_add_pd( _mm256_mul_pd( v00, gx ), _mm256_mul_pd( v01, fx ) );
+  __m256d bottom = _mm256_add_pd( _mm256_mul_pd( v10, gx ), _mm256_mul_pd( v11, fx ) );
+  return _mm256_add_pd( _mm256_mul_pd( top, gy ), _mm256_mul_pd( bottom, fy ) );
+};
+
+
+//Bilinear samples at the indices k of the upper left pixels
+__attribute__((target("avx2")))
+static inline __m256d gatherBilinear(const float *image, __m128i k, int width,
+                                     __m256d fx, __m256d fy, __m256d one){
+  __m128i kBelow = _mm_add_epi32( k, _mm_set1_epi32( width ) );
+  return bilinear( _mm256_cvtps_pd( _mm_i32gather_ps( image, k, 4 ) ),
+                   _mm256_cvtps_pd( _mm_i32gather_ps( image + 1, k, 4 ) ),
+                   _mm256_cvtps_pd( _mm_i32gather_ps( image, kBelow, 4 ) ),
+                   _mm256_cvtps_pd( _mm_i32gather_ps( image + 1, kBelow, 4 ) ),
+                   fx, fy, one );
+};
+
+__attribute__((target("avx2")))
+static inline __m256d gatherBilinear(const double *plane, __m128i k, int width,
+                                     __m256d fx, __m256d fy, __m256d one){
+  __m128i kBelow = _mm_add_epi32( k, _mm_set1_epi32( width ) );
+  //Masked gathers with a defined source, the unmasked ones trip
+  //-Wmaybe-uninitialized in some GCC versions
+  __m256d zero = _mm256_setzero_pd();
+  __m256d all = _mm256_castsi256_pd( _mm256_set1_epi64x( -1 ) );
+  return bilinear( _mm256_mask_i32gather_pd( zero, plane, k, all, 8 ),
+                   _mm256_mask_i32gather_pd( zero, plane + 1, k, all, 8 ),
+                   _mm256_mask_i32gather_pd( zero, plane, kBelow, all, 8 ),
+                   _mm256_mask_i32gather_pd( zero, plane + 1, kBelow, all, 8 ),
+                   fx, fy, one );
+};
+
+
+__attribute__((target("avx2")))
+static double horizontalSum(__m256d v){
+  double lanes[4];
+  _mm256_storeu_pd( lanes, v );
+  return ( lanes[0] + lanes[1] ) + ( lanes[2] + lanes[3] );
+};
+
+
+//Four samples per iteration, lanes outside the moving image are clamped
+//for the gathers and masked from the sums
+__attribute__((target("avx2")))
+static void accumulateMeanSquaresAVX2(const MeanSquaresMoving &moving, const MeanSquaresRun &run,
+                                      MeanSquaresSums &sums){
+  const int width = moving.width;
+  const int height = moving.height;
+  const __m256d zero = _mm256_setzero_pd();
+  const __m256d one = _mm256_set1_pd( 1 );
+  const __m256d two = _mm256_set1_pd( 2 );
+  const __m256d maxX = _mm256_set1_pd( width - 1 );
+  const __m256d maxY = _mm256_set1_pd( height - 1 );
+  const __m256d maxX0 = _mm256_set1_pd( width - 2 );
+  const __m256d maxY0 = _mm256_set1_pd( height - 2 );
+  const __m256d lowerBound = _mm256_set1_pd( -0.5 );
+  const __m256d upperX = _mm256_set1_pd( width - 0.5 );
+  const __m256d upperY = _mm256_set1_pd( height - 0.5 );
+  const __m256d lowerGradient = _mm256_set1_pd( moving.gradientMargin - 0.5 );
+  const __m256d upperGradientX = _mm256_set1_pd( width - 0.5 - moving.gradientMargin );
+  const __m256d upperGradientY = _mm256_set1_pd( height - 0.5 - moving.gradientMargin );
+  const __m256d widthD = _mm256_set1_pd( width );
+  const __m256d lane = _mm256_set_pd( 3, 2, 1, 0 );
+  const __m256d x = _mm256_set1_pd( run.x );
+  const __m256d y = _mm256_set1_pd( run.y );
+  const __m256d stepX = _mm256_set1_pd( run.stepX );
+  const __m256d stepY = _mm256_set1_pd( run.stepY );
+  const __m256d qx0 = _mm256_set1_pd( run.qx );
+  const __m256d qy = _mm256_set1_pd( run.qy );
+  const __m256d stepQ = _mm256_set1_pd( run.stepQ );
+
+  __m256d value = zero;
+  __m256d g0 = zero;
+  __m256d g1 = zero;
+  __m256d gq0 = zero;
+  __m256d gq1 = zero;
+  __m256d gq2 = zero;
+  __m256d gq3 = zero;
+  unsigned long count = 0;
+
+  unsigned int i = 0;
+  for(; i + 4 <= run.n; i += 4){
+    __m256d index = _mm256_add_pd( _mm256_set1_pd( i ), lane );
+    __m256d cx = _mm256_add_pd( x, _mm256_mul_pd( index, stepX ) );
+    __m256d cy = _mm256_add_pd( y, _mm256_mul_pd( index, stepY ) );
+    __m256d inside = _mm256_and_pd(
+        _mm256_and_pd( _mm256_cmp_pd( cx, lowerBound, _CMP_GE_OQ ), _mm256_cmp_pd( cx, upperX, _CMP_LT_OQ ) ),
+        _mm256_and_pd( _mm256_cmp_pd( cy, lowerBound, _CMP_GE_OQ ), _mm256_cmp_pd( cy, upperY, _CMP_LT_OQ ) ) );
+    int insideBits = _mm256_movemask_pd( inside );
+    if( insideBits == 0 ){
+      continue;
+    }
+    count += __builtin_popcount( insideBits );
+
+    __m256d px = _mm256_min_pd( _mm256_max_pd( cx, zero ), maxX );
+    __m256d py = _mm256_min_pd( _mm256_max_pd( cy, zero ), maxY );
+    __m256d x0 = _mm256_min_pd( _mm256_floor_pd( px ), maxX0 );
+    __m256d y0 = _mm256_min_pd( _mm256_floor_pd( py ), maxY0 );
+    __m256d fx = _mm256_sub_pd( px, x0 );
+    __m256d fy = _mm256_sub_pd( py, y0 );
+    __m128i k = _mm256_cvtpd_epi32( _mm256_add_pd( _mm256_mul_pd( y0, widthD ), x0 ) );
+
+    __m256d v = gatherBilinear( moving.values, k, width, fx, fy, one );
+    __m256d gx = _mm256_and_pd( gatherBilinear( moving.gradientX, k, width, fx, fy, one ),
+        _mm256_and_pd( _mm256_cmp_pd( cx, lowerGradient, _CMP_GE_OQ ), _mm256_cmp_pd( cx, upperGradientX, _CMP_LT_OQ ) ) );
+    __m256d gy = _mm256_and_pd( gatherBilinear( moving.gradientY, k, width, fx, fy, one ),
+        _mm256_and_pd( _mm256_cmp_pd( cy, lowerGradient, _CMP_GE_OQ ), _mm256_cmp_pd( cy, upperGradientY, _CMP_LT_OQ ) ) );
+
+    __m256d fixed = _mm256_cvtps_pd( _mm_loadu_ps( run.fixed + i ) );
+    __m256d diff = _mm256_and_pd( _mm256_sub_pd( fixed, v ), inside );
+    __m256d w = _mm256_mul_pd( two, diff );
+    __m256d qx = _mm256_add_pd( qx0, _mm256_mul_pd( index, stepQ ) );
+    __m256d wgx = _mm256_mul_pd( w, gx );
+    __m256d wgy = _mm256_mul_pd( w, gy );
+    value = _mm256_add_pd( value, _mm256_mul_pd( diff, diff ) );
+    g0 = _mm256_add_pd( g0, wgx );
+    g1 = _mm256_add_pd( g1, wgy );
+    gq0 = _mm256_add_pd( gq0, _mm256_mul_pd( wgx, qx ) );
+    gq1 = _mm256_add_pd( gq1, _mm256_mul_pd( wgx, qy ) );
+    gq2 = _mm256_add_pd( gq2, _mm256_mul_pd( wgy, qx ) );
+    gq3 = _mm256_add_pd( gq3, _mm256_mul_pd( wgy, qy ) );
+  }
+
+  sums.value += horizontalSum( value );
+  sums.g[0] += horizontalSum( g0 );
+  sums.g[1] += horizontalSum( g1 );
+  sums.gq[0] += horizontalSum( gq0 );
+  sums.gq[1] += horizontalSum( gq1 );
+  sums.gq[2] += horizontalSum( gq2 );
+  sums.gq[3] += horizontalSum( gq3 );
+  sums.count += count;
+
+  //Remaining samples
+  if( i < run.n ){
+    MeanSquaresRun rest = run;
+    rest.x = run.x + i * run.stepX;
+    rest.y = run.y + i * run.stepY;
+    rest.qx = run.qx + i * run.stepQ;
+    rest.fixed = run.fixed + i;
+    rest.n = run.n - i;
+    accumulateMeanSquaresScalar( moving, rest, sums );
+  }
+};
+
+#endif
+
+
+
+bool hasMeanSquaresAVX2(){
+#ifdef MEANSQUARES_AVX2
+  static const bool avx2 = __builtin_cpu_supports( "avx2" );
+  return avx2;
+#else
+  return false;
+#endif
+};
+
+
+
+void accumulateMeanSquares(const MeanSquaresMoving &moving, const MeanSquaresRun &run,
+                           MeanSquaresSums &sums){
+#ifdef MEANSQUARES_AVX2
+  if( hasMeanSquaresAVX2() ){
+    accumulateMeanSquaresAVX2( moving, run, sums );
+    return;
+  }
+#endif
+  accumulateMeanSquaresScalar( moving, run, sums );
+};
@@ -0,0 +1,84 @@
+#ifndef MEANSQUARESKERNEL_H
+#define MEANSQUARESKERNEL_H
+
+
+//Row kernel of FastMeanSquaresMetric, see FastMeanSquaresMetric.h.
+//
+//Accumulates the mean squares value and the sums the derivative of a 2D
+//matrix and offset transform is assembled from, for a run of fixed samples
+//along a row of the virtual domain. The moving image is sampled
+//bilinearly at continuous indices advancing by a constant step, samples
+//outside the moving image are skipped. The moving gradient is sampled the
+//same way from precomputed gradient planes, either copied from a gradient
+//image or built with centralDifferencePlanes.
+//
+//The AVX2 variant processes four samples at a time with the same double
+//precision arithmetic as the scalar variant, it is selected at runtime if
+//the CPU supports it.
+
+
+#include <vector>
+
+
+//Moving image and gradient planes in row order
+struct MeanSquaresMoving{
+  const float *values;
+  const double *gradientX;
+  const double *gradientY;
+  int width;
+  int height;
+  //The gradient is zero closer than this to the border of the inside
+  //region, 1 for central difference planes and 0 for gradient images
+  double gradientMargin;
+};
+
+
+//Run of n consecutive fixed samples of a row
+struct MeanSquaresRun{
+  //Continuous moving index of the first sample and step per sample
+  double x;
+  double y;
+  double stepX;
+  double stepY;
+  //Virtual point of the first sample minus the transform center and step
+  //per sample, rows run along x
+  double qx;
+  double qy;
+  double stepQ;
+  //Fixed values of the samples
+  const float *fixed;
+  unsigned int n;
+};
+
+
+//With w = 2 (fixed - moving) and the moving gradient g: sums of squared
+//differences, w g and w g q
+struct MeanSquaresSums{
+  double value = 0;
+  double g[2] = {0, 0};
+  //w gx qx, w gx qy, w gy qx, w gy qy
+  double gq[4] = {0, 0, 0, 0};
+  unsigned long count = 0;
+};
+
+
+//Planes of the central differences of image divided by twice the spacing,
+//one sided at the borders. Bilinear sampling of the planes equals central
+//differences of the bilinearly interpolated image at +-1 pixel wherever
+//both neighbors are inside the image.
+void centralDifferencePlanes(const float *image, int width, int height,
+                             double spacingX, double spacingY,
+                             std::vector<double> &gradientX, std::vector<double> &gradientY);
+
+
+void accumulateMeanSquares(const MeanSquaresMoving &moving, const MeanSquaresRun &run,
+                           MeanSquaresSums &sums);
+
+void accumulateMeanSquaresScalar(const MeanSquaresMoving &moving, const MeanSquaresRun &run,
+                                 MeanSquaresSums &sums);
+
+//False if the AVX2 kernel is not available on this CPU or build
+bool hasMeanSquaresAVX2();
+
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef MEMORYTRACKER_H
+#define MEMORYTRACKER_H
+
+
+//Accounting of live pixel buffer bytes.
+//
+//The counters are fed by TrackedImportImageContainer, see
+//TrackedImageContainer.h, once it is installed for the pixel types in use.
+//Besides the global high-water mark, watermarks can be pushed to capture
+//the peak while they are active, TraceSpan uses this to report the peak of
+//each stage next to its time.
+
+
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+
+
+class MemoryTracker{
+
+  public:
+
+    //Peak of live bytes while the watermark is pushed
+    struct Watermark{
+      long long peak;
+    };
+
+
+  static MemoryTracker &Instance(){
+    static MemoryTracker tracker;
+    return tracker;
+  };
+
+
+  void SetEnabled(bool enabled){
+    m_Enabled.store( enabled, std::memory_order_relaxed );
+  };
+
+  bool IsEnabled() const{
+    return m_Enabled.load( std::memory_order_relaxed );
+  };
+
+
+  void Allocated(long long bytes){
+    std::lock_guard<std::mutex> lock( m_Mutex );
+    m_Live += bytes;
+    m_TotalAllocated += bytes;
+    m_NumberOfAllocations++;
+    m_Peak = std::max( m_Peak, m_Live );
+    for(unsigned int i=0; i<m_Watermarks.size(); i++){
+      m_Watermarks[i]->peak = std::max( m_Watermarks[i]->peak, m_Live );
+    }
+  };
+
+  void Freed(long long bytes){
+    std::lock_guard<std::mutex> lock( m_Mutex );
+    m_Live -= bytes;
+  };
+
+
+  void PushWatermark(Watermark *watermark){
+    std::lock_guard<std::mutex> lock( m_Mutex );
+    watermark->peak = m_Live;
+    m_Watermarks.push_back( watermark );
+  };
+
+  //Returns the peak since the watermark was pushed
+  long long PopWatermark(Watermark *watermark){
+    std::lock_guard<std::mutex> lock( m_Mutex );
+    std::vector<Watermark *>::iterator it =
+      std::find( m_Watermarks.begin(), m_Watermarks.end(), watermark );
+    if( it != m_Watermarks.end() ){
+      m_Watermarks.erase( it );
+    }
+    return watermark->peak;
+  };
+
+
+  long long Live(){
+    std::lock_guard<std::mutex> lock( m_Mutex );
+    return m_Live;
+  };
+
+  long long Peak(){
+    std::lock_guard<std::mutex> lock( m_Mutex );
+    return m_Peak;
+  };
+
+  long long TotalAllocated(){
+    std::lock_guard<std::mutex> lock( m_Mutex );
+    return m_TotalAllocated;
+  };
+
+  long long NumberOfAllocations(){
+    std::lock_guard<std::mutex> lock( m_Mutex );
+    return m_NumberOfAllocations;
+  };
+
+  //Restart the global high-water mark at the current live bytes
+  void ResetPeak(){
+    std::lock_guard<std::mutex> lock( m_Mutex );
+    m_Peak = m_Live;
+  };
+
+
+
+  private:
+
+    MemoryTracker() : m_Enabled(false), m_Live(0), m_Peak(0),
+                      m_TotalAllocated(0), m_NumberOfAllocations(0) {};
+
+    std::atomic<bool> m_Enabled;
+    std::mutex m_Mutex;
+    long long m_Live;
+    long long m_Peak;
+    long long m_TotalAllocated;
+    long long m_NumberOfAllocations;
+    std::vector<Watermark *> m_Watermarks;
+
+};
+
+
+#endif
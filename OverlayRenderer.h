@@ -0,0 +1,175 @@
+#ifndef OVERLAYRENDERER_H
+#define OVERLAYRENDERER_H
+
+
+#include "itkImage.h"
+#include "itkRGBPixel.h"
+#include "itkNumericTraits.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+//Draws fitted shapes onto an 8-bit RGB copy of an image. The shapes are
+//described by their template geometry and the transform that maps image
+//points into template space, so no intermediate label or float images are
+//needed. The output is produced row by row in a single pass.
+template <typename TImage>
+class OverlayRenderer{
+
+  public:
+
+    typedef TImage Image;
+    typedef typename Image::Pointer ImagePointer;
+    typedef typename Image::IndexType ImageIndex;
+    typedef typename Image::PointType ImagePoint;
+    typedef typename Image::PixelType PixelType;
+    typedef typename Image::RegionType ImageRegion;
+    typedef typename ImageRegion::SizeType ImageSize;
+
+    typedef itk::RGBPixel<unsigned char> RGBPixel;
+    typedef itk::Image<RGBPixel, 2> RGBImage;
+    typedef typename RGBImage::Pointer RGBImagePointer;
+
+
+    //Ellipse ring centered at center with radii radius and
+    //ringFactor * radius. An image point x is mapped into template space by
+    //matrix * x + offset.
+    struct EllipseRing{
+      double center[2];
+      double radius[2];
+      double ringFactor;
+      double matrix[2][2];
+      double offset[2];
+    };
+
+    //Two vertical bars on a template grid with the given origin and spacing.
+    //Bars cover the columns [xStart1, xEnd1) and [xStart2, xEnd2) of the rows
+    //[yStart, yEnd). Only pixels within region of the image are tested. An
+    //image point x is mapped into template space by matrix * x + offset.
+    struct Bars{
+      ImageRegion region;
+      double origin[2];
+      double spacing[2];
+      long yStart;
+      long yEnd;
+      long xStart1;
+      long xEnd1;
+      long xStart2;
+      long xEnd2;
+      double matrix[2][2];
+      double offset[2];
+    };
+
+
+  //Render ring and bars (either may be NULL) in the colors of the ITK label
+  //overlay, blended with the given opacity
+  static RGBImagePointer Render(ImagePointer image, const EllipseRing *ring,
+                                const Bars *bars, double opacity = 0.25){
+
+    ImageRegion region = image->GetBufferedRegion();
+    ImageSize size = region.GetSize();
+    ImageIndex start = region.GetIndex();
+
+    RGBImagePointer overlay = RGBImage::New();
+    overlay->SetRegions( region );
+    overlay->SetOrigin( image->GetOrigin() );
+    overlay->SetSpacing( image->GetSpacing() );
+    overlay->SetDirection( image->GetDirection() );
+    overlay->Allocate();
+
+    //Intensity mapping to 0, 255 as in ITKFilterFunctions::Rescale
+    const PixelType *in = image->GetBufferPointer();
+    const size_t nPixels = region.GetNumberOfPixels();
+    PixelType minI = itk::NumericTraits< PixelType >::max();
+    PixelType maxI = itk::NumericTraits< PixelType >::NonpositiveMin();
+    for(size_t i=0; i<nPixels; i++){
+      minI = std::min( in[i], minI );
+      maxI = std::max( in[i], maxI );
+    }
+    double scale = 0;
+    if( maxI != minI ){
+      scale = 255.0 / ( (double) maxI - (double) minI );
+    }
+
+    //Step in physical space between adjacent columns
+    ImageIndex index = start;
+    ImagePoint p0;
+    ImagePoint p1;
+    image->TransformIndexToPhysicalPoint( index, p0 );
+    index[0] += 1;
+    image->TransformIndexToPhysicalPoint( index, p1 );
+    double step[2] = { p1[0] - p0[0], p1[1] - p0[1] };
+
+    static const unsigned char eyeColor[3]  = { 255, 0, 0 };
+    static const unsigned char stemColor[3] = { 0, 205, 0 };
+
+    RGBPixel *out = overlay->GetBufferPointer();
+    for(unsigned long y=0; y<size[1]; y++){
+      index[0] = start[0];
+      index[1] = start[1] + y;
+      ImagePoint p;
+      image->TransformIndexToPhysicalPoint( index, p );
+
+      bool barRow = bars != NULL &&
+                    index[1] >= bars->region.GetIndex()[1] &&
+                    index[1] < bars->region.GetIndex()[1] + (long) bars->region.GetSize()[1];
+
+      double x[2] = { p[0], p[1] };
+      for(unsigned long i=0; i<size[0]; i++, x[0] += step[0], x[1] += step[1] ){
+        const size_t offset = y * size[0] + i;
+        unsigned char gray = (unsigned char) std::min( 255.0, std::max( 0.0,
+                               ( (double) in[offset] - (double) minI ) * scale ) );
+        RGBPixel &pixel = out[offset];
+        pixel.Fill( gray );
+
+        const unsigned char *color = NULL;
+        if( ring != NULL && OnRing( *ring, x ) ){
+          color = eyeColor;
+        }
+        else if( barRow && OnBars( *bars, x, start[0] + (long) i ) ){
+          color = stemColor;
+        }
+        if( color != NULL ){
+          for(int c=0; c<3; c++){
+            pixel[c] = (unsigned char) ( opacity * color[c] + ( 1.0 - opacity ) * gray );
+          }
+        }
+      }
+    }
+
+    return overlay;
+  };
+
+
+
+  private:
+
+    static bool OnRing(const EllipseRing &ring, const double *x){
+      double d0 = ring.matrix[0][0] * x[0] + ring.matrix[0][1] * x[1] + ring.offset[0] - ring.center[0];
+      double d1 = ring.matrix[1][0] * x[0] + ring.matrix[1][1] * x[1] + ring.offset[1] - ring.center[1];
+      d0 /= ring.radius[0];
+      d1 /= ring.radius[1];
+      double q = d0*d0 + d1*d1;
+      return q >= 1.0 && q <= ring.ringFactor * ring.ringFactor;
+    };
+
+    static bool OnBars(const Bars &bars, const double *x, long column){
+      if( column < bars.region.GetIndex()[0] ||
+          column >= bars.region.GetIndex()[0] + (long) bars.region.GetSize()[0] ){
+        return false;
+      }
+      double t0 = bars.matrix[0][0] * x[0] + bars.matrix[0][1] * x[1] + bars.offset[0];
+      double t1 = bars.matrix[1][0] * x[0] + bars.matrix[1][1] * x[1] + bars.offset[1];
+      long i = (long) std::floor( ( t0 - bars.origin[0] ) / bars.spacing[0] + 0.5 );
+      long j = (long) std::floor( ( t1 - bars.origin[1] ) / bars.spacing[1] + 0.5 );
+      if( j < bars.yStart || j >= bars.yEnd ){
+        return false;
+      }
+      return ( i >= bars.xStart1 && i < bars.xEnd1 ) || ( i >= bars.xStart2 && i < bars.xEnd2 );
+    };
+
+};
+
+
+#endif
@@ -0,0 +1,151 @@
+#include "ParameterSweep.h"
+
+#include "StageTracer.h"
+
+#include <map>
+#include <sstream>
+#include <iomanip>
+
+
+
+bool parseSweepAxis(const std::string &assignment, SweepAxis &axis){
+  size_t equal = assignment.find( '=' );
+  if( equal == std::string::npos ){
+    return false;
+  }
+  axis.name = assignment.substr( 0, equal );
+  axis.values.clear();
+
+  std::stringstream in( assignment.substr( equal + 1 ) );
+  std::string value;
+  FitParameters parameters;
+  while( std::getline( in, value, ':' ) ){
+    if( !setFitParameter( parameters, axis.name, value ) ){
+      return false;
+    }
+    axis.values.push_back( value );
+  }
+  return !axis.values.empty();
+};
+
+
+
+std::vector<SweepPoint> expandSweep(const FitParameters &base,
+                                    const std::vector<SweepAxis> &axes){
+  std::vector<SweepPoint> points( 1 );
+  points[0].parameters = base;
+  for(unsigned int i=0; i<axes.size(); i++){
+    std::vector<SweepPoint> expanded;
+    for(unsigned int j=0; j<points.size(); j++){
+      for(unsigned int k=0; k<axes[i].values.size(); k++){
+        SweepPoint point = points[j];
+        setFitParameter( point.parameters, axes[i].name, axes[i].values[k] );
+        point.values.push_back( axes[i].values[k] );
+        expanded.push_back( point );
+      }
+    }
+    points.swap( expanded );
+  }
+  return points;
+};
+
+
+
+//Parameters with all stem parameters reset to the defaults
+FitParameters eyeStageParameters(const FitParameters &parameters){
+  FitParameters defaults;
+  FitParameters eye = parameters;
+  eye.stemSigmaX = defaults.stemSigmaX;
+  eye.stemSigmaY = defaults.stemSigmaY;
+  eye.stemThreshold = defaults.stemThreshold;
+  eye.stemOpeningRadius = defaults.stemOpeningRadius;
+  eye.stemRefineThreshold = defaults.stemRefineThreshold;
+  eye.stemRegistrationSigma = defaults.stemRegistrationSigma;
+  eye.stemShrinkFactors = defaults.stemShrinkFactors;
+  eye.stemSmoothingSigmas = defaults.stemSmoothingSigmas;
+  eye.stemAutoLevels = defaults.stemAutoLevels;
+  eye.stemMaxShrinkFactor = defaults.stemMaxShrinkFactor;
+  eye.stemMinBarPixels = defaults.stemMinBarPixels;
+  eye.stemMinLevelSize = defaults.stemMinLevelSize;
+  return eye;
+};
+
+
+
+std::string eyeStageKey(const FitParameters &parameters){
+  std::stringstream key;
+  key << std::setprecision(17);
+  printFitParameters( eyeStageParameters( parameters ), key );
+  return key.str();
+};
+
+
+
+std::string stemRegionStageKey(const FitParameters &parameters){
+  std::stringstream key;
+  key << std::setprecision(17);
+  key << eyeStageKey( parameters )
+      << "stemSigmaX=" << parameters.stemSigmaX << std::endl
+      << "stemSigmaY=" << parameters.stemSigmaY << std::endl;
+  return key.str();
+};
+
+
+
+SweepStatistics runSweep(ImageType::Pointer image, std::vector<SweepPoint> &points){
+
+  SweepStatistics statistics;
+  std::map<std::string, Eye> eyes;
+  std::map<std::string, StemRegion> regions;
+
+  for(unsigned int i=0; i<points.size(); i++){
+    SweepPoint &point = points[i];
+
+    std::string eyeKey = eyeStageKey( point.parameters );
+    std::map<std::string, Eye>::iterator eye = eyes.find( eyeKey );
+    if( eye == eyes.end() ){
+      eye = eyes.insert( std::make_pair( eyeKey, fitEye( image, "", point.parameters ) ) ).first;
+      statistics.eyeFits++;
+    }
+    point.eye = eye->second;
+
+    std::string regionKey = stemRegionStageKey( point.parameters );
+    std::map<std::string, StemRegion>::iterator region = regions.find( regionKey );
+    if( region == regions.end() ){
+      TraceSpan spanRegion( "Stem region" );
+      StemRegion stemRegion = extractStemRegion( image, point.eye, "", point.parameters );
+      stemRegion.shared = true;
+      region = regions.insert( std::make_pair( regionKey, stemRegion ) ).first;
+      statistics.stemRegions++;
+    }
+
+    TraceSpan spanStem( "Stem" );
+    point.stem = fitStem( image, point.eye, region->second, "", point.parameters );
+    statistics.stemFits++;
+  }
+
+  return statistics;
+};
+
+
+
+void writeSweepCSV(const std::vector<SweepAxis> &axes,
+                   const std::vector<SweepPoint> &points, std::ostream &out){
+  out << "point";
+  for(unsigned int i=0; i<axes.size(); i++){
+    out << "," << axes[i].name;
+  }
+  out << ",status,eye_minor,eye_major,stem_initial_width,width" << std::endl;
+
+  for(unsigned int i=0; i<points.size(); i++){
+    const SweepPoint &point = points[i];
+    out << i;
+    //List values contain commas
+    for(unsigned int j=0; j<point.values.size(); j++){
+      out << ",\"" << point.values[j] << "\"";
+    }
+    out << "," << fitStatusName( point.stem.status )
+        << "," << point.eye.minor << "," << point.eye.major
+        << "," << 2 * point.stem.initialWidth << "," << 2 * point.stem.width << std::endl;
+  }
+};
@@ -0,0 +1,76 @@
+#ifndef PARAMETERSWEEP_H
+#define PARAMETERSWEEP_H
+
+
+//Memoized parameter sweep over a single image.
+//
+//The fit is a chain of three stages, each depending on the previous one
+//and a subset of the FitParameters:
+// - eye: fitEye, all parameters except the stem parameters
+// - stem region: extractStemRegion, the eye and stemSigmaX, stemSigmaY
+// - stem: fitStem on the region, all remaining stem parameters
+//Each stage result is stored under a key made of the parameters it depends
+//on, so grid points sharing a prefix of the chain share its results. A
+//sweep over stem parameters fits the eye once and, unless the stem
+//smoothing is swept, extracts the stem region once.
+//
+//With a deadline the stem of a memoized eye is timed from the start of the
+//eye fit that produced it, sweeps are meant to run without deadline.
+
+
+#include <string>
+#include <vector>
+#include <ostream>
+
+#include "EyeAndStemFitting.h"
+
+
+//Values of a single parameter, the sweep runs all combinations of axes
+struct SweepAxis{
+  std::string name;
+  std::vector<std::string> values;
+};
+
+
+struct SweepPoint{
+  FitParameters parameters;
+  //Value of each axis
+  std::vector<std::string> values;
+
+  Eye eye;
+  Stem stem;
+};
+
+
+//Number of stage evaluations of a sweep
+struct SweepStatistics{
+  unsigned int eyeFits = 0;
+  unsigned int stemRegions = 0;
+  unsigned int stemFits = 0;
+};
+
+
+
+//Parse an axis from name=value1:value2:..., list values are comma
+//separated as for setFitParameter. Returns false for an unknown name or an
+//invalid value.
+bool parseSweepAxis(const std::string &assignment, SweepAxis &axis);
+
+//All combinations of the axes applied to base, the last axis varies
+//fastest
+std::vector<SweepPoint> expandSweep(const FitParameters &base,
+                                    const std::vector<SweepAxis> &axes);
+
+//Keys of the eye and stem region stages
+std::string eyeStageKey(const FitParameters &parameters);
+std::string stemRegionStageKey(const FitParameters &parameters);
+
+//Fit all points, the results are stored in the points
+SweepStatistics runSweep(ImageType::Pointer image, std::vector<SweepPoint> &points);
+
+//One CSV line per point with the axis values, status and fitted sizes
+void writeSweepCSV(const std::vector<SweepAxis> &axes,
+                   const std::vector<SweepPoint> &points, std::ostream &out);
+
+
+#endif
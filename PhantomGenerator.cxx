@@ -0,0 +1,157 @@
+#include "PhantomGenerator.h"
+
+#include "itkMersenneTwisterRandomVariateGenerator.h"
+
+#include <fstream>
+#include <sstream>
+#include <cmath>
+
+
+
+Phantom createPhantom(const PhantomParameters &parameters){
+
+  ImageType::SizeType size;
+  size[0] = parameters.width;
+  size[1] = parameters.height;
+  ImageType::SpacingType spacing;
+  spacing.Fill( parameters.spacing );
+  ImageType::PointType origin;
+  origin.Fill( 0.0 );
+  ImageType::RegionType region;
+  region.SetSize( size );
+
+  double h = parameters.height * parameters.spacing;
+
+  Phantom phantom;
+  phantom.eyeCenter[0] = parameters.eyeCenterX * parameters.width * parameters.spacing;
+  phantom.eyeCenter[1] = parameters.eyeCenterY * h;
+  phantom.eyeMinor = parameters.eyeRadiusX * h;
+  phantom.eyeMajor = parameters.eyeRadiusY * h;
+  phantom.nerveWidth = parameters.nerveWidth * h;
+  phantom.rotation = parameters.rotation;
+
+
+  //Eye and optic nerve, the nerve starts at the eye center and is covered
+  //by the eye above its lower border
+  ImageType::Pointer eye = CreateEllipseImage( spacing, size, origin, phantom.eyeCenter,
+                                               parameters.eyeRadiusX * h,
+                                               parameters.eyeRadiusY * h,
+                                               parameters.tissueIntensity,
+                                               parameters.eyeIntensity );
+
+  ImageType::IndexType centerIndex;
+  eye->TransformPhysicalPointToIndex( phantom.eyeCenter, centerIndex );
+  double nerveHalfWidth = 0.5 * phantom.nerveWidth / parameters.spacing;
+  ImageType::Pointer nerve = CreateBarsImage( region, spacing, origin, centerIndex[1],
+                                              (int) std::floor( centerIndex[0] - nerveHalfWidth + 0.5 ),
+                                              (int) std::floor( centerIndex[0] + nerveHalfWidth + 0.5 ),
+                                              0, 0, 1.0 );
+
+  PixelType *eyeBuffer = eye->GetBufferPointer();
+  const PixelType *nerveBuffer = nerve->GetBufferPointer();
+  const size_t nPixels = region.GetNumberOfPixels();
+  for(size_t i=0; i<nPixels; i++){
+    if( nerveBuffer[i] > 0 ){
+      eyeBuffer[i] = std::min( eyeBuffer[i], (PixelType) parameters.nerveIntensity );
+    }
+  }
+
+
+  //Rotate about the eye center, the resampler maps output to input points
+  //so the inverse rotation is used
+  SimilarityTransformType::Pointer rotation = SimilarityTransformType::New();
+  rotation->SetCenter( phantom.eyeCenter );
+  rotation->SetAngle( -parameters.rotation * itk::Math::pi / 180.0 );
+
+  ResampleFilterType::Pointer resampler = ResampleFilterType::New();
+  resampler->SetInput( eye );
+  resampler->SetTransform( rotation );
+  resampler->SetSize( size );
+  resampler->SetOutputOrigin( origin );
+  resampler->SetOutputSpacing( spacing );
+  resampler->SetDefaultPixelValue( parameters.tissueIntensity );
+  resampler->Update();
+  ImageType::Pointer image = resampler->GetOutput();
+
+
+  //Multiplicative speckle with Rayleigh distributed amplitude of mean one
+  if( parameters.speckle > 0 ){
+    typedef itk::Statistics::MersenneTwisterRandomVariateGenerator RandomGenerator;
+    RandomGenerator::Pointer random = RandomGenerator::New();
+    random->SetSeed( parameters.seed );
+
+    const double rayleighMean = std::sqrt( itk::Math::pi / 2.0 );
+    PixelType *buffer = image->GetBufferPointer();
+    for(size_t i=0; i<nPixels; i++){
+      double u = random->GetVariateWithOpenUpperRange();
+      double r = std::sqrt( -2.0 * std::log( 1.0 - u ) ) / rayleighMean;
+      buffer[i] *= ( 1.0 - parameters.speckle ) + parameters.speckle * r;
+    }
+  }
+
+  //Point spread function and 8-bit range of B-mode images
+  ITKPipeline<ImageType> pipeline( image, true );
+  if( parameters.blur > 0 ){
+    ITKFilterFunctions<ImageType>::SigmaArrayType sigma;
+    sigma.Fill( parameters.blur * parameters.spacing );
+    pipeline.GaussSmooth( sigma );
+  }
+  pipeline.ThresholdAbove( 255, 255 ).ThresholdBelow( 0, 0 );
+  image = pipeline.Update();
+
+  phantom.image = image;
+  return phantom;
+};
+
+
+
+bool writePhantomGroundTruth(const Phantom &phantom, const std::string &filename){
+  std::ofstream file( filename.c_str() );
+  if( !file ){
+    return false;
+  }
+  ImageType::SizeType size = phantom.image->GetLargestPossibleRegion().GetSize();
+  file << "Image size: " << size[0] << " " << size[1] << std::endl;
+  file << "Spacing: " << phantom.image->GetSpacing()[0] << std::endl;
+  file << "Rotation: " << phantom.rotation << std::endl;
+  file << "Eye center: " << phantom.eyeCenter[0] << " " << phantom.eyeCenter[1] << std::endl;
+  file << "Eye minor: " << phantom.eyeMinor << std::endl;
+  file << "Eye major: " << phantom.eyeMajor << std::endl;
+  file << "Estimated optic nerve width: " << phantom.nerveWidth << std::endl;
+  return true;
+};
+
+
+
+bool readPhantomGroundTruth(const std::string &filename, Phantom &phantom){
+  std::ifstream file( filename.c_str() );
+  if( !file ){
+    return false;
+  }
+  bool hasWidth = false;
+  std::string line;
+  while( std::getline( file, line ) ){
+    size_t colon = line.find( ':' );
+    if( colon == std::string::npos ){
+      continue;
+    }
+    std::string name = line.substr( 0, colon );
+    std::stringstream value( line.substr( colon + 1 ) );
+    if( name == "Rotation" ){
+      value >> phantom.rotation;
+    }
+    else if( name == "Eye center" ){
+      value >> phantom.eyeCenter[0] >> phantom.eyeCenter[1];
+    }
+    else if( name == "Eye minor" ){
+      value >> phantom.eyeMinor;
+    }
+    else if( name == "Eye major" ){
+      value >> phantom.eyeMajor;
+    }
+    else if( name == "Estimated optic nerve width" ){
+      hasWidth = (bool) ( value >> phantom.nerveWidth );
+    }
+  }
+  return hasWidth;
+};
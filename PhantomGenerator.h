@@ -0,0 +1,77 @@
+#ifndef PHANTOMGENERATOR_H
+#define PHANTOMGENERATOR_H
+
+
+//Synthetic B-mode like eye images with known eye and optic nerve geometry.
+//
+//The phantom is built from the same template shapes as the fitting: an
+//ellipse created by CreateEllipseImage for the anechoic eye and a bar
+//created by CreateBarsImage for the hypoechoic optic nerve below it. The
+//scene is rotated about the eye center, multiplied with Rayleigh distributed
+//speckle and blurred by a Gaussian point spread function.
+//
+//Geometry is given relative to the image size so the same parameters
+//produce the same scene at any resolution. All ground truth values are in
+//physical units, as reported by fitEye and fitStem.
+
+
+#include <string>
+
+#include "EyeAndStemFitting.h"
+
+
+struct PhantomParameters{
+  unsigned long width = 640;
+  unsigned long height = 480;
+  double spacing = 1.0;
+
+  //Eye center as fraction of image width and height
+  double eyeCenterX = 0.5;
+  double eyeCenterY = 0.3;
+
+  //Eye radii and optic nerve width as fraction of image height
+  double eyeRadiusX = 0.3;
+  double eyeRadiusY = 0.25;
+  double nerveWidth = 0.1;
+
+  //Rotation of the scene about the eye center in degrees
+  double rotation = 0;
+
+  //Speckle strength, 0 for none up to 1 for fully developed speckle
+  double speckle = 0.3;
+  //Standard deviation of the point spread function in pixels
+  double blur = 1.5;
+  unsigned int seed = 0;
+
+  double tissueIntensity = 150;
+  double eyeIntensity = 10;
+  double nerveIntensity = 40;
+};
+
+
+
+struct Phantom{
+  ImageType::Pointer image;
+
+  //Ground truth
+  ImageType::PointType eyeCenter;
+  //Radii along x and y, as Eye::minor and Eye::major
+  double eyeMinor = -1;
+  double eyeMajor = -1;
+  double nerveWidth = -1;
+  double rotation = 0;
+};
+
+
+
+Phantom createPhantom(const PhantomParameters &parameters);
+
+//Ground truth as "name: value" lines, the optic nerve width is written in
+//the same form as the output of EstimateEyeAndStem
+bool writePhantomGroundTruth(const Phantom &phantom, const std::string &filename);
+
+//Read ground truth written by writePhantomGroundTruth, the image is not read
+bool readPhantomGroundTruth(const std::string &filename, Phantom &phantom);
+
+
+#endif
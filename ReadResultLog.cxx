@@ -0,0 +1,117 @@
+//Prints or summarizes binary result logs written by EstimateEyeAndStem
+//with --log, see ResultLog.h.
+//
+//  ReadResultLog results.bin                 all records as CSV
+//  ReadResultLog --format json --failed results.bin
+//  ReadResultLog --summary results.bin       counts per status, widths
+
+
+
+#include <tclap/CmdLine.h>
+
+#include <vector>
+#include <string>
+#include <map>
+#include <iostream>
+#include <algorithm>
+
+#include "ResultLog.h"
+
+
+
+int main(int argc, char **argv ){
+
+  //Command line parsing
+  TCLAP::CmdLine cmd("Print binary result logs of EstimateEyeAndStem", ' ', "1");
+
+  TCLAP::UnlabeledMultiArg<std::string> logArg("logs","Result logs", true,
+      "filename");
+  cmd.add(logArg);
+
+  std::vector<std::string> formats;
+  formats.push_back( "csv" );
+  formats.push_back( "json" );
+  TCLAP::ValuesConstraint<std::string> formatConstraint( formats );
+  TCLAP::ValueArg<std::string> formatArg("","format","Format of the printed records", false, "csv",
+      &formatConstraint);
+  cmd.add(formatArg);
+
+  TCLAP::SwitchArg failedArg("","failed","Only records of images that could not be fitted" );
+  cmd.add(failedArg);
+
+  TCLAP::SwitchArg summaryArg("","summary","Print counts per status and optic nerve width statistics instead of the records" );
+  cmd.add(summaryArg);
+
+  try{
+    cmd.parse( argc, argv );
+  }
+  catch (TCLAP::ArgException &e){
+    std::cerr << "error: " << e.error() << " for arg " << e.argId() << std::endl;
+    return -1;
+  }
+
+  bool json = formatArg.getValue() == "json";
+  if( !json && !summaryArg.getValue() ){
+    writeResultCSVHeader( std::cout );
+  }
+
+  std::map<int, unsigned int> statusCounts;
+  std::vector<double> widths;
+  double totalSeconds = 0;
+  unsigned int nRecords = 0;
+  for(unsigned int i=0; i<logArg.getValue().size(); i++){
+    ResultLogReader reader( logArg.getValue()[i] );
+    if( !reader.IsValid() ){
+      std::cerr << "error: " << logArg.getValue()[i] << " is not a result log" << std::endl;
+      return -1;
+    }
+    std::string image;
+    ResultRecord record;
+    while( reader.Next( image, record ) ){
+      if( failedArg.getValue() && record.stemStatus == FIT_OK ){
+        continue;
+      }
+      nRecords++;
+      if( summaryArg.getValue() ){
+        statusCounts[record.stemStatus]++;
+        if( record.stemStatus == FIT_OK ){
+          widths.push_back( record.stemWidth );
+        }
+        totalSeconds += record.totalSeconds;
+      }
+      else if( json ){
+        writeResultJSON( std::cout, image, record );
+      }
+      else{
+        writeResultCSV( std::cout, image, record );
+      }
+    }
+    if( reader.NumberOfSkippedBytes() > 0 ){
+      std::cerr << "warning: skipped " << reader.NumberOfSkippedBytes() << " bytes of torn or corrupt entries in "
+                << logArg.getValue()[i] << std::endl;
+    }
+  }
+
+  if( summaryArg.getValue() ){
+    std::cout << "Records: " << nRecords << std::endl;
+    for(std::map<int, unsigned int>::iterator it = statusCounts.begin(); it != statusCounts.end(); ++it){
+      std::cout << "  " << fitStatusName( (FitStatus) it->first ) << ": " << it->second << std::endl;
+    }
+    if( !widths.empty() ){
+      std::sort( widths.begin(), widths.end() );
+      double mean = 0;
+      for(unsigned int i=0; i<widths.size(); i++){
+        mean += widths[i];
+      }
+      mean /= widths.size();
+      std::cout << "Optic nerve width: min " << widths.front() << ", median "
+                << widths[ widths.size() / 2 ] << ", mean " << mean
+                << ", max " << widths.back() << std::endl;
+    }
+    if( nRecords > 0 ){
+      std::cout << "Mean seconds per image: " << totalSeconds / nRecords << std::endl;
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
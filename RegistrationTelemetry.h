@@ -0,0 +1,179 @@
+#ifndef REGISTRATIONTELEMETRY_H
+#define REGISTRATIONTELEMETRY_H
+
+
+#include <vector>
+#include <string>
+#include <chrono>
+#include <ostream>
+#include <iomanip>
+
+#include "itkCommand.h"
+#include "itkEventObject.h"
+
+
+//Convergence of a single level of a multi resolution registration
+struct RegistrationLevelTelemetry{
+  unsigned int shrinkFactor = 1;
+  unsigned int iterations = 0;
+  unsigned int evaluations = 0;
+  //Metric value and gradient norm after each iteration
+  std::vector<double> metricValues;
+  std::vector<double> gradientNorms;
+  std::string stopCondition;
+  double seconds = 0;
+};
+
+
+
+//Convergence of a registration, one entry per pyramid level
+struct RegistrationTelemetry{
+  std::vector<RegistrationLevelTelemetry> levels;
+
+  unsigned int TotalIterations() const{
+    unsigned int n = 0;
+    for(unsigned int i=0; i<levels.size(); i++){
+      n += levels[i].iterations;
+    }
+    return n;
+  };
+
+  unsigned int TotalEvaluations() const{
+    unsigned int n = 0;
+    for(unsigned int i=0; i<levels.size(); i++){
+      n += levels[i].evaluations;
+    }
+    return n;
+  };
+
+  double FinalMetricValue() const{
+    for(int i=levels.size()-1; i>=0; i--){
+      if( !levels[i].metricValues.empty() ){
+        return levels[i].metricValues.back();
+      }
+    }
+    return 0;
+  };
+
+
+  //One line per level
+  void Print(const std::string &name, std::ostream &out) const{
+    for(unsigned int i=0; i<levels.size(); i++){
+      const RegistrationLevelTelemetry &level = levels[i];
+      out << name << " level " << i << ": shrink " << level.shrinkFactor
+          << ", iterations " << level.iterations
+          << ", evaluations " << level.evaluations;
+      if( !level.metricValues.empty() ){
+        out << ", metric " << level.metricValues.front() << " -> " << level.metricValues.back()
+            << ", gradient " << level.gradientNorms.back();
+      }
+      out << ", time " << level.seconds << std::endl;
+      out << "  " << level.stopCondition << std::endl;
+    }
+  };
+
+
+  //Trajectories as CSV lines: name, level, iteration, metric, gradient norm
+  void WriteCSV(const std::string &name, std::ostream &out) const{
+    for(unsigned int i=0; i<levels.size(); i++){
+      const RegistrationLevelTelemetry &level = levels[i];
+      for(unsigned int j=0; j<level.metricValues.size(); j++){
+        out << name << "," << i << "," << j << ","
+            << std::setprecision(10) << level.metricValues[j] << ","
+            << level.gradientNorms[j] << std::endl;
+      }
+    }
+  };
+};
+
+
+
+//Records RegistrationTelemetry from the events of an ImageRegistrationMethodv4
+//and its optimizer. Attach with Observe before the registration is updated
+//and call Finish afterwards to close the last level.
+template <typename TOptimizer>
+class RegistrationTelemetryObserver : public itk::Command{
+
+  public:
+
+    typedef RegistrationTelemetryObserver Self;
+    typedef itk::Command Superclass;
+    typedef itk::SmartPointer<Self> Pointer;
+
+    typedef TOptimizer Optimizer;
+
+  itkNewMacro( Self );
+
+
+  template <typename TRegistration>
+  void Observe(TRegistration *registration, Optimizer *optimizer, RegistrationTelemetry *telemetry){
+    m_Optimizer = optimizer;
+    m_Telemetry = telemetry;
+    m_Telemetry->levels.clear();
+    registration->AddObserver( itk::MultiResolutionIterationEvent(), this );
+    //Also receives the derived function and gradient evaluation events
+    optimizer->AddObserver( itk::IterationEvent(), this );
+  };
+
+
+  //Close the current level
+  void Finish(){
+    if( m_Telemetry == NULL || m_Telemetry->levels.empty() || m_LevelDone ){
+      return;
+    }
+    RegistrationLevelTelemetry &level = m_Telemetry->levels.back();
+    level.seconds = std::chrono::duration<double>(
+                      std::chrono::steady_clock::now() - m_LevelStart ).count();
+    level.stopCondition = m_Optimizer->GetStopConditionDescription();
+    m_LevelDone = true;
+  };
+
+
+  void Execute(itk::Object *caller, const itk::EventObject &event) override{
+    Execute( (const itk::Object *) caller, event );
+  };
+
+  void Execute(const itk::Object *, const itk::EventObject &event) override{
+    if( m_Telemetry == NULL ){
+      return;
+    }
+    if( itk::MultiResolutionIterationEvent().CheckEvent( &event ) ){
+      Finish();
+      m_Telemetry->levels.push_back( RegistrationLevelTelemetry() );
+      m_LevelStart = std::chrono::steady_clock::now();
+      m_LevelDone = false;
+      return;
+    }
+    if( m_Telemetry->levels.empty() ){
+      return;
+    }
+
+    RegistrationLevelTelemetry &level = m_Telemetry->levels.back();
+    if( itk::FunctionEvaluationIterationEvent().CheckEvent( &event ) ||
+        itk::GradientEvaluationIterationEvent().CheckEvent( &event ) ||
+        itk::FunctionAndGradientEvaluationIterationEvent().CheckEvent( &event ) ){
+      level.evaluations++;
+    }
+    else if( itk::IterationEvent().CheckEvent( &event ) ){
+      level.iterations++;
+      level.metricValues.push_back( m_Optimizer->GetCachedValue() );
+      level.gradientNorms.push_back( m_Optimizer->GetCachedDerivative().magnitude() );
+    }
+  };
+
+
+  protected:
+
+    RegistrationTelemetryObserver() : m_Optimizer(NULL), m_Telemetry(NULL), m_LevelDone(true) {};
+
+  private:
+
+    Optimizer *m_Optimizer;
+    RegistrationTelemetry *m_Telemetry;
+    std::chrono::steady_clock::time_point m_LevelStart;
+    bool m_LevelDone;
+
+};
+
+
+#endif
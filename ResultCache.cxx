@@ -0,0 +1,286 @@
+#include "ResultCache.h"
+
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <map>
+#include <atomic>
+#include <cstdio>
+
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+
+//Increase when the entry format or the meaning of the results changes
+static const int CacheVersion = 1;
+
+
+
+uint64_t hashBytes(const void *data, size_t n, uint64_t hash){
+  const unsigned char *bytes = (const unsigned char *) data;
+  for(size_t i=0; i<n; i++){
+    hash ^= bytes[i];
+    hash *= 1099511628211ull;
+  }
+  return hash;
+};
+
+
+
+uint64_t hashImage(ImageType::Pointer image){
+  ImageType::RegionType region = image->GetBufferedRegion();
+  ImageType::SizeType size = region.GetSize();
+  ImageType::SpacingType spacing = image->GetSpacing();
+  ImageType::PointType origin = image->GetOrigin();
+  uint64_t hash = hashBytes( &size[0], 2 * sizeof(size[0]) );
+  hash = hashBytes( &spacing[0], 2 * sizeof(spacing[0]), hash );
+  hash = hashBytes( &origin[0], 2 * sizeof(origin[0]), hash );
+  return hashBytes( image->GetBufferPointer(), region.GetNumberOfPixels() * sizeof(PixelType), hash );
+};
+
+
+
+uint64_t hashFitParameters(const FitParameters &parameters){
+  //Parameters that do not change the results
+  FitParameters hashed = parameters;
+  hashed.stageThreads = FitParameters().stageThreads;
+  hashed.templateCacheSize = FitParameters().templateCacheSize;
+
+  std::stringstream out;
+  out << std::setprecision(17);
+  printFitParameters( hashed, out );
+  std::string s = out.str();
+  return hashBytes( s.data(), s.size() );
+};
+
+
+
+
+//Entries are "name: values" lines
+template <typename T>
+void writeCacheValues(std::ostream &out, const char *name, const T &values, unsigned int n){
+  out << name << ":";
+  for(unsigned int i=0; i<n; i++){
+    out << " " << values[i];
+  }
+  out << std::endl;
+};
+
+template <typename T>
+void writeCacheValue(std::ostream &out, const char *name, const T &value){
+  out << name << ": " << value << std::endl;
+};
+
+void writeCacheParameters(std::ostream &out, const char *name,
+                          const itk::OptimizerParameters<double> &parameters){
+  out << name << ": " << parameters.GetSize();
+  for(unsigned int i=0; i<parameters.GetSize(); i++){
+    out << " " << parameters[i];
+  }
+  out << std::endl;
+};
+
+
+typedef std::map<std::string, std::string> CacheEntry;
+
+template <typename T>
+bool readCacheValues(const CacheEntry &entry, const std::string &name, T &values, unsigned int n){
+  CacheEntry::const_iterator it = entry.find( name );
+  if( it == entry.end() ){
+    return false;
+  }
+  std::stringstream in( it->second );
+  for(unsigned int i=0; i<n; i++){
+    if( !( in >> values[i] ) ){
+      return false;
+    }
+  }
+  return true;
+};
+
+template <typename T>
+bool readCacheValue(const CacheEntry &entry, const std::string &name, T &value){
+  T *values = &value;
+  return readCacheValues( entry, name, values, 1 );
+};
+
+bool readCacheParameters(const CacheEntry &entry, const std::string &name,
+                         itk::OptimizerParameters<double> &parameters){
+  CacheEntry::const_iterator it = entry.find( name );
+  if( it == entry.end() ){
+    return false;
+  }
+  std::stringstream in( it->second );
+  unsigned int n;
+  if( !( in >> n ) ){
+    return false;
+  }
+  parameters.SetSize( n );
+  for(unsigned int i=0; i<n; i++){
+    if( !( in >> parameters[i] ) ){
+      return false;
+    }
+  }
+  return true;
+};
+
+
+
+
+ResultCache::ResultCache(const std::string &directory) : m_Directory( directory ){
+  mkdir( m_Directory.c_str(), 0777 );
+};
+
+
+
+std::string ResultCache::Key(ImageType::Pointer image, const FitParameters &parameters){
+  std::stringstream key;
+  key << std::hex << std::setfill('0') << std::setw(16) << hashImage( image )
+      << "-" << std::setw(16) << hashFitParameters( parameters );
+  return key.str();
+};
+
+
+
+std::string ResultCache::Filename(const std::string &key) const{
+  return m_Directory + "/" + key + ".txt";
+};
+
+
+
+bool ResultCache::Store(const std::string &key, const Eye &eye, const Stem &stem) const{
+  static std::atomic<unsigned int> counter( 0 );
+  std::stringstream tmpName;
+  tmpName << Filename( key ) << "." << getpid() << "." << counter++ << ".tmp";
+
+  {
+    std::ofstream out( tmpName.str().c_str() );
+    if( !out ){
+      return false;
+    }
+    out << std::setprecision(17);
+    writeCacheValue( out, "Version", CacheVersion );
+    writeCacheValue( out, "Key", key );
+
+    writeCacheValues( out, "Eye initial center index", eye.initialCenterIndex, 2 );
+    writeCacheValues( out, "Eye initial center", eye.initialCenter, 2 );
+    writeCacheValues( out, "Eye center index", eye.centerIndex, 2 );
+    writeCacheValues( out, "Eye center", eye.center, 2 );
+    writeCacheValue( out, "Eye initial radius", eye.initialRadius );
+    writeCacheValue( out, "Eye initial radius x", eye.initialRadiusX );
+    writeCacheValue( out, "Eye initial radius y", eye.initialRadiusY );
+    writeCacheValue( out, "Eye minor", eye.minor );
+    writeCacheValue( out, "Eye major", eye.major );
+    writeCacheValue( out, "Eye r1", eye.r1 );
+    writeCacheValue( out, "Eye r2", eye.r2 );
+    writeCacheValue( out, "Eye rf", eye.rf );
+    writeCacheParameters( out, "Eye transform", eye.transformParameters );
+    writeCacheValue( out, "Eye status", (int) eye.status );
+    writeCacheValue( out, "Eye level", (int) eye.level );
+
+    writeCacheValues( out, "Stem initial center index", stem.initialCenterIndex, 2 );
+    writeCacheValues( out, "Stem initial center", stem.initialCenter, 2 );
+    writeCacheValues( out, "Stem center index", stem.centerIndex, 2 );
+    writeCacheValues( out, "Stem center", stem.center, 2 );
+    writeCacheValue( out, "Stem initial width", stem.initialWidth );
+    writeCacheValue( out, "Stem width", stem.width );
+    writeCacheValues( out, "Stem region index", stem.originalImageRegion.GetIndex(), 2 );
+    writeCacheValues( out, "Stem region size", stem.originalImageRegion.GetSize(), 2 );
+    writeCacheValue( out, "Stem bars y start", stem.barsYStart );
+    writeCacheValue( out, "Stem bars x start 1", stem.barsXStart1 );
+    writeCacheValue( out, "Stem bars x end 1", stem.barsXEnd1 );
+    writeCacheValue( out, "Stem bars x start 2", stem.barsXStart2 );
+    writeCacheValue( out, "Stem bars x end 2", stem.barsXEnd2 );
+    writeCacheParameters( out, "Stem transform", stem.transformParameters );
+    writeCacheValue( out, "Stem status", (int) stem.status );
+    writeCacheValue( out, "Stem level", (int) stem.level );
+
+    if( !out ){
+      out.close();
+      std::remove( tmpName.str().c_str() );
+      return false;
+    }
+  }
+
+  //Atomic replacement, readers see either no entry or a complete one
+  if( std::rename( tmpName.str().c_str(), Filename( key ).c_str() ) != 0 ){
+    std::remove( tmpName.str().c_str() );
+    return false;
+  }
+  return true;
+};
+
+
+
+bool ResultCache::Load(const std::string &key, Eye &eye, Stem &stem) const{
+  std::ifstream in( Filename( key ).c_str() );
+  if( !in ){
+    return false;
+  }
+  CacheEntry entry;
+  std::string line;
+  while( std::getline( in, line ) ){
+    size_t colon = line.find( ':' );
+    if( colon != std::string::npos ){
+      entry[ line.substr( 0, colon ) ] = line.substr( colon + 1 );
+    }
+  }
+
+  int version = 0;
+  std::string storedKey;
+  if( !readCacheValue( entry, "Version", version ) || version != CacheVersion ||
+      !readCacheValue( entry, "Key", storedKey ) || storedKey != key ){
+    return false;
+  }
+
+  Eye e;
+  Stem s;
+  int eyeStatus, eyeLevel, stemStatus, stemLevel;
+  ImageType::IndexType regionIndex;
+  ImageType::SizeType regionSize;
+  bool ok =
+    readCacheValues( entry, "Eye initial center index", e.initialCenterIndex, 2 ) &&
+    readCacheValues( entry, "Eye initial center", e.initialCenter, 2 ) &&
+    readCacheValues( entry, "Eye center index", e.centerIndex, 2 ) &&
+    readCacheValues( entry, "Eye center", e.center, 2 ) &&
+    readCacheValue( entry, "Eye initial radius", e.initialRadius ) &&
+    readCacheValue( entry, "Eye initial radius x", e.initialRadiusX ) &&
+    readCacheValue( entry, "Eye initial radius y", e.initialRadiusY ) &&
+    readCacheValue( entry, "Eye minor", e.minor ) &&
+    readCacheValue( entry, "Eye major", e.major ) &&
+    readCacheValue( entry, "Eye r1", e.r1 ) &&
+    readCacheValue( entry, "Eye r2", e.r2 ) &&
+    readCacheValue( entry, "Eye rf", e.rf ) &&
+    readCacheParameters( entry, "Eye transform", e.transformParameters ) &&
+    readCacheValue( entry, "Eye status", eyeStatus ) &&
+    readCacheValue( entry, "Eye level", eyeLevel ) &&
+    readCacheValues( entry, "Stem initial center index", s.initialCenterIndex, 2 ) &&
+    readCacheValues( entry, "Stem initial center", s.initialCenter, 2 ) &&
+    readCacheValues( entry, "Stem center index", s.centerIndex, 2 ) &&
+    readCacheValues( entry, "Stem center", s.center, 2 ) &&
+    readCacheValue( entry, "Stem initial width", s.initialWidth ) &&
+    readCacheValue( entry, "Stem width", s.width ) &&
+    readCacheValues( entry, "Stem region index", regionIndex, 2 ) &&
+    readCacheValues( entry, "Stem region size", regionSize, 2 ) &&
+    readCacheValue( entry, "Stem bars y start", s.barsYStart ) &&
+    readCacheValue( entry, "Stem bars x start 1", s.barsXStart1 ) &&
+    readCacheValue( entry, "Stem bars x end 1", s.barsXEnd1 ) &&
+    readCacheValue( entry, "Stem bars x start 2", s.barsXStart2 ) &&
+    readCacheValue( entry, "Stem bars x end 2", s.barsXEnd2 ) &&
+    readCacheParameters( entry, "Stem transform", s.transformParameters ) &&
+    readCacheValue( entry, "Stem status", stemStatus ) &&
+    readCacheValue( entry, "Stem level", stemLevel );
+  if( !ok ){
+    return false;
+  }
+  s.originalImageRegion = ImageType::RegionType( regionIndex, regionSize );
+  e.status = (FitStatus) eyeStatus;
+  e.level = (FitLevel) eyeLevel;
+  s.status = (FitStatus) stemStatus;
+  s.level = (FitLevel) stemLevel;
+
+  eye = e;
+  stem = s;
+  return true;
+};
@@ -0,0 +1,60 @@
+#ifndef RESULTCACHE_H
+#define RESULTCACHE_H
+
+
+//On-disk cache of fit results keyed by content.
+//
+//The key combines a hash of the pixel data and geometry of the input image
+//with a hash of all FitParameters, so a result is reused exactly when the
+//same pixels are fitted with the same configuration. Entries are text
+//files <directory>/<key>.txt holding the Eye and Stem results, registration
+//telemetry is not stored.
+//
+//Entries are written to a temporary file in the cache directory and
+//renamed into place, so concurrent workers sharing a directory only ever
+//read complete entries. Two workers missing the same key both fit and
+//the last rename wins with an identical result.
+
+
+#include <string>
+#include <cstdint>
+
+#include "EyeAndStemFitting.h"
+
+
+//64 bit FNV-1a
+uint64_t hashBytes(const void *data, size_t n, uint64_t hash = 14695981039346656037ull);
+
+//Hash of size, spacing, origin and pixel data
+uint64_t hashImage(ImageType::Pointer image);
+
+//Hash of all parameters as listed by printFitParameters, except those
+//that do not change the results
+uint64_t hashFitParameters(const FitParameters &parameters);
+
+
+
+class ResultCache{
+
+  public:
+
+  ResultCache(const std::string &directory);
+
+  static std::string Key(ImageType::Pointer image, const FitParameters &parameters);
+
+  //Returns false if there is no complete entry for key
+  bool Load(const std::string &key, Eye &eye, Stem &stem) const;
+
+  bool Store(const std::string &key, const Eye &eye, const Stem &stem) const;
+
+
+  private:
+
+    std::string Filename(const std::string &key) const;
+
+    std::string m_Directory;
+
+};
+
+
+#endif
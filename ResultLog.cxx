@@ -0,0 +1,309 @@
+#include "ResultLog.h"
+
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+
+//Increase when ResultRecord or the entry layout changes
+static const uint32_t LogVersion = 2;
+static const char LogMagic[4] = { 'O', 'N', 'S', 'R' };
+//Start of each entry
+static const char EntryMagic[4] = { 'O', 'N', 'S', 'E' };
+//Longer names are truncated, longer lengths in a log are corrupt entries
+static const uint32_t MaximumNameLength = 65536;
+
+struct LogHeader{
+  char magic[4];
+  uint32_t version;
+  uint32_t recordBytes;
+  uint32_t reserved;
+};
+
+
+
+//CRC-32 (IEEE 802.3) of an entry
+struct Crc32Table{
+  uint32_t values[256];
+
+  Crc32Table(){
+    for(uint32_t i=0; i<256; i++){
+      uint32_t c = i;
+      for(int k=0; k<8; k++){
+        c = ( c & 1 ) ? 0xEDB88320u ^ ( c >> 1 ) : c >> 1;
+      }
+      values[i] = c;
+    }
+  };
+};
+
+static uint32_t crc32Bytes(const void *data, size_t n, uint32_t crc = 0){
+  static const Crc32Table table;
+  const unsigned char *bytes = (const unsigned char *) data;
+  crc = ~crc;
+  for(size_t i=0; i<n; i++){
+    crc = table.values[ ( crc ^ bytes[i] ) & 0xFF ] ^ ( crc >> 8 );
+  }
+  return ~crc;
+};
+
+
+
+ResultRecord makeResultRecord(const Eye &eye, const Stem &stem){
+  ResultRecord record;
+  std::memset( &record, 0, sizeof(ResultRecord) );
+  record.eyeStatus = eye.status;
+  record.stemStatus = stem.status;
+  record.eyeLevel = eye.level;
+  record.stemLevel = stem.level;
+
+  record.eyeInitialRadius = -1;
+  record.eyeInitialRadiusX = -1;
+  record.eyeInitialRadiusY = -1;
+  record.eyeMinor = -1;
+  record.eyeMajor = -1;
+  if( eye.status == FIT_OK ){
+    for(unsigned int i=0; i<2; i++){
+      record.eyeInitialCenter[i] = eye.initialCenter[i];
+      record.eyeCenter[i] = eye.center[i];
+    }
+    record.eyeInitialRadius = eye.initialRadius;
+    record.eyeInitialRadiusX = eye.initialRadiusX;
+    record.eyeInitialRadiusY = eye.initialRadiusY;
+    record.eyeMinor = eye.minor;
+    record.eyeMajor = eye.major;
+  }
+
+  record.stemInitialWidth = -1;
+  record.stemWidth = -1;
+  if( stem.status == FIT_OK ){
+    for(unsigned int i=0; i<2; i++){
+      record.stemInitialCenter[i] = stem.initialCenter[i];
+      record.stemCenter[i] = stem.center[i];
+    }
+    record.stemInitialWidth = 2 * stem.initialWidth;
+    record.stemWidth = 2 * stem.width;
+  }
+  return record;
+};
+
+
+
+static std::string jsonString(const std::string &s){
+  std::stringstream out;
+  out << '"';
+  for(unsigned int i=0; i<s.size(); i++){
+    unsigned char c = s[i];
+    if( c == '"' || c == '\\' ){
+      out << '\\' << c;
+    }
+    else if( c < 0x20 ){
+      out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << (int) c << std::dec;
+    }
+    else{
+      out << c;
+    }
+  }
+  out << '"';
+  return out.str();
+};
+
+
+static std::string csvString(const std::string &s){
+  if( s.find_first_of( ",\"\n\r" ) == std::string::npos ){
+    return s;
+  }
+  std::string quoted = "\"";
+  for(unsigned int i=0; i<s.size(); i++){
+    if( s[i] == '"' ){
+      quoted += '"';
+    }
+    quoted += s[i];
+  }
+  return quoted + "\"";
+};
+
+
+
+void writeResultJSON(std::ostream &out, const std::string &image, const ResultRecord &r){
+  std::stringstream line;
+  line << std::setprecision(10);
+  line << "{\"image\":" << jsonString( image )
+       << ",\"status\":" << jsonString( fitStatusName( (FitStatus) r.stemStatus ) )
+       << ",\"eye\":{\"status\":" << r.eyeStatus
+       << ",\"level\":" << jsonString( fitLevelName( (FitLevel) r.eyeLevel ) )
+       << ",\"initialCenter\":[" << r.eyeInitialCenter[0] << "," << r.eyeInitialCenter[1] << "]"
+       << ",\"initialRadius\":" << r.eyeInitialRadius
+       << ",\"initialRadiusX\":" << r.eyeInitialRadiusX
+       << ",\"initialRadiusY\":" << r.eyeInitialRadiusY
+       << ",\"center\":[" << r.eyeCenter[0] << "," << r.eyeCenter[1] << "]"
+       << ",\"minor\":" << r.eyeMinor
+       << ",\"major\":" << r.eyeMajor << "}"
+       << ",\"stem\":{\"status\":" << r.stemStatus
+       << ",\"level\":" << jsonString( fitLevelName( (FitLevel) r.stemLevel ) )
+       << ",\"initialCenter\":[" << r.stemInitialCenter[0] << "," << r.stemInitialCenter[1] << "]"
+       << ",\"initialWidth\":" << r.stemInitialWidth
+       << ",\"center\":[" << r.stemCenter[0] << "," << r.stemCenter[1] << "]"
+       << ",\"width\":" << r.stemWidth << "}"
+       << ",\"cached\":" << ( r.cached ? "true" : "false" )
+       << ",\"seconds\":{\"read\":" << r.readSeconds
+       << ",\"eye\":" << r.eyeSeconds
+       << ",\"stem\":" << r.stemSeconds
+       << ",\"total\":" << r.totalSeconds << "}}" << std::endl;
+  out << line.str();
+};
+
+
+
+void writeResultCSVHeader(std::ostream &out){
+  out << "image,status,eye_status,eye_level,eye_initial_center_x,eye_initial_center_y,"
+         "eye_initial_radius,eye_initial_radius_x,eye_initial_radius_y,"
+         "eye_center_x,eye_center_y,eye_minor,eye_major,"
+         "stem_status,stem_level,stem_initial_center_x,stem_initial_center_y,"
+         "stem_initial_width,stem_center_x,stem_center_y,stem_width,"
+         "cached,read_seconds,eye_seconds,stem_seconds,total_seconds" << std::endl;
+};
+
+
+void writeResultCSV(std::ostream &out, const std::string &image, const ResultRecord &r){
+  std::stringstream line;
+  line << std::setprecision(10);
+  line << csvString( image ) << "," << fitStatusName( (FitStatus) r.stemStatus ) << ","
+       << r.eyeStatus << "," << fitLevelName( (FitLevel) r.eyeLevel ) << ","
+       << r.eyeInitialCenter[0] << "," << r.eyeInitialCenter[1] << ","
+       << r.eyeInitialRadius << "," << r.eyeInitialRadiusX << "," << r.eyeInitialRadiusY << ","
+       << r.eyeCenter[0] << "," << r.eyeCenter[1] << ","
+       << r.eyeMinor << "," << r.eyeMajor << ","
+       << r.stemStatus << "," << fitLevelName( (FitLevel) r.stemLevel ) << ","
+       << r.stemInitialCenter[0] << "," << r.stemInitialCenter[1] << ","
+       << r.stemInitialWidth << "," << r.stemCenter[0] << "," << r.stemCenter[1] << ","
+       << r.stemWidth << "," << r.cached << ","
+       << r.readSeconds << "," << r.eyeSeconds << ","
+       << r.stemSeconds << "," << r.totalSeconds << std::endl;
+  out << line.str();
+};
+
+
+
+ResultLog::ResultLog(const std::string &filename) : m_File( -1 ){
+  //A new log is created complete with its header by linking a temporary
+  //file, which fails if another process created it first
+  struct stat st;
+  if( stat( filename.c_str(), &st ) != 0 ){
+    std::stringstream tmp;
+    tmp << filename << ".tmp." << getpid();
+    int fd = open( tmp.str().c_str(), O_CREAT | O_EXCL | O_WRONLY, 0666 );
+    if( fd >= 0 ){
+      LogHeader header;
+      std::memcpy( header.magic, LogMagic, 4 );
+      header.version = LogVersion;
+      header.recordBytes = sizeof(ResultRecord);
+      header.reserved = 0;
+      bool written = write( fd, &header, sizeof(LogHeader) ) == (ssize_t) sizeof(LogHeader);
+      close( fd );
+      if( written ){
+        link( tmp.str().c_str(), filename.c_str() );
+      }
+      unlink( tmp.str().c_str() );
+    }
+  }
+
+  m_File = open( filename.c_str(), O_WRONLY | O_APPEND );
+};
+
+
+
+ResultLog::~ResultLog(){
+  if( m_File >= 0 ){
+    close( m_File );
+  }
+};
+
+
+
+bool ResultLog::Append(const std::string &image, const ResultRecord &record){
+  if( m_File < 0 ){
+    return false;
+  }
+  //Marker, then length, name and record covered by the CRC
+  uint32_t length = std::min( (uint32_t) image.size(), MaximumNameLength );
+  size_t covered = sizeof(uint32_t) + length + sizeof(ResultRecord);
+  std::vector<char> entry( 4 + covered + sizeof(uint32_t) );
+  std::memcpy( &entry[0], EntryMagic, 4 );
+  std::memcpy( &entry[4], &length, sizeof(uint32_t) );
+  std::memcpy( &entry[4 + sizeof(uint32_t)], image.data(), length );
+  std::memcpy( &entry[4 + sizeof(uint32_t) + length], &record, sizeof(ResultRecord) );
+  uint32_t crc = crc32Bytes( &entry[4], covered );
+  std::memcpy( &entry[4 + covered], &crc, sizeof(uint32_t) );
+  return write( m_File, &entry[0], entry.size() ) == (ssize_t) entry.size();
+};
+
+
+
+ResultLogReader::ResultLogReader(const std::string &filename)
+                                : m_File( filename.c_str(), std::ios::binary ), m_Valid( false ),
+                                  m_Position( sizeof(LogHeader) ), m_Size( 0 ), m_Skipped( 0 ){
+  LogHeader header;
+  if( m_File.read( (char *) &header, sizeof(LogHeader) ) ){
+    m_Valid = std::memcmp( header.magic, LogMagic, 4 ) == 0 &&
+              header.version == LogVersion &&
+              header.recordBytes == sizeof(ResultRecord);
+  }
+  //Entries appended after opening are not read
+  if( m_Valid ){
+    m_File.seekg( 0, std::ios::end );
+    m_Size = m_File.tellg();
+  }
+};
+
+
+
+bool ResultLogReader::ReadEntry(std::string &image, ResultRecord &record, std::streamoff &end){
+  m_File.clear();
+  m_File.seekg( m_Position );
+  char magic[4];
+  uint32_t length;
+  if( !m_File.read( magic, 4 ) || std::memcmp( magic, EntryMagic, 4 ) != 0 ||
+      !m_File.read( (char *) &length, sizeof(uint32_t) ) || length > MaximumNameLength ){
+    return false;
+  }
+  std::vector<char> covered( sizeof(uint32_t) + length + sizeof(ResultRecord) );
+  uint32_t crc;
+  std::memcpy( &covered[0], &length, sizeof(uint32_t) );
+  if( !m_File.read( &covered[sizeof(uint32_t)], length + sizeof(ResultRecord) ) ||
+      !m_File.read( (char *) &crc, sizeof(uint32_t) ) ||
+      crc != crc32Bytes( &covered[0], covered.size() ) ){
+    return false;
+  }
+  image.assign( &covered[sizeof(uint32_t)], length );
+  std::memcpy( &record, &covered[sizeof(uint32_t) + length], sizeof(ResultRecord) );
+  end = m_File.tellg();
+  return true;
+};
+
+
+
+bool ResultLogReader::Next(std::string &image, ResultRecord &record){
+  if( !m_Valid ){
+    return false;
+  }
+  //Entries start at the first marker with a matching CRC, bytes before it
+  //are from torn or corrupt entries
+  while( m_Position < m_Size ){
+    std::streamoff end;
+    if( ReadEntry( image, record, end ) ){
+      m_Position = end;
+      return true;
+    }
+    m_Position++;
+    m_Skipped++;
+  }
+  return false;
+};
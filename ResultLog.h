@@ -0,0 +1,137 @@
+#ifndef RESULTLOG_H
+#define RESULTLOG_H
+
+
+//Machine readable per image results of EstimateEyeAndStem.
+//
+//A ResultRecord holds the eye and stem estimates, status codes and stage
+//timings of one image. Records are written as one JSON object per line,
+//as CSV rows or appended to a binary result log.
+//
+//The binary log is a file header followed by entries of a marker, the
+//image name length, the name, the fixed size record and a CRC-32 of the
+//length, name and record. Each entry is appended with a single write to a
+//file opened with O_APPEND, so several processes on one host can append to
+//the same log. O_APPEND is not atomic on NFS and some other network file
+//systems: concurrent appends from several hosts can overwrite or
+//interleave each other, give each host its own log there. A reader skips
+//torn or corrupt entries, e.g. from a crashed writer, by searching for the
+//next marker that starts an entry with a matching CRC. See ReadResultLog to
+//print or summarize a log.
+
+
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <cstdint>
+
+#include "EyeAndStemFitting.h"
+
+
+//Fixed size layout stored in the binary log. Geometry of failed fits is
+//0 for positions and -1 for sizes, widths are optic nerve widths (twice
+//Stem::width).
+struct ResultRecord{
+  int32_t eyeStatus;
+  int32_t stemStatus;
+  int32_t eyeLevel;
+  int32_t stemLevel;
+  //1 if the result was loaded from the result cache
+  int32_t cached;
+  int32_t reserved;
+
+  double eyeInitialCenter[2];
+  double eyeInitialRadius;
+  double eyeInitialRadiusX;
+  double eyeInitialRadiusY;
+  double eyeCenter[2];
+  double eyeMinor;
+  double eyeMajor;
+
+  double stemInitialCenter[2];
+  double stemInitialWidth;
+  double stemCenter[2];
+  double stemWidth;
+
+  //Wall clock seconds of reading the image, fitEye, fitStem and the whole
+  //image including the overlay
+  double readSeconds;
+  double eyeSeconds;
+  double stemSeconds;
+  double totalSeconds;
+};
+
+
+ResultRecord makeResultRecord(const Eye &eye, const Stem &stem);
+
+
+//One JSON object per line
+void writeResultJSON(std::ostream &out, const std::string &image, const ResultRecord &record);
+
+void writeResultCSVHeader(std::ostream &out);
+void writeResultCSV(std::ostream &out, const std::string &image, const ResultRecord &record);
+
+
+
+class ResultLog{
+
+  public:
+
+  //Opens the log for appending, creates it if needed
+  ResultLog(const std::string &filename);
+  ~ResultLog();
+
+  bool IsOpen() const{
+    return m_File >= 0;
+  };
+
+  bool Append(const std::string &image, const ResultRecord &record);
+
+
+  private:
+
+    ResultLog(const ResultLog &);
+    ResultLog &operator=(const ResultLog &);
+
+    int m_File;
+
+};
+
+
+
+class ResultLogReader{
+
+  public:
+
+  ResultLogReader(const std::string &filename);
+
+  //False if the file could not be read or is not a result log
+  bool IsValid() const{
+    return m_Valid;
+  };
+
+  //Next complete entry, false at the end of the log. Corrupt entries are
+  //skipped.
+  bool Next(std::string &image, ResultRecord &record);
+
+  //Bytes skipped so far because they did not belong to a valid entry
+  unsigned long NumberOfSkippedBytes() const{
+    return m_Skipped;
+  };
+
+
+  private:
+
+    //Entry starting at m_Position, false if there is no valid one
+    bool ReadEntry(std::string &image, ResultRecord &record, std::streamoff &end);
+
+    std::ifstream m_File;
+    bool m_Valid;
+    std::streamoff m_Position;
+    std::streamoff m_Size;
+    unsigned long m_Skipped;
+
+};
+
+
+#endif
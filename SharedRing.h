@@ -0,0 +1,219 @@
+#ifndef SHAREDRING_H
+#define SHAREDRING_H
+
+
+//Ring of fixed size slots in POSIX shared memory with a single writer and
+//any number of readers, see LiveFrames.h for the frame and result rings.
+//
+//Each slot is guarded by a sequence lock: the writer marks the slot odd,
+//writes the payload and marks it with twice the sequence number of the
+//payload, then publishes the sequence number in the ring header. Readers
+//never block the writer, they read the newest (or any still present)
+//payload directly from the mapping and check afterwards that the slot was
+//not overwritten meanwhile.
+//
+//The writer creates the ring and removes its name when destroyed, readers
+//open it by name.
+
+
+#include <string>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+#if ATOMIC_LLONG_LOCK_FREE != 2
+#error "SharedRing requires lock free 64 bit atomics"
+#endif
+
+
+class SharedRing{
+
+  public:
+
+    struct Header{
+      uint32_t magic;
+      uint32_t numberOfSlots;
+      uint64_t slotBytes;
+      //Sequence number of the newest complete payload, 0 for none
+      std::atomic<uint64_t> published;
+      //Set by the writer when no further payloads follow
+      std::atomic<uint32_t> closed;
+    };
+
+    static const uint32_t Magic = 0x53524e47;
+    //Slot sequence and payload start on separate cache lines
+    static const uint64_t Alignment = 64;
+
+
+  //Create a ring for payloads of at most payloadBytes, replacing a ring of
+  //the same name. Returns NULL on failure.
+  static std::unique_ptr<SharedRing> Create(const std::string &name, uint32_t numberOfSlots,
+                                            uint64_t payloadBytes){
+    uint64_t slotBytes = Align( Alignment + payloadBytes );
+    uint64_t size = Align( sizeof(Header) ) + numberOfSlots * slotBytes;
+    shm_unlink( name.c_str() );
+    int fd = shm_open( name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0666 );
+    if( fd < 0 ){
+      return NULL;
+    }
+    if( ftruncate( fd, size ) != 0 ){
+      close( fd );
+      shm_unlink( name.c_str() );
+      return NULL;
+    }
+    std::unique_ptr<SharedRing> ring( new SharedRing( name, fd, size, true ) );
+    if( ring->m_Memory == NULL ){
+      return NULL;
+    }
+    //The new mapping is zero filled, all slots have sequence 0
+    Header *header = ring->GetHeader();
+    header->numberOfSlots = numberOfSlots;
+    header->slotBytes = slotBytes;
+    header->published.store( 0 );
+    header->closed.store( 0 );
+    std::atomic_thread_fence( std::memory_order_release );
+    header->magic = Magic;
+    return ring;
+  };
+
+
+  //Open an existing ring, returns NULL if there is none
+  static std::unique_ptr<SharedRing> Open(const std::string &name){
+    int fd = shm_open( name.c_str(), O_RDWR, 0666 );
+    if( fd < 0 ){
+      return NULL;
+    }
+    struct stat st;
+    if( fstat( fd, &st ) != 0 || (uint64_t) st.st_size < sizeof(Header) ){
+      close( fd );
+      return NULL;
+    }
+    std::unique_ptr<SharedRing> ring( new SharedRing( name, fd, st.st_size, false ) );
+    if( ring->m_Memory == NULL || ring->GetHeader()->magic != Magic ){
+      return NULL;
+    }
+    std::atomic_thread_fence( std::memory_order_acquire );
+    Header *header = ring->GetHeader();
+    if( ring->m_Size < Align( sizeof(Header) ) + header->numberOfSlots * header->slotBytes ){
+      return NULL;
+    }
+    return ring;
+  };
+
+
+  ~SharedRing(){
+    if( m_Memory != NULL ){
+      munmap( m_Memory, m_Size );
+    }
+    if( m_Owner ){
+      shm_unlink( m_Name.c_str() );
+    }
+  };
+
+
+  uint64_t PayloadBytes() const{
+    return GetHeader()->slotBytes - Alignment;
+  };
+
+  uint32_t NumberOfSlots() const{
+    return GetHeader()->numberOfSlots;
+  };
+
+
+  //Writer: payload of the next sequence number, to be filled and
+  //published by EndWrite
+  unsigned char *BeginWrite(uint64_t &sequence){
+    sequence = GetHeader()->published.load( std::memory_order_relaxed ) + 1;
+    std::atomic<uint64_t> &slotSequence = SlotSequence( sequence );
+    slotSequence.store( 2 * sequence - 1, std::memory_order_relaxed );
+    std::atomic_thread_fence( std::memory_order_release );
+    return Payload( sequence );
+  };
+
+  void EndWrite(uint64_t sequence){
+    SlotSequence( sequence ).store( 2 * sequence, std::memory_order_release );
+    GetHeader()->published.store( sequence, std::memory_order_release );
+  };
+
+  void Close(){
+    GetHeader()->closed.store( 1, std::memory_order_release );
+  };
+
+
+  //Reader: sequence number of the newest payload, 0 for none
+  uint64_t Newest() const{
+    return GetHeader()->published.load( std::memory_order_acquire );
+  };
+
+  bool IsClosed() const{
+    return GetHeader()->closed.load( std::memory_order_acquire ) != 0;
+  };
+
+  //Payload of sequence, NULL if it was already overwritten or is being
+  //written. The payload is valid if EndRead returns true afterwards.
+  const unsigned char *BeginRead(uint64_t sequence) const{
+    if( sequence == 0 ||
+        SlotSequence( sequence ).load( std::memory_order_acquire ) != 2 * sequence ){
+      return NULL;
+    }
+    return Payload( sequence );
+  };
+
+  bool EndRead(uint64_t sequence) const{
+    std::atomic_thread_fence( std::memory_order_acquire );
+    return SlotSequence( sequence ).load( std::memory_order_relaxed ) == 2 * sequence;
+  };
+
+
+
+  private:
+
+    SharedRing(const std::string &name, int fd, uint64_t size, bool owner)
+              : m_Name( name ), m_Size( size ), m_Owner( owner ){
+      m_Memory = (unsigned char *) mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+      close( fd );
+      if( m_Memory == MAP_FAILED ){
+        m_Memory = NULL;
+      }
+    };
+
+
+    static uint64_t Align(uint64_t bytes){
+      return ( bytes + Alignment - 1 ) / Alignment * Alignment;
+    };
+
+    Header *GetHeader() const{
+      return (Header *) m_Memory;
+    };
+
+    unsigned char *Slot(uint64_t sequence) const{
+      Header *header = GetHeader();
+      return m_Memory + Align( sizeof(Header) ) +
+             ( ( sequence - 1 ) % header->numberOfSlots ) * header->slotBytes;
+    };
+
+    std::atomic<uint64_t> &SlotSequence(uint64_t sequence) const{
+      return *(std::atomic<uint64_t> *) Slot( sequence );
+    };
+
+    unsigned char *Payload(uint64_t sequence) const{
+      return Slot( sequence ) + Alignment;
+    };
+
+
+    std::string m_Name;
+    unsigned char *m_Memory;
+    uint64_t m_Size;
+    bool m_Owner;
+
+};
+
+
+#endif
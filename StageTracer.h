@@ -0,0 +1,387 @@
+#ifndef STAGETRACER_H
+#define STAGETRACER_H
+
+
+//Runtime enabled tracer for the pipeline stages.
+//
+//Stages are marked with TraceSpan objects which may be nested. Each thread
+//records into its own buffer, when tracing is disabled a span costs a single
+//atomic load. Buffers of finished threads are reused by new threads, so
+//there are at most as many buffers as threads recorded at the same time.
+//Tasks running on other threads continue the nesting of the thread that
+//started them with TraceNesting. The recorded spans can be written as Chrome trace event JSON
+//(load in chrome://tracing or https://ui.perfetto.dev), as a flat CSV file
+//or summarized per stage name.
+//
+//If MemoryTracker is enabled each span also records the peak of live pixel
+//buffer bytes and the bytes allocated while it was active.
+
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+
+#include "MemoryTracker.h"
+
+
+class StageTracer{
+
+  public:
+
+    struct Event{
+      const char *name;
+      //Nanoseconds since the tracer was created
+      long long start;
+      long long end;
+      int depth;
+      //Peak live and allocated pixel buffer bytes, -1 if not tracked
+      long long peakBytes;
+      long long allocatedBytes;
+    };
+
+    struct ThreadBuffer{
+      int id;
+      int depth;
+      std::mutex mutex;
+      std::vector<Event> events;
+    };
+
+
+  static StageTracer &Instance(){
+    static StageTracer tracer;
+    return tracer;
+  };
+
+
+  void SetEnabled(bool enabled){
+    m_Enabled.store( enabled, std::memory_order_relaxed );
+  };
+
+  bool IsEnabled() const{
+    return m_Enabled.load( std::memory_order_relaxed );
+  };
+
+
+  long long Now() const{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now() - m_Start ).count();
+  };
+
+
+  //Buffer of the calling thread, taken on first use from the buffers of
+  //finished threads or created
+  ThreadBuffer &Buffer(){
+    static thread_local BufferHolder holder;
+    if( holder.buffer == NULL ){
+      std::lock_guard<std::mutex> lock( m_Mutex );
+      if( m_Free.empty() ){
+        m_Buffers.push_back( std::unique_ptr<ThreadBuffer>( new ThreadBuffer() ) );
+        holder.buffer = m_Buffers.back().get();
+        holder.buffer->id = ++m_NextId;
+      }
+      else{
+        holder.buffer = m_Free.back();
+        m_Free.pop_back();
+      }
+      holder.buffer->depth = 0;
+    }
+    return *holder.buffer;
+  };
+
+  //Nesting depth of the spans open on the calling thread, 0 if disabled
+  int Depth(){
+    if( !IsEnabled() ){
+      return 0;
+    }
+    return Buffer().depth;
+  };
+
+
+  void Record(ThreadBuffer &buffer, const Event &event){
+    std::lock_guard<std::mutex> lock( buffer.mutex );
+    buffer.events.push_back( event );
+  };
+
+
+  //Remove all recorded events and the buffers of finished threads
+  void Clear(){
+    std::lock_guard<std::mutex> lock( m_Mutex );
+    for(unsigned int i=0; i<m_Free.size(); i++){
+      for(unsigned int j=0; j<m_Buffers.size(); j++){
+        if( m_Buffers[j].get() == m_Free[i] ){
+          m_Buffers.erase( m_Buffers.begin() + j );
+          break;
+        }
+      }
+    }
+    m_Free.clear();
+    for(unsigned int i=0; i<m_Buffers.size(); i++){
+      std::lock_guard<std::mutex> bufferLock( m_Buffers[i]->mutex );
+      m_Buffers[i]->events.clear();
+    }
+  };
+
+
+
+  //Chrome trace event format, complete events with microsecond timestamps
+  void WriteChromeTrace(std::ostream &out){
+    std::lock_guard<std::mutex> lock( m_Mutex );
+    out << "{\"traceEvents\":[" << std::endl;
+    bool first = true;
+    out << std::fixed << std::setprecision(3);
+    for(unsigned int i=0; i<m_Buffers.size(); i++){
+      std::lock_guard<std::mutex> bufferLock( m_Buffers[i]->mutex );
+      const std::vector<Event> &events = m_Buffers[i]->events;
+      for(unsigned int j=0; j<events.size(); j++){
+        if( !first ){
+          out << "," << std::endl;
+        }
+        first = false;
+        out << "{\"name\":\"" << events[j].name << "\",\"cat\":\"stage\",\"ph\":\"X\""
+            << ",\"ts\":" << events[j].start / 1000.0
+            << ",\"dur\":" << ( events[j].end - events[j].start ) / 1000.0
+            << ",\"pid\":1,\"tid\":" << m_Buffers[i]->id;
+        if( events[j].peakBytes >= 0 ){
+          out << ",\"args\":{\"peak_bytes\":" << events[j].peakBytes
+              << ",\"allocated_bytes\":" << events[j].allocatedBytes << "}";
+        }
+        out << "}";
+      }
+    }
+    out << std::endl << "],\"displayTimeUnit\":\"ms\"}" << std::endl;
+  };
+
+
+  //One line per span: thread, nesting depth, name, start and duration in
+  //microseconds, peak and allocated bytes (-1 if not tracked)
+  void WriteCSV(std::ostream &out){
+    std::lock_guard<std::mutex> lock( m_Mutex );
+    out << "thread,depth,name,start_us,duration_us,peak_bytes,allocated_bytes" << std::endl;
+    out << std::fixed << std::setprecision(3);
+    for(unsigned int i=0; i<m_Buffers.size(); i++){
+      std::lock_guard<std::mutex> bufferLock( m_Buffers[i]->mutex );
+      const std::vector<Event> &events = m_Buffers[i]->events;
+      for(unsigned int j=0; j<events.size(); j++){
+        out << m_Buffers[i]->id << "," << events[j].depth << "," << events[j].name << ","
+            << events[j].start / 1000.0 << "," << ( events[j].end - events[j].start ) / 1000.0
+            << "," << events[j].peakBytes << "," << events[j].allocatedBytes << std::endl;
+      }
+    }
+  };
+
+
+  //Write Chrome trace JSON, or CSV if filename ends in .csv
+  bool Write(const std::string &filename){
+    std::ofstream file( filename.c_str() );
+    if( !file ){
+      std::cerr << "Could not open trace file " << filename << std::endl;
+      return false;
+    }
+    if( filename.size() >= 4 && filename.compare( filename.size() - 4, 4, ".csv" ) == 0 ){
+      WriteCSV( file );
+    }
+    else{
+      WriteChromeTrace( file );
+    }
+    return true;
+  };
+
+
+  //Number of calls and mean duration in seconds per stage name, in order of
+  //first start, indented by nesting depth. With memory tracking also the
+  //maximal peak and mean allocated pixel buffer megabytes.
+  void PrintSummary(std::ostream &out){
+    struct Summary{
+      long long firstStart;
+      int depth;
+      unsigned int count;
+      long long total;
+      long long peakBytes;
+      long long allocatedBytes;
+    };
+    bool hasMemory = false;
+    std::map<std::string, Summary> summaries;
+
+    {
+      std::lock_guard<std::mutex> lock( m_Mutex );
+      for(unsigned int i=0; i<m_Buffers.size(); i++){
+        std::lock_guard<std::mutex> bufferLock( m_Buffers[i]->mutex );
+        const std::vector<Event> &events = m_Buffers[i]->events;
+        for(unsigned int j=0; j<events.size(); j++){
+          std::map<std::string, Summary>::iterator it = summaries.find( events[j].name );
+          if( it == summaries.end() ){
+            Summary s = { events[j].start, events[j].depth, 0, 0, 0, 0 };
+            it = summaries.insert( std::make_pair( std::string(events[j].name), s ) ).first;
+          }
+          it->second.firstStart = std::min( it->second.firstStart, events[j].start );
+          it->second.count++;
+          it->second.total += events[j].end - events[j].start;
+          if( events[j].peakBytes >= 0 ){
+            hasMemory = true;
+            it->second.peakBytes = std::max( it->second.peakBytes, events[j].peakBytes );
+            it->second.allocatedBytes += events[j].allocatedBytes;
+          }
+        }
+      }
+    }
+
+    //Events are recorded when a span ends, order by start instead
+    std::vector< std::pair<long long, std::string> > ordered;
+    for(std::map<std::string, Summary>::iterator it = summaries.begin(); it != summaries.end(); ++it){
+      ordered.push_back( std::make_pair( it->second.firstStart, it->first ) );
+    }
+    std::sort( ordered.begin(), ordered.end() );
+
+    out << ( hasMemory ? "Times, peak MB, allocated MB" : "Times" ) << std::endl;
+    for(unsigned int i=0; i<ordered.size(); i++){
+      const Summary &s = summaries[ ordered[i].second ];
+      out << std::string( 2 * s.depth, ' ' ) << std::left << std::setw( std::max(1, 24 - 2 * s.depth) )
+          << ordered[i].second << std::right << std::setw(8) << s.count << " "
+          << std::setw(12) << std::setprecision(6) << std::fixed
+          << s.total / 1.0e9 / s.count;
+      if( hasMemory ){
+        out << std::setw(10) << std::setprecision(2) << s.peakBytes / 1048576.0
+            << std::setw(10) << s.allocatedBytes / 1048576.0 / s.count;
+      }
+      out << std::endl;
+    }
+  };
+
+
+
+  private:
+
+    //Returns the buffer of a thread for reuse when the thread ends
+    struct BufferHolder{
+      ThreadBuffer *buffer = NULL;
+      ~BufferHolder(){
+        if( buffer != NULL ){
+          StageTracer::Instance().Release( buffer );
+        }
+      };
+    };
+
+
+    StageTracer() : m_Enabled(false), m_Start( std::chrono::steady_clock::now() ), m_NextId( 0 ) {};
+
+    void Release(ThreadBuffer *buffer){
+      std::lock_guard<std::mutex> lock( m_Mutex );
+      m_Free.push_back( buffer );
+    };
+
+
+    std::atomic<bool> m_Enabled;
+    std::chrono::steady_clock::time_point m_Start;
+    std::mutex m_Mutex;
+    std::vector< std::unique_ptr<ThreadBuffer> > m_Buffers;
+    //Buffers of finished threads, still holding their events
+    std::vector<ThreadBuffer *> m_Free;
+    int m_NextId;
+
+};
+
+
+
+//Marks a stage. The span starts on construction and ends with Stop or when
+//it goes out of scope. Names must be string literals.
+class TraceSpan{
+
+  public:
+
+  TraceSpan(const char *name) : m_Buffer(NULL), m_TrackMemory(false) {
+    StageTracer &tracer = StageTracer::Instance();
+    if( !tracer.IsEnabled() ){
+      return;
+    }
+    m_Buffer = &tracer.Buffer();
+    m_Event.name = name;
+    m_Event.depth = m_Buffer->depth++;
+    m_Event.peakBytes = -1;
+    m_Event.allocatedBytes = -1;
+    MemoryTracker &memory = MemoryTracker::Instance();
+    m_TrackMemory = memory.IsEnabled();
+    if( m_TrackMemory ){
+      memory.PushWatermark( &m_Watermark );
+      m_Event.allocatedBytes = memory.TotalAllocated();
+    }
+    m_Event.start = tracer.Now();
+  };
+
+  ~TraceSpan(){
+    Stop();
+  };
+
+  void Stop(){
+    if( m_Buffer == NULL ){
+      return;
+    }
+    StageTracer &tracer = StageTracer::Instance();
+    m_Event.end = tracer.Now();
+    if( m_TrackMemory ){
+      MemoryTracker &memory = MemoryTracker::Instance();
+      m_Event.peakBytes = memory.PopWatermark( &m_Watermark );
+      m_Event.allocatedBytes = memory.TotalAllocated() - m_Event.allocatedBytes;
+    }
+    m_Buffer->depth--;
+    tracer.Record( *m_Buffer, m_Event );
+    m_Buffer = NULL;
+  };
+
+
+  private:
+
+    TraceSpan(const TraceSpan &);
+    TraceSpan &operator=(const TraceSpan &);
+
+    StageTracer::ThreadBuffer *m_Buffer;
+    StageTracer::Event m_Event;
+    bool m_TrackMemory;
+    MemoryTracker::Watermark m_Watermark;
+
+};
+
+
+
+//Spans opened on the calling thread while in scope are nested at depth,
+//the depth of the thread that started the work, see StageTracer::Depth
+class TraceNesting{
+
+  public:
+
+  TraceNesting(int depth) : m_Buffer(NULL), m_Depth(0) {
+    StageTracer &tracer = StageTracer::Instance();
+    if( !tracer.IsEnabled() ){
+      return;
+    }
+    m_Buffer = &tracer.Buffer();
+    m_Depth = m_Buffer->depth;
+    m_Buffer->depth = depth;
+  };
+
+  ~TraceNesting(){
+    if( m_Buffer != NULL ){
+      m_Buffer->depth = m_Depth;
+    }
+  };
+
+
+  private:
+
+    TraceNesting(const TraceNesting &);
+    TraceNesting &operator=(const TraceNesting &);
+
+    StageTracer::ThreadBuffer *m_Buffer;
+    int m_Depth;
+
+};
+
+
+#endif
@@ -0,0 +1,324 @@
+#ifndef TASKGRAPH_H
+#define TASKGRAPH_H
+
+
+//Executes a small graph of dependent tasks on work stealing threads.
+//
+//Tasks are added with the ids of the tasks they depend on, so the order
+//of Add is a valid sequential order. Run executes all tasks: each thread
+//owns a queue, tasks that become ready are pushed onto the queue of the
+//thread that completed their last dependency and taken from its back,
+//idle threads steal from the front of the other queues. The calling
+//thread takes part, with a single thread the tasks run in the order they
+//were added.
+//
+//The other threads come from a process wide pool. Its threads are started
+//when a run first needs them and wait between runs, graphs are built per
+//fit and starting threads for each would cost more than small stages.
+//A helper that has not started when the calling thread finished all tasks
+//is withdrawn, so nested graphs complete even if all pool threads are busy.
+//
+//Each task is traced as a TraceSpan with its name, nested in the spans
+//open on the thread calling Run. If a task throws, the
+//tasks not yet started are skipped and Run rethrows the first exception.
+//Tasks only communicate through their dependencies, results do not
+//depend on the number of threads. Tasks that may run concurrently must not
+//update filters on the same ITK image, since an update sets the requested
+//region of its input. Give each its own view, see ITKFilterFunctions::View.
+
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+#include <algorithm>
+#include <utility>
+
+#include "StageTracer.h"
+
+
+class TaskGraph{
+
+  public:
+
+    typedef unsigned int TaskId;
+
+
+  //Zero threads uses the number of hardware threads
+  TaskGraph(unsigned int numberOfThreads = 0) : m_NumberOfThreads( numberOfThreads ), m_Depth( 0 ), m_Helpers( 0 ) {
+    if( m_NumberOfThreads == 0 ){
+      m_NumberOfThreads = std::max( 1u, std::thread::hardware_concurrency() );
+    }
+  };
+
+
+  TaskId Add(const char *name, std::function<void()> work,
+             const std::vector<TaskId> &dependencies = std::vector<TaskId>()){
+    TaskId id = m_Tasks.size();
+    std::unique_ptr<Task> task( new Task() );
+    task->name = name;
+    task->work = work;
+    task->remaining = dependencies.size();
+    for(unsigned int i=0; i<dependencies.size(); i++){
+      m_Tasks[ dependencies[i] ]->dependents.push_back( id );
+    }
+    m_Tasks.push_back( std::move( task ) );
+    return id;
+  };
+
+
+  void Run(){
+    unsigned int nThreads = std::min( m_NumberOfThreads, (unsigned int) m_Tasks.size() );
+    if( nThreads <= 1 ){
+      for(unsigned int i=0; i<m_Tasks.size(); i++){
+        TraceSpan span( m_Tasks[i]->name );
+        m_Tasks[i]->work();
+      }
+      return;
+    }
+
+    m_Queues.clear();
+    for(unsigned int i=0; i<nThreads; i++){
+      m_Queues.push_back( std::unique_ptr<Queue>( new Queue() ) );
+    }
+    m_Depth = StageTracer::Instance().Depth();
+    m_Pending = m_Tasks.size();
+    m_Ready = 0;
+    m_Failed = false;
+    m_Error = NULL;
+
+    unsigned int next = 0;
+    for(TaskId id=0; id<m_Tasks.size(); id++){
+      if( m_Tasks[id]->remaining == 0 ){
+        Push( next++ % nThreads, id );
+      }
+    }
+
+    Workers &workers = Workers::Instance();
+    workers.Start( this, nThreads );
+    Work( 0 );
+    workers.Finish( this );
+
+    if( m_Error ){
+      std::rethrow_exception( m_Error );
+    }
+  };
+
+
+
+  private:
+
+    //Pool of threads running Work for the queues of graphs other than the
+    //first, joined at exit
+    class Workers{
+
+      public:
+
+      static Workers &Instance(){
+        static Workers workers;
+        return workers;
+      };
+
+
+      //Work on queues 1 to nThreads-1 of graph
+      void Start(TaskGraph *graph, unsigned int nThreads){
+        {
+          std::lock_guard<std::mutex> lock( m_Mutex );
+          while( m_Threads.size() + 1 < nThreads ){
+            m_Threads.push_back( std::thread( &Workers::Loop, this ) );
+          }
+          graph->m_Helpers = 0;
+          for(unsigned int i=1; i<nThreads; i++){
+            m_Jobs.push_back( Job( graph, i ) );
+          }
+        }
+        m_Wake.notify_all();
+      };
+
+
+      //Withdraws the helpers of graph not yet started and waits for the
+      //others, which return once all tasks are done
+      void Finish(TaskGraph *graph){
+        std::unique_lock<std::mutex> lock( m_Mutex );
+        for(std::deque<Job>::iterator it = m_Jobs.begin(); it != m_Jobs.end(); ){
+          it = it->first == graph ? m_Jobs.erase( it ) : it + 1;
+        }
+        m_Done.wait( lock, [graph]{ return graph->m_Helpers == 0; } );
+      };
+
+
+
+      private:
+
+        typedef std::pair<TaskGraph *, unsigned int> Job;
+
+
+        Workers() : m_Stop( false ) {};
+
+        ~Workers(){
+          {
+            std::lock_guard<std::mutex> lock( m_Mutex );
+            m_Stop = true;
+          }
+          m_Wake.notify_all();
+          for(unsigned int i=0; i<m_Threads.size(); i++){
+            m_Threads[i].join();
+          }
+        };
+
+        Workers(const Workers &);
+        Workers &operator=(const Workers &);
+
+
+        void Loop(){
+          std::unique_lock<std::mutex> lock( m_Mutex );
+          while( true ){
+            m_Wake.wait( lock, [this]{ return m_Stop || !m_Jobs.empty(); } );
+            if( m_Jobs.empty() ){
+              return;
+            }
+            Job job = m_Jobs.front();
+            m_Jobs.pop_front();
+            job.first->m_Helpers++;
+            lock.unlock();
+            job.first->Work( job.second );
+            lock.lock();
+            if( --job.first->m_Helpers == 0 ){
+              m_Done.notify_all();
+            }
+          }
+        };
+
+
+        std::mutex m_Mutex;
+        std::condition_variable m_Wake;
+        std::condition_variable m_Done;
+        std::vector<std::thread> m_Threads;
+        std::deque<Job> m_Jobs;
+        bool m_Stop;
+
+    };
+
+
+    struct Task{
+      const char *name;
+      std::function<void()> work;
+      std::atomic<unsigned int> remaining;
+      std::vector<TaskId> dependents;
+    };
+
+    struct Queue{
+      std::mutex mutex;
+      std::deque<TaskId> tasks;
+    };
+
+
+    void Push(unsigned int queue, TaskId id){
+      {
+        std::lock_guard<std::mutex> lock( m_Queues[queue]->mutex );
+        m_Queues[queue]->tasks.push_back( id );
+      }
+      {
+        std::lock_guard<std::mutex> lock( m_Mutex );
+        m_Ready++;
+      }
+      m_Wake.notify_all();
+    };
+
+
+    //Newest task of the own queue or oldest task of another queue
+    bool Pop(unsigned int queue, TaskId &id){
+      for(unsigned int i=0; i<m_Queues.size(); i++){
+        Queue &q = *m_Queues[ ( queue + i ) % m_Queues.size() ];
+        std::lock_guard<std::mutex> lock( q.mutex );
+        if( q.tasks.empty() ){
+          continue;
+        }
+        if( i == 0 ){
+          id = q.tasks.back();
+          q.tasks.pop_back();
+        }
+        else{
+          id = q.tasks.front();
+          q.tasks.pop_front();
+        }
+        std::lock_guard<std::mutex> readyLock( m_Mutex );
+        m_Ready--;
+        return true;
+      }
+      return false;
+    };
+
+
+    void Execute(unsigned int queue, TaskId id){
+      Task &task = *m_Tasks[id];
+      if( !m_Failed.load() ){
+        try{
+          TraceNesting nesting( m_Depth );
+          TraceSpan span( task.name );
+          task.work();
+        }
+        catch( ... ){
+          std::lock_guard<std::mutex> lock( m_Mutex );
+          if( !m_Error ){
+            m_Error = std::current_exception();
+          }
+          m_Failed = true;
+        }
+      }
+
+      //Dependents of failed tasks are skipped as well
+      for(unsigned int i=0; i<task.dependents.size(); i++){
+        if( --m_Tasks[ task.dependents[i] ]->remaining == 0 ){
+          Push( queue, task.dependents[i] );
+        }
+      }
+
+      std::lock_guard<std::mutex> lock( m_Mutex );
+      if( --m_Pending == 0 ){
+        m_Wake.notify_all();
+      }
+    };
+
+
+    void Work(unsigned int queue){
+      while( true ){
+        TaskId id;
+        if( Pop( queue, id ) ){
+          Execute( queue, id );
+          continue;
+        }
+        std::unique_lock<std::mutex> lock( m_Mutex );
+        if( m_Pending == 0 ){
+          return;
+        }
+        m_Wake.wait( lock, [this]{ return m_Pending == 0 || m_Ready > 0; } );
+      }
+    };
+
+
+    unsigned int m_NumberOfThreads;
+    std::vector< std::unique_ptr<Task> > m_Tasks;
+    std::vector< std::unique_ptr<Queue> > m_Queues;
+
+    std::mutex m_Mutex;
+    std::condition_variable m_Wake;
+    //Tasks not yet completed and tasks waiting in a queue
+    unsigned int m_Pending;
+    int m_Ready;
+    std::atomic<bool> m_Failed;
+    std::exception_ptr m_Error;
+    //Nesting depth of the spans of the tasks, see TraceNesting
+    int m_Depth;
+    //Pool threads working on this graph, guarded by the mutex of Workers
+    unsigned int m_Helpers;
+
+};
+
+
+#endif
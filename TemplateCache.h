@@ -0,0 +1,182 @@
+#ifndef TEMPLATECACHE_H
+#define TEMPLATECACHE_H
+
+
+//Process wide cache of the fixed images and masks of the eye and stem
+//registrations, see FitParameters::templateCache.
+//
+//The eye ring and mask only depend on the image size and spacing, the
+//radii, the ring factor and the center. The stem bars and mask only depend
+//on the region size and spacing, the bar rows and columns relative to the
+//center and the smoothing. Templates are keyed by this geometry without
+//the center, the anchor. Each key has a fixed build anchor, cached
+//templates are always built there and returned translated to the anchor
+//of the lookup: a new image sharing the pixel buffer, with the region
+//shifted by the difference of the anchors and the origin of the lookup.
+//Hits and misses therefore return the same pixels, results do not depend
+//on which fits ran before. Shared templates are read only.
+//
+//Building at the anchor of the lookup would not give the same pixels:
+//CreateEllipseImage samples the ellipse on a coarse grid fixed to the
+//image origin, so whole pixel shifts change the partial pixel values at
+//the border of the ellipse. A template at the build anchor only resembles
+//the one built at the anchor of the lookup if everything but the zero
+//background lies inside the image at both anchors, with a margin for the
+//smoothing. Callers check this and bypass the cache otherwise. Each kind of
+//template has its own least recently used cache.
+
+
+#include <string>
+#include <functional>
+#include <ostream>
+#include <mutex>
+
+#include "EyeAndStemFitting.h"
+#include "LRUCache.h"
+
+
+class TemplateCache{
+
+  public:
+
+  enum Kind{
+    EYE_RING,
+    EYE_MASK,
+    STEM_BARS,
+    STEM_MASK,
+    NUMBER_OF_KINDS
+  };
+
+
+  static TemplateCache &Instance(){
+    static TemplateCache cache;
+    return cache;
+  };
+
+
+  //Entries per kind of template
+  void SetCapacity(unsigned int capacity){
+    for(unsigned int i=0; i<NUMBER_OF_KINDS; i++){
+      m_Caches[i].SetCapacity( capacity );
+    }
+  };
+
+
+  //Template of kind for the geometry key at anchor in an image with origin.
+  //build creates the template at the anchor it is given. On a miss it is
+  //built at buildAnchor, which has to be the same for all lookups of key,
+  //and cached if cacheable. A template that is not cacheable is built at
+  //anchor without a lookup and counted as bypassed.
+  template <typename TImage>
+  typename TImage::Pointer Get(Kind kind, const std::string &key,
+                               const typename TImage::IndexType &anchor,
+                               const typename TImage::IndexType &buildAnchor,
+                               const typename TImage::PointType &origin, bool cacheable,
+                               const std::function<typename TImage::Pointer(const typename TImage::IndexType &)> &build){
+    if( !cacheable ){
+      {
+        std::lock_guard<std::mutex> lock( m_Mutex );
+        m_Bypassed[kind]++;
+      }
+      return build( anchor );
+    }
+
+    Entry entry;
+    if( m_Caches[kind].Get( key, entry ) ){
+      TImage *image = dynamic_cast<TImage *>( entry.image.GetPointer() );
+      if( image != NULL ){
+        return Translate<TImage>( image, anchor - entry.anchor, origin );
+      }
+    }
+
+    typename TImage::Pointer image = build( buildAnchor );
+    entry.image = image.GetPointer();
+    entry.anchor = buildAnchor;
+    m_Caches[kind].Put( key, entry );
+    return Translate<TImage>( image, anchor - buildAnchor, origin );
+  };
+
+
+  //Removes all templates, the statistics are kept
+  void Clear(){
+    for(unsigned int i=0; i<NUMBER_OF_KINDS; i++){
+      m_Caches[i].Clear();
+    }
+  };
+
+
+  unsigned long NumberOfHits(Kind kind) const{
+    return m_Caches[kind].NumberOfHits();
+  };
+
+  unsigned long NumberOfMisses(Kind kind) const{
+    return m_Caches[kind].NumberOfMisses();
+  };
+
+  unsigned long NumberOfBypassed(Kind kind) const{
+    std::lock_guard<std::mutex> lock( m_Mutex );
+    return m_Bypassed[kind];
+  };
+
+
+  //Hits, misses, bypassed lookups and hit rate of each kind that was used
+  void PrintStatistics(std::ostream &out) const{
+    static const char *names[NUMBER_OF_KINDS] = { "eye ring", "eye mask", "stem bars", "stem mask" };
+    for(unsigned int i=0; i<NUMBER_OF_KINDS; i++){
+      Kind kind = (Kind) i;
+      unsigned long hits = NumberOfHits( kind );
+      unsigned long lookups = hits + NumberOfMisses( kind );
+      unsigned long bypassed = NumberOfBypassed( kind );
+      if( lookups + bypassed == 0 ){
+        continue;
+      }
+      out << "Template cache " << names[i] << ": " << hits << " hits of " << lookups
+          << " lookups (" << ( lookups > 0 ? 100.0 * hits / lookups : 0.0 ) << "%), "
+          << bypassed << " bypassed" << std::endl;
+    }
+  };
+
+
+
+  private:
+
+    struct Entry{
+      itk::DataObject::Pointer image;
+      ImageType::IndexType anchor;
+    };
+
+
+    TemplateCache(){
+      for(unsigned int i=0; i<NUMBER_OF_KINDS; i++){
+        m_Bypassed[i] = 0;
+      }
+    };
+
+    TemplateCache(const TemplateCache &);
+    TemplateCache &operator=(const TemplateCache &);
+
+
+    //Image sharing the pixels of image, moved by offset pixels
+    template <typename TImage>
+    static typename TImage::Pointer Translate(TImage *image, const typename TImage::OffsetType &offset,
+                                              const typename TImage::PointType &origin){
+      typename TImage::RegionType region = image->GetLargestPossibleRegion();
+      region.SetIndex( region.GetIndex() + offset );
+      typename TImage::Pointer translated = TImage::New();
+      translated->SetRegions( region );
+      translated->SetSpacing( image->GetSpacing() );
+      translated->SetDirection( image->GetDirection() );
+      translated->SetOrigin( origin );
+      translated->SetPixelContainer( image->GetPixelContainer() );
+      return translated;
+    };
+
+
+    LRUCache<std::string, Entry> m_Caches[NUMBER_OF_KINDS];
+    unsigned long m_Bypassed[NUMBER_OF_KINDS];
+    mutable std::mutex m_Mutex;
+
+};
+
+
+#endif
@@ -0,0 +1,200 @@
+//Checks FastMeanSquaresMetric against itk::MeanSquaresImageToImageMetricv4,
+//see FitParameters::fastMetric.
+//
+//The fixed image is the eye ring of a phantom with the registration mask
+//of fitEye, the moving image the phantom. For several affine and
+//similarity transforms near the fit, GetValue and GetValueAndDerivative of
+//both metrics have to agree within a relative tolerance, and the fast
+//metric has to take its fast path. Without valid points both metrics have
+//to behave the same. The exit code is non-zero on any difference or
+//exception.
+
+
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <exception>
+#include <algorithm>
+#include <cmath>
+
+#include "EyeAndStemFitting.h"
+#include "FastMeanSquaresMetric.h"
+#include "PhantomGenerator.h"
+
+
+
+typedef FastMeanSquaresMetric< ImageType, ImageType > FastMetricType;
+
+
+//Both metrics on the same images, mask and moving transform
+struct MetricPair{
+  MetricType::Pointer itk;
+  FastMetricType::Pointer fast;
+};
+
+
+MetricPair createMetrics(ImageType::Pointer fixed, ImageType::Pointer moving,
+                         MaskType::Pointer mask, MetricType::MovingTransformType *transform){
+  MetricPair metrics;
+  metrics.itk = MetricType::New();
+  metrics.fast = FastMetricType::New();
+  MetricType *all[2] = { metrics.itk.GetPointer(), metrics.fast.GetPointer() };
+  for(unsigned int i=0; i<2; i++){
+    all[i]->SetFixedImage( fixed );
+    all[i]->SetMovingImage( moving );
+    all[i]->SetFixedInterpolator( InterpolatorType::New() );
+    all[i]->SetMovingInterpolator( InterpolatorType::New() );
+    all[i]->SetFixedImageMask( mask );
+    all[i]->SetMovingTransform( transform );
+    all[i]->Initialize();
+  }
+  return metrics;
+};
+
+
+bool close(double a, double b, double scale, double tolerance){
+  return std::fabs( a - b ) <= tolerance * std::max( scale, 1e-12 );
+};
+
+
+//Value and derivative of both metrics within tolerance relative to the
+//value and the largest derivative component
+bool sameMetric(const MetricPair &metrics, double tolerance){
+  if( !metrics.fast->IsFastPathSupported() ){
+    std::cerr << "error: fast metric fell back to the superclass" << std::endl;
+    return false;
+  }
+
+  double itkValue = metrics.itk->GetValue();
+  double fastValue = metrics.fast->GetValue();
+  bool same = close( itkValue, fastValue, std::fabs( itkValue ), tolerance );
+
+  MetricType::MeasureType itkMeasure;
+  MetricType::MeasureType fastMeasure;
+  MetricType::DerivativeType itkDerivative;
+  MetricType::DerivativeType fastDerivative;
+  metrics.itk->GetValueAndDerivative( itkMeasure, itkDerivative );
+  metrics.fast->GetValueAndDerivative( fastMeasure, fastDerivative );
+  same = same && close( itkMeasure, fastMeasure, std::fabs( itkMeasure ), tolerance ) &&
+         itkDerivative.GetSize() == fastDerivative.GetSize();
+
+  double scale = 0;
+  for(unsigned int i=0; i<itkDerivative.GetSize(); i++){
+    scale = std::max( scale, std::fabs( itkDerivative[i] ) );
+  }
+  for(unsigned int i=0; i<itkDerivative.GetSize() && same; i++){
+    same = close( itkDerivative[i], fastDerivative[i], scale, tolerance );
+  }
+  if( !same ){
+    std::cerr << "itk " << itkValue << " " << itkDerivative << std::endl;
+    std::cerr << "fast " << fastValue << " " << fastDerivative << std::endl;
+  }
+  return same;
+};
+
+
+//Without valid points both metrics have to throw or give the same value
+//and derivative
+bool sameWithoutValidPoints(const MetricPair &metrics){
+  MetricType *all[2] = { metrics.itk.GetPointer(), metrics.fast.GetPointer() };
+  bool threw[2] = { false, false };
+  MetricType::MeasureType value[2] = { 0, 0 };
+  MetricType::DerivativeType derivative[2];
+  for(unsigned int i=0; i<2; i++){
+    try{
+      all[i]->GetValueAndDerivative( value[i], derivative[i] );
+    }
+    catch(itk::ExceptionObject &){
+      threw[i] = true;
+    }
+  }
+  if( threw[0] || threw[1] ){
+    return threw[0] && threw[1];
+  }
+  return value[0] == value[1] && derivative[0] == derivative[1];
+};
+
+
+bool report(const std::string &name, bool same){
+  std::cout << ( same ? "ok   " : "FAIL " ) << name << std::endl;
+  return same;
+};
+
+
+
+int main(){
+
+  double tolerance = 1e-4;
+
+  PhantomParameters phantomParameters;
+  phantomParameters.width = 320;
+  phantomParameters.height = 240;
+  Phantom phantom = createPhantom( phantomParameters );
+  ImageType::Pointer moving = phantom.image;
+  ImageType::SpacingType spacing = moving->GetSpacing();
+  ImageType::SizeType size = moving->GetLargestPossibleRegion().GetSize();
+  ImageType::PointType origin = moving->GetOrigin();
+  ImageType::PointType center = phantom.eyeCenter;
+
+  //Ring and mask of fitEye, slightly smaller than the phantom eye
+  double r1 = 0.9 * phantom.eyeMinor;
+  double r2 = 0.9 * phantom.eyeMajor;
+  double rf = FitParameters().eyeRingFactor;
+  ImageType::Pointer fixed = CreateEllipseRingImage( spacing, size, origin, center, r1, r2, rf );
+  CastFilter::Pointer castFilter = CastFilter::New();
+  castFilter->SetInput( CreateEllipseImage( spacing, size, origin, center,
+                                            r1*(rf+1)/2, r2*(rf+1)/2, 0, 100 ) );
+  castFilter->Update();
+  MaskType::Pointer mask = MaskType::New();
+  mask->SetImage( castFilter->GetOutput() );
+
+  unsigned int nFailed = 0;
+  try{
+    //Affine: identity, then rotated, scaled, sheared and shifted
+    for(unsigned int i=0; i<3; i++){
+      AffineTransformType::Pointer affine = AffineTransformType::New();
+      affine->SetCenter( center );
+      AffineTransformType::ParametersType parameters = affine->GetParameters();
+      parameters[0] += 0.04 * i;
+      parameters[1] += 0.03 * i;
+      parameters[2] -= 0.02 * i;
+      parameters[3] -= 0.05 * i;
+      parameters[4] += 2.5 * i * spacing[0];
+      parameters[5] -= 1.5 * i * spacing[1];
+      affine->SetParameters( parameters );
+      MetricPair metrics = createMetrics( fixed, moving, mask, affine.GetPointer() );
+      nFailed += !report( "affine " + std::to_string( i ), sameMetric( metrics, tolerance ) );
+    }
+
+    //Similarity: identity, then rotated, scaled and shifted
+    for(unsigned int i=0; i<3; i++){
+      SimilarityTransformType::Pointer similarity = SimilarityTransformType::New();
+      similarity->SetCenter( center );
+      similarity->SetScale( 1.0 + 0.05 * i );
+      similarity->SetAngle( -0.03 * i );
+      SimilarityTransformType::OutputVectorType translation;
+      translation[0] = -2.0 * i * spacing[0];
+      translation[1] = 3.0 * i * spacing[1];
+      similarity->SetTranslation( translation );
+      MetricPair metrics = createMetrics( fixed, moving, mask, similarity.GetPointer() );
+      nFailed += !report( "similarity " + std::to_string( i ), sameMetric( metrics, tolerance ) );
+    }
+
+    //Moving image shifted away from every fixed point
+    AffineTransformType::Pointer away = AffineTransformType::New();
+    away->SetCenter( center );
+    AffineTransformType::OutputVectorType translation;
+    translation[0] = 10.0 * size[0] * spacing[0];
+    translation[1] = 0;
+    away->SetTranslation( translation );
+    MetricPair metrics = createMetrics( fixed, moving, mask, away.GetPointer() );
+    nFailed += !report( "no valid points", sameWithoutValidPoints( metrics ) );
+  }
+  catch(std::exception &e){
+    std::cerr << "error: " << e.what() << std::endl;
+    nFailed++;
+  }
+
+  return nFailed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
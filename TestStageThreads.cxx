@@ -0,0 +1,100 @@
+//Checks that fitEye and fitStem give the same results with their stages in
+//sequence and on concurrent threads, see FitParameters::stageThreads.
+//
+//Phantoms of several sizes and rotations are fitted once with
+//stageThreads=1 as reference and repeatedly with stageThreads=3, for each
+//configuration below. Transform parameters, eye axes and optic nerve width
+//have to match exactly. The exit code is non-zero on any difference or
+//exception.
+
+
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <exception>
+
+#include "EyeAndStemFitting.h"
+#include "PhantomGenerator.h"
+
+
+
+struct StageThreadsFit{
+  Eye eye;
+  Stem stem;
+};
+
+
+StageThreadsFit fitStageThreads(ImageType::Pointer image, FitParameters parameters,
+                                unsigned int stageThreads){
+  parameters.stageThreads = stageThreads;
+  StageThreadsFit fit;
+  fit.eye = fitEye( image, "test", parameters );
+  fit.stem = fitStem( image, fit.eye, "test", parameters );
+  return fit;
+};
+
+
+bool sameFit(const StageThreadsFit &a, const StageThreadsFit &b){
+  return a.eye.status == b.eye.status && a.stem.status == b.stem.status &&
+         a.eye.transformParameters == b.eye.transformParameters &&
+         a.stem.transformParameters == b.stem.transformParameters &&
+         a.eye.center == b.eye.center && a.eye.minor == b.eye.minor &&
+         a.eye.major == b.eye.major && a.stem.width == b.stem.width;
+};
+
+
+
+int main(){
+
+  //Parameter assignments of the configurations, the defaults first
+  std::vector< std::vector<std::string> > configurations;
+  configurations.push_back( std::vector<std::string>() );
+  configurations.push_back( std::vector<std::string>( 1, "eyeHypothesisCenters=3" ) );
+
+  std::vector<PhantomParameters> phantoms;
+  for(unsigned int i=0; i<3; i++){
+    PhantomParameters phantom;
+    phantom.width = 320 + 160 * i;
+    phantom.height = 240 + 120 * i;
+    phantom.rotation = -5.0 + 5.0 * i;
+    phantom.seed = i;
+    phantoms.push_back( phantom );
+  }
+
+  unsigned int repetitions = 5;
+  unsigned int nFailed = 0;
+  for(unsigned int c=0; c<configurations.size(); c++){
+    FitParameters parameters;
+    std::string name = "defaults";
+    for(unsigned int i=0; i<configurations[c].size(); i++){
+      if( !setFitParameter( parameters, configurations[c][i] ) ){
+        std::cerr << "error: invalid parameter " << configurations[c][i] << std::endl;
+        return EXIT_FAILURE;
+      }
+      name = ( i == 0 ? "" : name + " " ) + configurations[c][i];
+    }
+
+    for(unsigned int p=0; p<phantoms.size(); p++){
+      ImageType::Pointer image = createPhantom( phantoms[p] ).image;
+      bool same = true;
+      try{
+        StageThreadsFit reference = fitStageThreads( image, parameters, 1 );
+        for(unsigned int r=0; r<repetitions && same; r++){
+          same = sameFit( reference, fitStageThreads( image, parameters, 3 ) );
+        }
+      }
+      catch(std::exception &e){
+        std::cerr << "error: " << e.what() << std::endl;
+        same = false;
+      }
+      std::cout << ( same ? "ok   " : "FAIL " ) << name << ", phantom "
+                << phantoms[p].width << "x" << phantoms[p].height << std::endl;
+      if( !same ){
+        nFailed++;
+      }
+    }
+  }
+
+  return nFailed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
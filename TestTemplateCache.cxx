@@ -0,0 +1,163 @@
+//Checks that templates shared through TemplateCache do not depend on the
+//lookups before them, see FitParameters::templateCache.
+//
+//For the eye ring and mask and the stem bars and mask, a template is
+//looked up at a first center, which builds and caches it, and then at
+//other centers, which translate the cached template. After clearing the
+//cache the same lookups build the template anew. Regions, origins and
+//pixels have to match exactly. The exit code is non-zero on any
+//difference or exception.
+
+
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <exception>
+#include <functional>
+
+#include "itkImageRegionConstIterator.h"
+
+#include "EyeAndStemFitting.h"
+#include "TemplateCache.h"
+
+
+
+template <typename TImage>
+bool sameTemplate(typename TImage::Pointer a, typename TImage::Pointer b){
+  typename TImage::RegionType region = a->GetLargestPossibleRegion();
+  if( region != b->GetLargestPossibleRegion() || a->GetOrigin() != b->GetOrigin() ||
+      a->GetSpacing() != b->GetSpacing() ){
+    return false;
+  }
+  itk::ImageRegionConstIterator<TImage> itA( a, region );
+  itk::ImageRegionConstIterator<TImage> itB( b, region );
+  for(; !itA.IsAtEnd(); ++itA, ++itB){
+    if( itA.Get() != itB.Get() ){
+      return false;
+    }
+  }
+  return true;
+};
+
+
+//Template at each center after a lookup at the first center and after
+//clearing the cache, the first lookup has to be cached
+template <typename TImage>
+bool sameTranslated(const std::vector<int> &centers,
+                    const std::function<typename TImage::Pointer(int)> &lookup){
+  TemplateCache &cache = TemplateCache::Instance();
+  bool same = true;
+  for(unsigned int i=1; i<centers.size() && same; i++){
+    cache.Clear();
+    lookup( centers[0] );
+    typename TImage::Pointer translated = lookup( centers[i] );
+    cache.Clear();
+    typename TImage::Pointer built = lookup( centers[i] );
+    same = sameTemplate<TImage>( translated, built );
+  }
+  return same;
+};
+
+
+bool report(const std::string &name, bool same, TemplateCache::Kind kind,
+            unsigned long hitsBefore){
+  //Every other lookup is a hit, nothing may bypass the cache
+  same = same && TemplateCache::Instance().NumberOfHits( kind ) > hitsBefore &&
+         TemplateCache::Instance().NumberOfBypassed( kind ) == 0;
+  std::cout << ( same ? "ok   " : "FAIL " ) << name << std::endl;
+  return same;
+};
+
+
+
+int main(){
+
+  FitParameters parameters;
+  parameters.templateCache = true;
+
+  ImageType::SpacingType spacing;
+  spacing[0] = 0.1;
+  spacing[1] = 0.1;
+  ImageType::SizeType size;
+  size[0] = 640;
+  size[1] = 480;
+  ImageType::PointType origin;
+  origin[0] = -3.2;
+  origin[1] = 1.7;
+
+  double r1 = 8;
+  double r2 = 6;
+  double rf = parameters.eyeRingFactor;
+
+  //Eye centers on the diagonal, the first away from the build anchor
+  std::vector<int> eyeCenters;
+  eyeCenters.push_back( 170 );
+  eyeCenters.push_back( 200 );
+  eyeCenters.push_back( 231 );
+  eyeCenters.push_back( 263 );
+
+  //Stem centers as columns of the region
+  ImageType::IndexType regionIndex;
+  regionIndex.Fill( 0 );
+  ImageType::SizeType regionSize;
+  regionSize[0] = 200;
+  regionSize[1] = 120;
+  ImageType::RegionType region( regionIndex, regionSize );
+  std::vector<int> stemCenters;
+  stemCenters.push_back( 80 );
+  stemCenters.push_back( 93 );
+  stemCenters.push_back( 100 );
+  stemCenters.push_back( 121 );
+
+  std::function<ImageType::IndexType(int)> eyeIndex = [&](int c){
+    ImageType::IndexType index;
+    index[0] = c;
+    index[1] = c;
+    return index;
+  };
+  std::function<ImageType::PointType(int)> eyePoint = [&](int c){
+    ImageType::PointType point;
+    for(unsigned int i=0; i<2; i++){
+      point[i] = origin[i] + spacing[i] * c;
+    }
+    return point;
+  };
+
+  TemplateCache &cache = TemplateCache::Instance();
+  unsigned int nFailed = 0;
+  try{
+    unsigned long hits = cache.NumberOfHits( TemplateCache::EYE_RING );
+    bool same = sameTranslated<ImageType>( eyeCenters, [&](int c){
+      return eyeRingTemplate( spacing, size, origin, eyePoint( c ), eyeIndex( c ),
+                              r1, r2, rf, parameters );
+    } );
+    nFailed += !report( "eye ring", same, TemplateCache::EYE_RING, hits );
+
+    hits = cache.NumberOfHits( TemplateCache::EYE_MASK );
+    same = sameTranslated<ImageType>( eyeCenters, [&](int c){
+      return eyeMaskTemplate( spacing, size, origin, eyePoint( c ), eyeIndex( c ),
+                              r1, r2, rf, parameters );
+    } );
+    nFailed += !report( "eye mask", same, TemplateCache::EYE_MASK, hits );
+
+    hits = cache.NumberOfHits( TemplateCache::STEM_BARS );
+    same = sameTranslated<ImageType>( stemCenters, [&](int c){
+      return stemBarsTemplate( region, spacing, origin, c, 20, c - 40, c - 25,
+                               c + 25, c + 40, parameters );
+    } );
+    nFailed += !report( "stem bars", same, TemplateCache::STEM_BARS, hits );
+
+    hits = cache.NumberOfHits( TemplateCache::STEM_MASK );
+    same = sameTranslated<UnsignedCharImageType>( stemCenters, [&](int c){
+      return stemMaskTemplate( region, spacing, origin, c, 20, c - 40, c + 40, parameters );
+    } );
+    nFailed += !report( "stem mask", same, TemplateCache::STEM_MASK, hits );
+  }
+  catch(std::exception &e){
+    std::cerr << "error: " << e.what() << std::endl;
+    nFailed++;
+  }
+
+  return nFailed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
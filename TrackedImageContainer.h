@@ -0,0 +1,142 @@
+#ifndef TRACKEDIMAGECONTAINER_H
+#define TRACKEDIMAGECONTAINER_H
+
+
+//Pixel container reporting its allocations to MemoryTracker.
+//
+//installMemoryTracking registers an object factory override so that every
+//itk::Image of the tracked pixel types created afterwards allocates its
+//buffer through TrackedImportImageContainer. Install it before the first
+//image is created, buffers created earlier are not accounted.
+
+
+#include "itkImportImageContainer.h"
+#include "itkObjectFactoryBase.h"
+#include "itkCreateObjectFunction.h"
+#include "itkVersion.h"
+#include "itkRGBPixel.h"
+#include "itkCovariantVector.h"
+
+#include <typeinfo>
+
+#include "MemoryTracker.h"
+
+
+template <typename TElementIdentifier, typename TElement>
+class TrackedImportImageContainer :
+  public itk::ImportImageContainer<TElementIdentifier, TElement>{
+
+  public:
+
+    typedef TrackedImportImageContainer Self;
+    typedef itk::ImportImageContainer<TElementIdentifier, TElement> Superclass;
+    typedef itk::SmartPointer<Self> Pointer;
+    typedef itk::SmartPointer<const Self> ConstPointer;
+
+    typedef typename Superclass::ElementIdentifier ElementIdentifier;
+
+  itkNewMacro( Self );
+  itkTypeMacro( TrackedImportImageContainer, ImportImageContainer );
+
+
+  protected:
+
+    TrackedImportImageContainer() {};
+
+    //The base destructor can not dispatch to the override
+    ~TrackedImportImageContainer(){
+      DeallocateManagedMemory();
+    };
+
+    TElement *AllocateElements(ElementIdentifier size, bool useDefaultConstructor) const override{
+      TElement *data = Superclass::AllocateElements( size, useDefaultConstructor );
+      MemoryTracker::Instance().Allocated( (long long) size * sizeof(TElement) );
+      return data;
+    };
+
+    void DeallocateManagedMemory() override{
+      if( this->GetContainerManageMemory() && this->GetImportPointer() != NULL ){
+        MemoryTracker::Instance().Freed( (long long) this->Capacity() * sizeof(TElement) );
+      }
+      Superclass::DeallocateManagedMemory();
+    };
+
+
+  private:
+
+    TrackedImportImageContainer(const Self &);
+    void operator=(const Self &);
+
+};
+
+
+
+class TrackedImageContainerFactory : public itk::ObjectFactoryBase{
+
+  public:
+
+    typedef TrackedImageContainerFactory Self;
+    typedef itk::ObjectFactoryBase Superclass;
+    typedef itk::SmartPointer<Self> Pointer;
+
+  itkFactorylessNewMacro( Self );
+  itkTypeMacro( TrackedImageContainerFactory, ObjectFactoryBase );
+
+  const char *GetITKSourceVersion() const override{
+    return ITK_SOURCE_VERSION;
+  };
+
+  const char *GetDescription() const override{
+    return "Pixel containers reporting to MemoryTracker";
+  };
+
+
+  protected:
+
+    TrackedImageContainerFactory(){
+      Override<float>();
+      Override<double>();
+      Override<unsigned char>();
+      Override<short>();
+      Override<unsigned short>();
+      Override<int>();
+      Override<unsigned int>();
+      Override<long>();
+      Override<unsigned long>();
+      Override< itk::RGBPixel<unsigned char> >();
+      Override< itk::CovariantVector<float, 2> >();
+      Override< itk::CovariantVector<double, 2> >();
+    };
+
+
+  private:
+
+    template <typename TElement>
+    void Override(){
+      typedef itk::ImportImageContainer<itk::SizeValueType, TElement> Container;
+      typedef TrackedImportImageContainer<itk::SizeValueType, TElement> TrackedContainer;
+      this->RegisterOverride( typeid(Container).name(), typeid(TrackedContainer).name(),
+                              "Tracked pixel container", true,
+                              itk::CreateObjectFunction<TrackedContainer>::New() );
+    };
+
+    TrackedImageContainerFactory(const Self &);
+    void operator=(const Self &);
+
+};
+
+
+
+//Register the factory once and enable MemoryTracker
+inline void installMemoryTracking(){
+  static bool installed = false;
+  if( !installed ){
+    TrackedImageContainerFactory::Pointer factory = TrackedImageContainerFactory::New();
+    itk::ObjectFactoryBase::RegisterFactory( factory );
+    installed = true;
+  }
+  MemoryTracker::Instance().SetEnabled( true );
+};
+
+
+#endif
@@ -0,0 +1,271 @@
+#include "WorkQueue.h"
+
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <functional>
+#include <cstdio>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <utime.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+
+
+static double modificationTime(const struct stat &st){
+  return st.st_mtim.tv_sec + 1e-9 * st.st_mtim.tv_nsec;
+};
+
+
+
+WorkQueue::WorkQueue(const std::string &directory, const std::string &worker,
+                     double leaseSeconds, unsigned int maxAttempts)
+                    : m_Directory( directory ), m_Worker( worker ),
+                      m_Lease( leaseSeconds ), m_MaxAttempts( maxAttempts ),
+                      m_Cursor( std::hash<std::string>()( worker ) ),
+                      m_Stopped( false ){
+  mkdir( m_Directory.c_str(), 0777 );
+  m_Heartbeat = std::thread( &WorkQueue::Heartbeat, this );
+};
+
+
+
+WorkQueue::~WorkQueue(){
+  {
+    std::lock_guard<std::mutex> lock( m_Mutex );
+    m_Stopped = true;
+  }
+  m_Stop.notify_all();
+  m_Heartbeat.join();
+  unlink( ( m_Directory + "/clock." + m_Worker ).c_str() );
+};
+
+
+
+std::string WorkQueue::DefaultWorker(){
+  char host[256] = "";
+  gethostname( host, sizeof(host) - 1 );
+  std::stringstream worker;
+  worker << host << "-" << getpid();
+  return worker.str();
+};
+
+
+
+std::string WorkQueue::Filename(unsigned int item, const char *suffix) const{
+  std::stringstream filename;
+  filename << m_Directory << "/" << item << suffix;
+  return filename.str();
+};
+
+
+
+double WorkQueue::Now() const{
+  std::string clock = m_Directory + "/clock." + m_Worker;
+  int fd = open( clock.c_str(), O_CREAT | O_WRONLY, 0666 );
+  if( fd >= 0 ){
+    close( fd );
+  }
+  utime( clock.c_str(), NULL );
+  struct stat st;
+  if( stat( clock.c_str(), &st ) != 0 ){
+    return 0;
+  }
+  return modificationTime( st );
+};
+
+
+
+bool WorkQueue::IsDone(unsigned int item) const{
+  struct stat st;
+  return stat( Filename( item, ".done" ).c_str(), &st ) == 0;
+};
+
+
+
+WorkQueue::ClaimResult WorkQueue::Claim(unsigned int item){
+  if( IsDone( item ) ){
+    return TAKEN;
+  }
+
+  std::string claim = Filename( item, ".claim" );
+  unsigned int attempt = 1;
+  int fd = open( claim.c_str(), O_CREAT | O_EXCL | O_WRONLY, 0666 );
+  if( fd < 0 ){
+    if( errno != EEXIST ){
+      return TAKEN;
+    }
+    struct stat st;
+    if( stat( claim.c_str(), &st ) != 0 || Now() - modificationTime( st ) < m_Lease ){
+      return TAKEN;
+    }
+
+    //Stale claim, only one worker succeeds in renaming it away
+    std::string stale = claim + ".stale." + m_Worker;
+    if( std::rename( claim.c_str(), stale.c_str() ) != 0 ){
+      return TAKEN;
+    }
+
+    //Between the stat and the rename another worker may have taken over 
+    //the claim and created a new one, or the owner touched it. Only the
+    //claim found stale is taken over, anything else is put back unless a
+    //new claim exists already.
+    struct stat renamed;
+    if( stat( stale.c_str(), &renamed ) != 0 ){
+      return TAKEN;
+    }
+    if( renamed.st_dev != st.st_dev || renamed.st_ino != st.st_ino ||
+        modificationTime( renamed ) != modificationTime( st ) ){
+      if( link( stale.c_str(), claim.c_str() ) == 0 ){
+        utime( claim.c_str(), NULL );
+      }
+      unlink( stale.c_str() );
+      return TAKEN;
+    }
+    std::ifstream in( stale.c_str() );
+    unsigned int previous = 0;
+    in >> previous;
+    in.close();
+    unlink( stale.c_str() );
+    attempt = previous + 1;
+
+    if( attempt > m_MaxAttempts ){
+      std::stringstream result;
+      result << "Item " << item << " failed after " << previous << " attempts" << std::endl;
+      WriteResult( item, result.str() );
+      return ABANDONED;
+    }
+
+    fd = open( claim.c_str(), O_CREAT | O_EXCL | O_WRONLY, 0666 );
+    if( fd < 0 ){
+      return TAKEN;
+    }
+  }
+
+  std::stringstream content;
+  content << attempt << " " << m_Worker << std::endl;
+  std::string s = content.str();
+  bool written = write( fd, s.data(), s.size() ) == (ssize_t) s.size();
+  close( fd );
+
+  //Completed between the check and the claim, or the claim is unusable
+  if( !written || IsDone( item ) ){
+    unlink( claim.c_str() );
+    return TAKEN;
+  }
+
+  std::lock_guard<std::mutex> lock( m_Mutex );
+  m_Claims.insert( item );
+  return CLAIMED;
+};
+
+
+
+bool WorkQueue::Next(unsigned int n, unsigned int &item){
+  if( n == 0 ){
+    return false;
+  }
+  while( true ){
+    bool open = false;
+    for(unsigned int k=0; k<n; k++){
+      unsigned int i = ( m_Cursor + k ) % n;
+      ClaimResult result = Claim( i );
+      if( result == CLAIMED ){
+        item = i;
+        m_Cursor = i + 1;
+        return true;
+      }
+      if( result == TAKEN && !IsDone( i ) ){
+        open = true;
+      }
+    }
+    if( !open ){
+      return false;
+    }
+    //Remaining items are claimed by other workers, wait for them to
+    //finish or for their claims to expire
+    std::this_thread::sleep_for( std::chrono::duration<double>( m_Lease / 4 ) );
+  }
+};
+
+
+
+bool WorkQueue::WriteResult(unsigned int item, const std::string &result) const{
+  std::string done = Filename( item, ".done" );
+  std::string tmp = done + ".tmp." + m_Worker;
+  {
+    std::ofstream out( tmp.c_str() );
+    out << result;
+    if( !out ){
+      out.close();
+      unlink( tmp.c_str() );
+      return false;
+    }
+  }
+  if( std::rename( tmp.c_str(), done.c_str() ) != 0 ){
+    unlink( tmp.c_str() );
+    return false;
+  }
+  return true;
+};
+
+
+
+bool WorkQueue::Complete(unsigned int item, const std::string &result){
+  bool written = WriteResult( item, result );
+  {
+    std::lock_guard<std::mutex> lock( m_Mutex );
+    if( m_Claims.erase( item ) == 0 ){
+      return written;
+    }
+  }
+  //A claim lost to another worker after a missed heartbeat is theirs now,
+  //it is released by them
+  std::ifstream in( Filename( item, ".claim" ).c_str() );
+  unsigned int attempt;
+  std::string worker;
+  if( in >> attempt >> worker && worker == m_Worker ){
+    in.close();
+    unlink( Filename( item, ".claim" ).c_str() );
+  }
+  return written;
+};
+
+
+
+bool WorkQueue::Merge(unsigned int n, const std::string &filename) const{
+  for(unsigned int i=0; i<n; i++){
+    if( !IsDone( i ) ){
+      return false;
+    }
+  }
+  std::string tmp = filename + ".tmp." + m_Worker;
+  {
+    std::ofstream out( tmp.c_str() );
+    for(unsigned int i=0; i<n; i++){
+      std::ifstream in( Filename( i, ".done" ).c_str() );
+      out << in.rdbuf();
+    }
+    if( !out ){
+      out.close();
+      unlink( tmp.c_str() );
+      return false;
+    }
+  }
+  return std::rename( tmp.c_str(), filename.c_str() ) == 0;
+};
+
+
+
+void WorkQueue::Heartbeat(){
+  std::unique_lock<std::mutex> lock( m_Mutex );
+  while( !m_Stopped ){
+    m_Stop.wait_for( lock, std::chrono::duration<double>( m_Lease / 4 ) );
+    for(std::set<unsigned int>::iterator it = m_Claims.begin(); it != m_Claims.end(); ++it){
+      utime( Filename( *it, ".claim" ).c_str(), NULL );
+    }
+  }
+};
@@ -0,0 +1,103 @@
+#ifndef WORKQUEUE_H
+#define WORKQUEUE_H
+
+
+//Work queue shared by several processes, possibly on several machines,
+//through a directory on a shared filesystem.
+//
+//The items are the lines 0 to n-1 of a manifest all workers agree on. A
+//worker claims item i by creating <directory>/<i>.claim exclusively
+//(O_CREAT | O_EXCL), so each item is claimed by exactly one worker and
+//workers take new items as they finish, slow items do not hold up other
+//work. The result of an item is written to a temporary file and renamed
+//to <i>.done.
+//
+//While a worker holds claims a background thread touches them every
+//quarter lease. A claim not touched for a lease belongs to a crashed
+//worker: it is renamed to a name unique to the worker, which only one 
+//worker can do, and claimed again if the renamed file is still the claim
+//found stale. Ages are measured against the modification time of a file the
+//worker touches itself, so clocks of different machines need not agree.
+//Items claimed maxAttempts times without completing are completed with a
+//failure message instead of crashing further workers.
+//
+//Merge concatenates all results in manifest order once all items are
+//done.
+
+
+#include <string>
+#include <set>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+
+class WorkQueue{
+
+  public:
+
+  WorkQueue(const std::string &directory, const std::string &worker,
+            double leaseSeconds = 60, unsigned int maxAttempts = 3);
+
+  ~WorkQueue();
+
+
+  //Claim an open item of n, waits while the only open items are claimed
+  //by live workers. Returns false once all items are done.
+  bool Next(unsigned int n, unsigned int &item);
+
+  //Store the result and release the claim of item
+  bool Complete(unsigned int item, const std::string &result);
+
+  //Write all results in item order to filename, returns false if not all
+  //n items are done
+  bool Merge(unsigned int n, const std::string &filename) const;
+
+  bool IsDone(unsigned int item) const;
+
+  //Default worker name, host name and process id
+  static std::string DefaultWorker();
+
+
+
+  private:
+
+    enum ClaimResult{
+      CLAIMED,
+      //Done or claimed by a live worker
+      TAKEN,
+      //Claim given up after maxAttempts, item completed as failed
+      ABANDONED
+    };
+
+    ClaimResult Claim(unsigned int item);
+
+    //Write the result of item without touching claims
+    bool WriteResult(unsigned int item, const std::string &result) const;
+
+    //Modification time of a freshly touched file, the time of the
+    //filesystem
+    double Now() const;
+
+    void Heartbeat();
+
+    std::string Filename(unsigned int item, const char *suffix) const;
+
+
+    std::string m_Directory;
+    std::string m_Worker;
+    double m_Lease;
+    unsigned int m_MaxAttempts;
+    //Item the scan for open items starts at
+    unsigned int m_Cursor;
+
+    std::mutex m_Mutex;
+    std::condition_variable m_Stop;
+    bool m_Stopped;
+    std::set<unsigned int> m_Claims;
+    std::thread m_Heartbeat;
+
+};
+
+
+#endif
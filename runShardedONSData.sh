@@ -0,0 +1,25 @@
+# Processes the images of runAllONSData.sh with several workers sharing a
+# work queue directory. Each run uses its own queue directory
+# ./processed/queue-<run>, so results of earlier runs are never merged.
+# Workers on other machines can join by running the same command with the
+# same run name on the shared directory, results are merged into
+# ./processed/queue-<run>/results.txt.
+#
+#   runShardedONSData.sh [workers] [run]
+WORKERS=${1:-4}
+RUN=${2:-$(date +%Y%m%d-%H%M%S)}
+QUEUE=./processed/queue-$RUN
+
+mkdir -p ./processed
+rm -f ./processed/manifest.txt
+for i in $(seq -f "%03g" 1 23); do
+  echo "$i.PNG ./processed/$i" >> ./processed/manifest.txt
+done
+
+echo "Run $RUN, queue $QUEUE"
+for w in $(seq 1 $WORKERS); do
+  ../Code/bin/EstimateEyeAndStem -b ./processed/manifest.txt --queue $QUEUE > ./processed/worker-$RUN-$w.txt &
+done
+wait
+
+awk  '/Estimated optic nerve width: /{print $NF}' $QUEUE/results.txt